@@ -0,0 +1,160 @@
+#include "adaptive_filters.h"
+#include "integral_image.h"
+#include "pixel_access.h"
+#include "filter_progress.h"
+
+#include <cmath>
+
+/******************************************************************************
+ * Filters that adapt to the statistics of the window around each pixel. The
+ * window means and deviations come from a summed-area table, so the cost does
+ * not depend on the radius.
+ *****************************************************************************/
+
+/******************************************************************************
+ * Function: local_statistics
+ * Description: The mean and standard deviation of the gray values in the
+ *  window around a pixel, from a gray table with squares.
+ *****************************************************************************/
+static inline void local_statistics(const IntegralImage& sums, int c, int r, int radius,
+                                    double area, double& mean, double& deviation)
+{
+    quint64 sum[2];
+    sums.clamped_sum(c, r, radius, sum);
+
+    mean = sum[0] / area;
+    double variance = sum[1] / area - mean * mean;
+    deviation = variance > 0 ? sqrt(variance) : 0;
+}
+
+/******************************************************************************
+ * Function: local_contrast
+ * Description: Evens out the contrast across an image: each pixel's gray is
+ *  pushed away from the mean of its window in proportion to how flat the
+ *  window is, and the same change is added to its red, green and blue.
+ * Parameters:
+ *   image - the image to process on
+ *   thread_count - the number of threads to use
+ *   params - the window radius, the standard deviation to aim for and the
+ *    largest gain
+ * Returns: The new image.
+ *****************************************************************************/
+QImage* local_contrast(const QImage& image, int thread_count, const LocalContrastParams& params)
+{
+    ScheduleScope schedule("local_contrast");
+
+    QImage source = to_argb32(image);
+    IntegralImage sums(source, IntegralImage::SOURCE_GRAY, true, thread_count);
+
+    QImage* newImage = new_output_image(source.size(), thread_count);
+    QSize size = newImage->size();
+
+    ConstScanlines in(source);
+    Scanlines out(*newImage);
+
+    int radius = qMax(0, params.radius);
+    double area = (double)(2 * radius + 1) * (2 * radius + 1);
+    double target = params.target;
+    double maxGain = params.maxGain;
+
+    FilterProgress* progress = FilterProgress::current();
+    progress_add_work(progress, size.height());
+
+#   pragma omp parallel for num_threads(thread_count) schedule(runtime) default(none) \
+        shared(progress, size, sums, in, out, radius, area, target, maxGain)
+    for(int r = 0; r < size.height(); r++)
+    {
+        if(progress_cancelled(progress))
+            continue;
+
+        const QRgb* src = in[r];
+        QRgb* dst = out[r];
+
+        for(int c = 0; c < size.width(); c++)
+        {
+            double mean, deviation;
+            local_statistics(sums, c, r, radius, area, mean, deviation);
+
+            double gain = deviation * maxGain > target ? target / deviation : maxGain;
+
+            int gray = (qRed(src[c]) + qGreen(src[c]) + qBlue(src[c])) / 3;
+            int change = qRound(mean + gain * (gray - mean)) - gray;
+
+            dst[c] = qRgb(qBound(0, qRed(src[c]) + change, 255),
+                          qBound(0, qGreen(src[c]) + change, 255),
+                          qBound(0, qBlue(src[c]) + change, 255));
+        }
+
+        progress_advance(progress);
+    }
+
+    return newImage;
+}
+
+QImage* local_contrast(const QImage& image, int thread_count)
+{
+    return local_contrast(image, thread_count, LocalContrastParams());
+}
+
+/******************************************************************************
+ * Function: adaptive_threshold
+ * Description: Turns an image black and white with a threshold that follows
+ *  the local brightness, so text and edges survive uneven lighting that a
+ *  single binary threshold cannot.
+ * Parameters:
+ *   image - the image to process on
+ *   thread_count - the number of threads to use
+ *   params - the window radius and Sauvola's k
+ * Returns: The black and white image.
+ *****************************************************************************/
+QImage* adaptive_threshold(const QImage& image, int thread_count, const AdaptiveThresholdParams& params)
+{
+    ScheduleScope schedule("adaptive_threshold");
+
+    QImage source = to_argb32(image);
+    IntegralImage sums(source, IntegralImage::SOURCE_GRAY, true, thread_count);
+
+    QImage* newImage = new_output_image(source.size(), thread_count);
+    QSize size = newImage->size();
+
+    ConstScanlines in(source);
+    Scanlines out(*newImage);
+
+    int radius = qMax(0, params.radius);
+    double area = (double)(2 * radius + 1) * (2 * radius + 1);
+    double k = params.k;
+
+    FilterProgress* progress = FilterProgress::current();
+    progress_add_work(progress, size.height());
+
+#   pragma omp parallel for num_threads(thread_count) schedule(runtime) default(none) \
+        shared(progress, size, sums, in, out, radius, area, k)
+    for(int r = 0; r < size.height(); r++)
+    {
+        if(progress_cancelled(progress))
+            continue;
+
+        const QRgb* src = in[r];
+        QRgb* dst = out[r];
+
+        for(int c = 0; c < size.width(); c++)
+        {
+            double mean, deviation;
+            local_statistics(sums, c, r, radius, area, mean, deviation);
+
+            double threshold = mean * (1 + k * (deviation / 128 - 1));
+            int gray = (qRed(src[c]) + qGreen(src[c]) + qBlue(src[c])) / 3;
+
+            dst[c] = gray > threshold ? qRgb(255, 255, 255) : qRgb(0, 0, 0);
+        }
+
+        progress_advance(progress);
+    }
+
+    return newImage;
+}
+
+QImage* adaptive_threshold(const QImage& image, int thread_count)
+{
+    return adaptive_threshold(image, thread_count, AdaptiveThresholdParams());
+}
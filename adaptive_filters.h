@@ -0,0 +1,51 @@
+#ifndef ADAPTIVE_FILTERS_H
+#define ADAPTIVE_FILTERS_H
+
+#include <QImage>
+
+/******************************************************************************
+ * Struct: LocalContrastParams
+ * Description: local_contrast() stretches each pixel's difference from the
+ *  mean gray of the (2*radius+1)^2 window around it by target / the window's
+ *  standard deviation, but never by more than maxGain, so flat areas do not
+ *  turn into amplified noise.
+ *****************************************************************************/
+struct LocalContrastParams
+{
+    explicit LocalContrastParams(int radius = 16, double target = 48, double maxGain = 4) :
+        radius(radius),
+        target(target),
+        maxGain(maxGain)
+    {
+    }
+
+    int radius;
+    double target;
+    double maxGain;
+};
+
+/******************************************************************************
+ * Struct: AdaptiveThresholdParams
+ * Description: adaptive_threshold() compares each pixel's gray with a
+ *  threshold from the (2*radius+1)^2 window around it, Sauvola's
+ *  mean * (1 + k * (deviation / 128 - 1)); a larger k darkens more.
+ *****************************************************************************/
+struct AdaptiveThresholdParams
+{
+    explicit AdaptiveThresholdParams(int radius = 15, double k = 0.2) :
+        radius(radius),
+        k(k)
+    {
+    }
+
+    int radius;
+    double k;
+};
+
+QImage* local_contrast(const QImage& image, int thread_count);
+QImage* local_contrast(const QImage& image, int thread_count, const LocalContrastParams& params);
+
+QImage* adaptive_threshold(const QImage& image, int thread_count);
+QImage* adaptive_threshold(const QImage& image, int thread_count, const AdaptiveThresholdParams& params);
+
+#endif // ADAPTIVE_FILTERS_H
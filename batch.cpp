@@ -0,0 +1,416 @@
+#include "batch.h"
+#include "buffer_pool.h"
+#include "filter_registry.h"
+#include "streaming.h"
+#include "qt_compat.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QHash>
+#include <QImage>
+
+#include <omp.h>
+
+#include <cstdio>
+
+/******************************************************************************
+ * Struct: BatchOptions
+ * Description: The parsed command line of a batch run.
+ *****************************************************************************/
+struct BatchOptions
+{
+    QStringList ops;
+    QStringList inputs;
+    QString output;
+    int threads;
+    int jobs;
+    bool stream;
+    int stripRows;
+    int poolLimit;          // in MB, -1 for the default
+};
+
+static void print_usage()
+{
+    fprintf(stderr,
+            "Usage: prog4 --ops filter[,filter...] --input <file|dir|glob> [--input ...]\n"
+            "             --output <dir|pattern> [--threads N] [--jobs N]\n"
+            "             [--stream [--strip-rows N]] [--pool-limit MB]\n"
+            "       prog4 --list-ops\n"
+            "\n"
+            "  --ops      filters to apply to every image, in order\n"
+            "  --input    an image, a directory of images, or a glob such as 'images/*.jpg'\n"
+            "  --output   a directory, or a file pattern where * is replaced by the input\n"
+            "             file's base name, such as 'out/*_edges.png'\n"
+            "  --threads  total threads to use (default: all processors)\n"
+            "  --jobs     images processed at once (default: min(images, threads));\n"
+            "             each image gets threads/jobs threads for its filters\n"
+            "  --stream   process images a strip at a time instead of loading them, for\n"
+            "             images larger than memory; point and kernel filters only,\n"
+            "             input must be .ppm/.pgm, output is written as .ppm\n"
+            "  --strip-rows  output rows per strip when streaming (default: about 32 MB)\n"
+            "  --pool-limit  MB of freed image buffers kept for reuse (default: 1024,\n"
+            "             0 to free them at once)\n");
+}
+
+/******************************************************************************
+ * Function: is_batch_invocation
+ * Description: Decides from the raw arguments whether prog4 should run
+ *  headless. This has to happen before any QApplication exists, since
+ *  creating one needs a display.
+ * Parameters:
+ *   argc - the argument count from main
+ *   argv - the arguments from main
+ * Returns: true if a batch mode option was given.
+ *****************************************************************************/
+bool is_batch_invocation(int argc, char *argv[])
+{
+    for(int i = 1; i < argc; i++)
+    {
+        QString arg = QString::fromLocal8Bit(argv[i]);
+
+        if(arg == "--ops" || arg.startsWith("--ops=") || arg == "--list-ops" || arg == "--help")
+            return true;
+    }
+
+    return false;
+}
+
+/******************************************************************************
+ * Function: parse_options
+ * Description: Parses "--name value" and "--name=value" options.
+ * Parameters:
+ *   arguments - the application arguments, including the program name
+ *   options - receives the parsed options
+ * Returns: true if the command line was valid.
+ *****************************************************************************/
+static bool parse_options(const QStringList& arguments, BatchOptions& options)
+{
+    options.threads = 0;
+    options.jobs = 0;
+    options.stream = false;
+    options.stripRows = 0;
+    options.poolLimit = -1;
+
+    for(int i = 1; i < arguments.size(); i++)
+    {
+        QString name = arguments[i];
+        QString value;
+
+        if(name == "--stream")
+        {
+            options.stream = true;
+            continue;
+        }
+
+        int equals = name.indexOf('=');
+        if(equals >= 0)
+        {
+            value = name.mid(equals + 1);
+            name = name.left(equals);
+        }
+        else if(i + 1 < arguments.size())
+        {
+            value = arguments[++i];
+        }
+        else
+        {
+            fprintf(stderr, "Missing value for %s\n", name.toLocal8Bit().constData());
+            return false;
+        }
+
+        bool ok = true;
+
+        if(name == "--ops")
+            options.ops += value.split(',', SKIP_EMPTY_PARTS);
+        else if(name == "--input")
+            options.inputs << value;
+        else if(name == "--output")
+            options.output = value;
+        else if(name == "--threads")
+            options.threads = value.toInt(&ok);
+        else if(name == "--jobs")
+            options.jobs = value.toInt(&ok);
+        else if(name == "--strip-rows")
+            options.stripRows = value.toInt(&ok);
+        else if(name == "--pool-limit")
+            options.poolLimit = value.toInt(&ok);
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", name.toLocal8Bit().constData());
+            return false;
+        }
+
+        if(!ok)
+        {
+            fprintf(stderr, "Invalid value for %s: %s\n", name.toLocal8Bit().constData(), value.toLocal8Bit().constData());
+            return false;
+        }
+    }
+
+    if(options.ops.isEmpty() || options.inputs.isEmpty() || options.output.isEmpty())
+    {
+        print_usage();
+        return false;
+    }
+
+    return true;
+}
+
+/******************************************************************************
+ * Function: expand_input
+ * Description: Turns one --input value into the image files it names. A
+ *  directory yields its png, jpg, bmp, ppm and pgm files; a path whose file
+ *  name has wildcards is matched against the files in its directory.
+ * Parameters:
+ *   input - the --input value
+ * Returns: The matching files, sorted by name.
+ *****************************************************************************/
+static QStringList expand_input(const QString& input)
+{
+    QFileInfo info(input);
+    QDir dir;
+    QStringList patterns;
+
+    if(info.isDir())
+    {
+        dir = QDir(input);
+        patterns << "*.png" << "*.jpg" << "*.jpeg" << "*.bmp" << "*.ppm" << "*.pgm";
+    }
+    else if(info.fileName().contains('*') || info.fileName().contains('?') || info.fileName().contains('['))
+    {
+        dir = info.dir();
+        patterns << info.fileName();
+    }
+    else
+    {
+        return QStringList(input);
+    }
+
+    QStringList files;
+    QStringList names = dir.entryList(patterns, QDir::Files, QDir::Name);
+
+    for(int i = 0; i < names.size(); i++)
+        files << dir.filePath(names[i]);
+
+    return files;
+}
+
+/******************************************************************************
+ * Function: output_path
+ * Description: Where the result for an input file is written.
+ * Parameters:
+ *   output - the --output value, a directory or a pattern containing *
+ *   input - the input file
+ *   stream - streamed output is always PPM, so a directory gets .ppm files
+ * Returns: The output file path.
+ *****************************************************************************/
+static QString output_path(const QString& output, const QString& input, bool stream)
+{
+    QFileInfo info(input);
+
+    if(output.contains('*'))
+    {
+        QString path = output;
+        return path.replace("*", info.completeBaseName());
+    }
+
+    if(stream)
+        return QDir(output).filePath(info.completeBaseName() + ".ppm");
+
+    return QDir(output).filePath(info.fileName());
+}
+
+/******************************************************************************
+ * Function: process_image
+ * Description: Loads one image, runs the filter chain over it and saves the
+ *  result.
+ * Parameters:
+ *   input - the file to read
+ *   output - the file to write
+ *   pipeline - the filter chain
+ *   thread_count - the number of threads the chain may use
+ * Returns: true on success.
+ *****************************************************************************/
+static bool process_image(const QString& input, const QString& output,
+                          const Pipeline& pipeline, int thread_count)
+{
+    double start = omp_get_wtime();
+
+    QImage* image = new QImage(input);
+
+    if(image->isNull())
+    {
+        fprintf(stderr, "Unable to load image %s\n", input.toLocal8Bit().constData());
+        delete image;
+        return false;
+    }
+
+    QImage* newImage = pipeline.run(*image, thread_count);
+    delete image;
+    image = newImage;
+
+    bool saved = image->save(output);
+    delete image;
+
+    if(!saved)
+    {
+        fprintf(stderr, "Unable to save image %s\n", output.toLocal8Bit().constData());
+        return false;
+    }
+
+    printf("%s -> %s (%f seconds)\n", input.toLocal8Bit().constData(),
+           output.toLocal8Bit().constData(), omp_get_wtime() - start);
+    fflush(stdout);
+
+    return true;
+}
+
+/******************************************************************************
+ * Function: process_image_streamed
+ * Description: Runs the filter chain over one image a strip at a time with
+ *  stream_image().
+ * Parameters:
+ *   input - the file to read
+ *   output - the .ppm file to write
+ *   pipeline - the filter chain
+ *   strip_rows - output rows per strip, 0 for the default
+ *   thread_count - the number of threads the chain may use
+ * Returns: true on success.
+ *****************************************************************************/
+static bool process_image_streamed(const QString& input, const QString& output,
+                                   const Pipeline& pipeline, int strip_rows, int thread_count)
+{
+    double start = omp_get_wtime();
+    QString error;
+
+    if(!stream_image(input, output, pipeline, strip_rows, thread_count, &error))
+    {
+        fprintf(stderr, "Unable to stream %s -> %s: %s\n", input.toLocal8Bit().constData(),
+                output.toLocal8Bit().constData(), error.toLocal8Bit().constData());
+        return false;
+    }
+
+    printf("%s -> %s (%f seconds, streamed)\n", input.toLocal8Bit().constData(),
+           output.toLocal8Bit().constData(), omp_get_wtime() - start);
+    fflush(stdout);
+
+    return true;
+}
+
+/******************************************************************************
+ * Function: run_batch
+ * Description: Headless entry point. Streams every input image through the
+ *  filter chain. Images are spread over "jobs" outer threads, and each image
+ *  runs its filters with threads/jobs inner threads, so a directory of small
+ *  images still keeps every core busy.
+ * Parameters:
+ *   arguments - the application arguments
+ * Returns: The process exit code.
+ *****************************************************************************/
+int run_batch(const QStringList& arguments)
+{
+    if(arguments.contains("--list-ops"))
+    {
+        QStringList names = filter_names();
+        for(int i = 0; i < names.size(); i++)
+            printf("%s\n", names[i].toLocal8Bit().constData());
+        return 0;
+    }
+
+    if(arguments.contains("--help"))
+    {
+        print_usage();
+        return 0;
+    }
+
+    BatchOptions options;
+    if(!parse_options(arguments, options))
+        return 2;
+
+    if(options.poolLimit >= 0)
+        set_buffer_pool_limit((qint64)options.poolLimit * 1024 * 1024);
+
+    //adjacent point and row filters are fused into single passes
+    Pipeline pipeline;
+    for(int i = 0; i < options.ops.size(); i++)
+    {
+        const FilterInfo* filter = find_filter(options.ops[i].trimmed());
+        if(filter == NULL)
+        {
+            fprintf(stderr, "Unknown filter %s (see --list-ops)\n", options.ops[i].toLocal8Bit().constData());
+            return 2;
+        }
+        append_filter(pipeline, filter);
+
+        if(options.stream && !pipeline.is_streamable())
+        {
+            fprintf(stderr, "%s needs the whole image and cannot be streamed\n", filter->name);
+            return 2;
+        }
+    }
+
+    QStringList files;
+    for(int i = 0; i < options.inputs.size(); i++)
+        files += expand_input(options.inputs[i]);
+
+    if(files.isEmpty())
+    {
+        fprintf(stderr, "No input images found\n");
+        return 1;
+    }
+
+    //inputs of the same name from different directories would be written to
+    //one file by two jobs at once
+    QStringList outputs;
+    QHash<QString, QString> writers;
+    for(int i = 0; i < files.size(); i++)
+    {
+        QString output = output_path(options.output, files[i], options.stream);
+
+        if(writers.contains(output))
+        {
+            fprintf(stderr, "%s and %s would both be written to %s\n", writers[output].toLocal8Bit().constData(),
+                    files[i].toLocal8Bit().constData(), output.toLocal8Bit().constData());
+            return 2;
+        }
+
+        writers.insert(output, files[i]);
+        outputs << output;
+    }
+
+    if(!options.output.contains('*'))
+        QDir().mkpath(options.output);
+    else
+        QDir().mkpath(QFileInfo(options.output).path());
+
+    int threads = options.threads > 0 ? options.threads : omp_get_num_procs();
+    int jobs = options.jobs > 0 ? options.jobs : qMin(files.size(), threads);
+    int inner = qMax(1, threads / jobs);
+
+    //images in the outer team, rows of each image in the inner teams
+    omp_set_max_active_levels(2);
+
+    int failures = 0;
+    double start = omp_get_wtime();
+
+#   pragma omp parallel for num_threads(jobs) schedule(dynamic) default(none) \
+        shared(files, outputs, pipeline, options, inner) reduction(+:failures)
+    for(int i = 0; i < files.size(); i++)
+    {
+        bool ok;
+
+        if(options.stream)
+            ok = process_image_streamed(files[i], outputs[i], pipeline, options.stripRows, inner);
+        else
+            ok = process_image(files[i], outputs[i], pipeline, inner);
+
+        if(!ok)
+            failures++;
+    }
+
+    printf("Processed %d images in %f seconds (%d jobs x %d threads)\n",
+           files.size() - failures, omp_get_wtime() - start, jobs, inner);
+    printf("Buffer pool: %s\n", buffer_pool_description().toLocal8Bit().constData());
+
+    return failures == 0 ? 0 : 1;
+}
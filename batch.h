@@ -0,0 +1,10 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <QStringList>
+
+bool is_batch_invocation(int argc, char *argv[]);
+
+int run_batch(const QStringList& arguments);
+
+#endif // BATCH_H
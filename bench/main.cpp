@@ -0,0 +1,523 @@
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QImage>
+#include <QStringList>
+#include <QVector>
+
+#include <omp.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include "buffer_pool.h"
+#include "filter_registry.h"
+#include "qt_compat.h"
+#include "ian_algorithms.h"
+#include "pixel_access.h"
+#include "convolution.h"
+#include "simd_kernels.h"
+#include "thread_policy.h"
+#include "trace.h"
+
+// The photos in ../images, which also holds the GUI's icons
+#define BENCH_DEFAULT_IMAGES "../images/Lichtenstein_img_processing_test.png,../images/galaxy.jpg," \
+                             "../images/lena256x256.jpg,../images/raindrop.jpg"
+
+/******************************************************************************
+ * Struct: BenchOptions
+ * Description: What to run and how to report it.
+ *****************************************************************************/
+struct BenchOptions
+{
+    QStringList filters;
+    QString imageDir;
+    QVector<double> megapixels;
+    double upscale;
+    QVector<int> threads;
+    QVector<SchedulePolicy> schedules;
+    int repeats;
+    bool json;
+    bool fftReference;
+};
+
+/******************************************************************************
+ * Struct: BenchResult
+ * Description: The timing summary for one filter, image and thread count.
+ *****************************************************************************/
+struct BenchResult
+{
+    QString image;
+    QString filter;
+    QString schedule;
+    bool placed;            // output writes ran static to match first touch
+    int width;
+    int height;
+    int threads;
+    int runs;
+    double median;
+    double p95;
+    double speedup;
+    double efficiency;
+};
+
+static void print_usage()
+{
+    fprintf(stderr,
+            "Usage: prog4_bench [--filters a,b,...] [--images dir|a.jpg,b.jpg] [--megapixels 1,4,16,64]\n"
+            "                   [--upscale MP] [--tile WxH] [--simd scalar|sse4.1|avx2]\n"
+            "                   [--threads 1,2,4,...] [--schedule filter,static,dynamic,guided,placed]\n"
+            "                   [--repeats N] [--pool-limit MB]\n"
+            "                   [--format csv|json]\n"
+            "       prog4_bench --fft-reference [image files...]\n"
+            "\n"
+            "Runs every filter over the images in --images (default the photos in\n"
+            "../images) and over synthetic images of the given sizes, once per thread\n"
+            "count (default powers of two up to the processor count). Reports the\n"
+            "median and 95th percentile time, the speedup over one thread and the\n"
+            "parallel efficiency.\n"
+            "--upscale resizes the loaded images to MP megapixels first; --tile sets the\n"
+            "convolution tile size (0x0 processes whole rows, the untiled order);\n"
+            "--simd limits the vector kernels to an instruction set.\n"
+            "--pool-limit sets the MB of freed buffers kept for reuse, 0 for none.\n"
+            "--schedule repeats the sweep with each loop schedule, \"filter\" being each\n"
+            "filter's own and \"placed\" each filter's own except that loops writing a\n"
+            "first-touched output run static; speedup is over one thread with the same\n"
+            "schedule.\n"
+            "--fft-reference instead compares fft() with the direct dft() reference.\n");
+}
+
+/******************************************************************************
+ * Function: synthetic_image
+ * Description: Builds a deterministic test image with some structure in it so
+ *  the filters have edges and a spread of values to work with.
+ * Parameters:
+ *   width - the image width
+ *   height - the image height
+ * Returns: The generated image.
+ *****************************************************************************/
+static QImage synthetic_image(int width, int height)
+{
+    QImage image(width, height, QImage::Format_ARGB32);
+    Scanlines out(image);
+
+#   pragma omp parallel for default(none) shared(out, width, height)
+    for(int r = 0; r < height; r++)
+        for(int c = 0; c < width; c++)
+            out[r][c] = qRgb((c * 7 + r) & 0xff, (r * 3) & 0xff, ((c ^ r) * 5) & 0xff);
+
+    return image;
+}
+
+/******************************************************************************
+ * Function: percentile
+ * Description: Nearest rank percentile of a set of samples.
+ * Parameters:
+ *   samples - the samples, sorted in increasing order
+ *   p - the percentile, 0 - 100
+ *****************************************************************************/
+static double percentile(const QVector<double>& samples, double p)
+{
+    int rank = (int)std::ceil(p / 100.0 * samples.size());
+    return samples[qBound(0, rank - 1, samples.size() - 1)];
+}
+
+/******************************************************************************
+ * Function: time_filter
+ * Description: Runs one filter repeatedly after one warm up run.
+ * Returns: The sorted run times in seconds.
+ *****************************************************************************/
+static QVector<double> time_filter(const FilterInfo* filter, const QImage& image,
+                                   int thread_count, int repeats)
+{
+    QVector<double> samples;
+
+    delete filter->function(image, thread_count);
+
+    for(int i = 0; i < repeats; i++)
+    {
+        double start = omp_get_wtime();
+        QImage* result = filter->function(image, thread_count);
+        samples << omp_get_wtime() - start;
+        delete result;
+    }
+
+    std::sort(samples.begin(), samples.end());
+
+    return samples;
+}
+
+/******************************************************************************
+ * Function: bench_schedule
+ * Description: Sweeps one filter over every thread count on one image with
+ *  the current schedule.
+ *****************************************************************************/
+static void bench_schedule(const QString& name, const QImage& image, const FilterInfo* filter,
+                           const BenchOptions& options, QVector<BenchResult>& results)
+{
+    const char* schedule = schedule_name(filter_schedule(filter->name));
+    double baseline = 0;
+
+    for(int t = 0; t < options.threads.size(); t++)
+    {
+        QVector<double> samples = time_filter(filter, image, options.threads[t], options.repeats);
+
+        BenchResult result;
+        result.image = name;
+        result.filter = filter->name;
+        result.schedule = schedule;
+        result.placed = placement_applies(image.size(), options.threads[t]);
+        result.width = image.width();
+        result.height = image.height();
+        result.threads = options.threads[t];
+        result.runs = samples.size();
+        result.median = percentile(samples, 50);
+        result.p95 = percentile(samples, 95);
+
+        if(t == 0)
+            baseline = result.median;
+
+        result.speedup = baseline / result.median;
+        result.efficiency = result.speedup / result.threads;
+        results << result;
+
+        fprintf(stderr, "%s %s %s%s %d threads: %f s\n", name.toLocal8Bit().constData(),
+                filter->name, schedule, result.placed ? " (placed)" : "", result.threads, result.median);
+    }
+}
+
+/******************************************************************************
+ * Function: bench_image
+ * Description: Sweeps every filter over every schedule and thread count on
+ *  one image. The single thread median, always the first count, is the
+ *  baseline for speedup and efficiency, so each schedule gets its own
+ *  speedup curve.
+ *****************************************************************************/
+static void bench_image(const QString& name, const QImage& image,
+                        const BenchOptions& options, QVector<BenchResult>& results)
+{
+    for(int f = 0; f < options.filters.size(); f++)
+    {
+        const FilterInfo* filter = find_filter(options.filters[f]);
+
+        for(int s = 0; s < options.schedules.size(); s++)
+        {
+            set_schedule_override(options.schedules[s]);
+            bench_schedule(name, image, filter, options, results);
+        }
+    }
+
+    set_schedule_override(SCHEDULE_FILTER);
+}
+
+static void print_csv(const QVector<BenchResult>& results)
+{
+    printf("image,width,height,filter,schedule,placed,threads,runs,median_s,p95_s,speedup,efficiency\n");
+
+    for(int i = 0; i < results.size(); i++)
+    {
+        const BenchResult& r = results[i];
+        printf("%s,%d,%d,%s,%s,%d,%d,%d,%f,%f,%f,%f\n", r.image.toLocal8Bit().constData(),
+               r.width, r.height, r.filter.toLocal8Bit().constData(),
+               r.schedule.toLocal8Bit().constData(), r.placed ? 1 : 0, r.threads, r.runs,
+               r.median, r.p95, r.speedup, r.efficiency);
+    }
+}
+
+static void print_json(const QVector<BenchResult>& results)
+{
+    printf("[\n");
+
+    for(int i = 0; i < results.size(); i++)
+    {
+        const BenchResult& r = results[i];
+        printf("  {\"image\": %s, \"width\": %d, \"height\": %d, \"filter\": %s, "
+               "\"schedule\": %s, \"placed\": %s, \"threads\": %d, \"runs\": %d, \"median_s\": %f, \"p95_s\": %f, "
+               "\"speedup\": %f, \"efficiency\": %f}%s\n",
+               json_string(r.image).constData(), r.width, r.height,
+               json_string(r.filter).constData(), json_string(r.schedule).constData(),
+               r.placed ? "true" : "false", r.threads, r.runs, r.median, r.p95,
+               r.speedup, r.efficiency, i + 1 < results.size() ? "," : "");
+    }
+
+    printf("]\n");
+}
+
+/******************************************************************************
+ * Function: max_difference
+ * Description: The largest per channel difference between two images.
+ *****************************************************************************/
+static int max_difference(const QImage& a, const QImage& b)
+{
+    int diff = 0;
+
+    for(int r = 0; r < a.height(); r++)
+    {
+        for(int c = 0; c < a.width(); c++)
+        {
+            QRgb p = a.pixel(c, r);
+            QRgb q = b.pixel(c, r);
+
+            diff = qMax(diff, qAbs(qRed(p) - qRed(q)));
+            diff = qMax(diff, qAbs(qGreen(p) - qGreen(q)));
+            diff = qMax(diff, qAbs(qBlue(p) - qBlue(q)));
+        }
+    }
+
+    return diff;
+}
+
+/******************************************************************************
+ * Function: bench_fft
+ * Description: Times fft() against the direct dft() reference on one image
+ *  and prints a CSV row with both times, the speedup and the largest output
+ *  difference.
+ *****************************************************************************/
+static void bench_fft(const QString& name, const QImage& image, int thread_count)
+{
+    double start = omp_get_wtime();
+    QImage* reference = dft(image, thread_count);
+    double dftTime = omp_get_wtime() - start;
+
+    start = omp_get_wtime();
+    QImage* result = fft(image, thread_count);
+    double fftTime = omp_get_wtime() - start;
+
+    printf("%s,%dx%d,%d,%f,%f,%.1f,%d\n", name.toLocal8Bit().constData(),
+           image.width(), image.height(), thread_count,
+           dftTime, fftTime, dftTime / fftTime, max_difference(*reference, *result));
+
+    delete reference;
+    delete result;
+}
+
+static int run_fft_reference(const QStringList& files)
+{
+    int thread_count = omp_get_max_threads();
+
+    printf("image,size,threads,dft_seconds,fft_seconds,speedup,max_diff\n");
+
+    // power of two, mixed radix and prime (Bluestein) sizes
+    const int sizes[][2] = {{256, 256}, {640, 480}, {509, 509}, {1024, 768}};
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        bench_fft("synthetic", synthetic_image(sizes[i][0], sizes[i][1]), thread_count);
+
+    for(int i = 0; i < files.size(); i++)
+    {
+        QImage image(files[i]);
+        if(image.isNull())
+        {
+            fprintf(stderr, "Unable to load image %s\n", files[i].toLocal8Bit().constData());
+            continue;
+        }
+        bench_fft(files[i], image, thread_count);
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Function: parse_options
+ * Description: Parses the command line, filling in the defaults.
+ * Returns: true if the command line was valid.
+ *****************************************************************************/
+static bool parse_options(const QStringList& arguments, BenchOptions& options)
+{
+    options.filters = filter_names();
+    options.imageDir = BENCH_DEFAULT_IMAGES;
+    options.megapixels << 1 << 4 << 16 << 64;
+    options.upscale = 0;
+    options.schedules << SCHEDULE_FILTER;
+    options.repeats = 5;
+    options.json = false;
+    options.fftReference = false;
+
+    int processors = omp_get_num_procs();
+    for(int t = 1; t < processors; t *= 2)
+        options.threads << t;
+    options.threads << processors;
+
+    for(int i = 1; i < arguments.size(); i++)
+    {
+        QString name = arguments[i];
+
+        if(name == "--fft-reference")
+        {
+            options.fftReference = true;
+            continue;
+        }
+
+        if(options.fftReference)
+            continue;
+
+        if(i + 1 >= arguments.size())
+        {
+            print_usage();
+            return false;
+        }
+
+        QString value = arguments[++i];
+
+        if(name == "--filters")
+        {
+            options.filters = value.split(',', SKIP_EMPTY_PARTS);
+            for(int f = 0; f < options.filters.size(); f++)
+            {
+                if(find_filter(options.filters[f]) == NULL)
+                {
+                    fprintf(stderr, "Unknown filter %s\n", options.filters[f].toLocal8Bit().constData());
+                    return false;
+                }
+            }
+        }
+        else if(name == "--images")
+            options.imageDir = value;
+        else if(name == "--megapixels")
+        {
+            options.megapixels.clear();
+            QStringList sizes = value.split(',', SKIP_EMPTY_PARTS);
+            for(int s = 0; s < sizes.size(); s++)
+                options.megapixels << sizes[s].toDouble();
+        }
+        else if(name == "--upscale")
+            options.upscale = value.toDouble();
+        else if(name == "--tile")
+        {
+            QStringList tile = value.split('x');
+            if(tile.size() != 2)
+            {
+                print_usage();
+                return false;
+            }
+            convolve_tile_size() = QSize(tile[0].toInt(), tile[1].toInt());
+        }
+        else if(name == "--simd")
+        {
+            if(value == "scalar")
+                set_simd_level(SIMD_SCALAR);
+            else if(value == "sse4.1")
+                set_simd_level(SIMD_SSE41);
+            else
+                set_simd_level(SIMD_AVX2);
+        }
+        else if(name == "--threads")
+        {
+            options.threads.clear();
+            QStringList counts = value.split(',', SKIP_EMPTY_PARTS);
+            for(int t = 0; t < counts.size(); t++)
+                options.threads << qMax(1, counts[t].toInt());
+            std::sort(options.threads.begin(), options.threads.end());
+        }
+        else if(name == "--schedule")
+        {
+            options.schedules.clear();
+            QStringList names = value.split(',', SKIP_EMPTY_PARTS);
+            for(int s = 0; s < names.size(); s++)
+            {
+                SchedulePolicy policy;
+                if(!find_schedule(names[s], policy))
+                {
+                    fprintf(stderr, "Unknown schedule %s\n", names[s].toLocal8Bit().constData());
+                    return false;
+                }
+                options.schedules << policy;
+            }
+            if(options.schedules.isEmpty())
+                options.schedules << SCHEDULE_FILTER;
+        }
+        else if(name == "--repeats")
+            options.repeats = qMax(1, value.toInt());
+        else if(name == "--pool-limit")
+            set_buffer_pool_limit((qint64)qMax(0, value.toInt()) * 1024 * 1024);
+        else if(name == "--format")
+            options.json = (value == "json");
+        else
+        {
+            print_usage();
+            return false;
+        }
+    }
+
+    //the single thread run is the baseline for speedup
+    if(options.threads.isEmpty() || options.threads.first() != 1)
+        options.threads.prepend(1);
+
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    setup_threads();
+
+    QCoreApplication a(argc, argv);
+
+    BenchOptions options;
+    if(!parse_options(a.arguments(), options))
+        return 2;
+
+    if(options.fftReference)
+    {
+        QStringList files = a.arguments().mid(1);
+        files.removeAll("--fft-reference");
+        return run_fft_reference(files);
+    }
+
+    fprintf(stderr, "Vector kernels: %s\n", simd_level_name(simd_level()));
+    fprintf(stderr, "Threads: %s\n", thread_binding_description().toLocal8Bit().constData());
+
+    QVector<BenchResult> results;
+
+    //a directory, or a list of image files
+    QStringList paths;
+    if(QFileInfo(options.imageDir).isDir())
+    {
+        QDir dir(options.imageDir);
+        QStringList names = dir.entryList(QStringList() << "*.png" << "*.jpg" << "*.bmp", QDir::Files, QDir::Name);
+        for(int i = 0; i < names.size(); i++)
+            paths << dir.filePath(names[i]);
+    }
+    else
+        paths = options.imageDir.split(',', SKIP_EMPTY_PARTS);
+
+    for(int i = 0; i < paths.size(); i++)
+    {
+        QImage image(paths[i]);
+        if(image.isNull())
+            continue;
+
+        QString name = QFileInfo(paths[i]).fileName();
+
+        if(options.upscale > 0)
+        {
+            //same aspect ratio, the requested pixel count
+            double scale = std::sqrt(options.upscale * 1000000 / ((double)image.width() * image.height()));
+            image = image.scaled((int)(image.width() * scale), (int)(image.height() * scale),
+                                 Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+            name += QString("@%1mp").arg(options.upscale);
+        }
+
+        bench_image(name, image, options, results);
+    }
+
+    for(int i = 0; i < options.megapixels.size(); i++)
+    {
+        //4:3 images of the requested pixel count
+        double pixels = options.megapixels[i] * 1000000;
+        int width = (int)std::sqrt(pixels * 4 / 3);
+        int height = (int)(pixels / width);
+
+        QString name = QString("synthetic_%1mp").arg(options.megapixels[i]);
+        bench_image(name, synthetic_image(width, height), options, results);
+    }
+
+    fprintf(stderr, "Buffer pool: %s\n", buffer_pool_description().toLocal8Bit().constData());
+
+    if(options.json)
+        print_json(results);
+    else
+        print_csv(results);
+
+    return 0;
+}
@@ -0,0 +1,62 @@
+#-------------------------------------------------
+#
+# Command line benchmarks for the prog4 algorithms
+#
+#-------------------------------------------------
+
+QT       += core gui
+
+TARGET = prog4_bench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG += c++11
+
+INCLUDEPATH += ..
+
+SOURCES += main.cpp \
+    ../chris_algorithms.cpp \
+    ../ian_algorithms.cpp \
+    ../matt_algorithms.cpp \
+    ../fft_engine.cpp \
+    ../blur.cpp \
+    ../integral_image.cpp \
+    ../adaptive_filters.cpp \
+    ../histogram.cpp \
+    ../pyramid.cpp \
+    ../image_gradient.cpp \
+    ../point_ops.cpp \
+    ../pipeline.cpp \
+    ../simd_kernels.cpp \
+    ../filter_registry.cpp \
+    ../filter_progress.cpp \
+    ../trace.cpp \
+    ../buffer_pool.cpp \
+    ../thread_policy.cpp
+
+HEADERS  += ../chris_algorithms.h \
+    ../ian_algorithms.h \
+    ../matt_algorithms.h \
+    ../fft_engine.h \
+    ../pixel_access.h \
+    ../counter_rng.h \
+    ../convolution.h \
+    ../planar_image.h \
+    ../blur.h \
+    ../integral_image.h \
+    ../adaptive_filters.h \
+    ../histogram.h \
+    ../pyramid.h \
+    ../image_gradient.h \
+    ../point_ops.h \
+    ../pipeline.h \
+    ../simd_kernels.h \
+    ../filter_registry.h \
+    ../filter_progress.h \
+    ../trace.h \
+    ../buffer_pool.h \
+    ../thread_policy.h \
+    ../qt_compat.h
+
+QMAKE_CXXFLAGS += -fopenmp
+LIBS += -fopenmp
@@ -0,0 +1,280 @@
+#include "blur.h"
+#include "pixel_access.h"
+#include "buffer_pool.h"
+#include "filter_progress.h"
+
+#include <cmath>
+
+using namespace std;
+
+// Number of columns each thread owns in the vertical running sum pass
+#define BOX_STRIP_WIDTH 64
+
+/******************************************************************************
+ * Function: gaussian_blur
+ * Description: Blurs the red, green and blue channels with a Gaussian of any
+ *  sigma as two 1D passes: each row is convolved into a float buffer, then
+ *  each output row is accumulated from the 2*radius+1 buffered rows around
+ *  it. The kernel is cut off at 3 sigma, so the cost is O(sigma) per pixel
+ *  rather than O(sigma^2) for the 2D kernel. Pixels past the edges repeat
+ *  the edge pixel.
+ * Parameters:
+ *   image - the image to process on
+ *   sigma - the standard deviation of the Gaussian, in pixels
+ *   thread_count - the number of threads to use
+ * Returns: The blurred image.
+ *****************************************************************************/
+QImage* gaussian_blur(const QImage& image, double sigma, int thread_count)
+{
+    ScheduleScope schedule("gaussian_blur");
+
+    QImage source = to_argb32(image);
+    QImage* newImage = new_output_image(source.size(), thread_count);
+    QSize size = newImage->size();
+    int width = size.width();
+    int height = size.height();
+
+    int radius = sigma > 0 ? (int)ceil(3 * sigma) : 0;
+    float* weights = new float[2 * radius + 1];
+    float total = 0;
+
+    for(int k = -radius; k <= radius; k++)
+    {
+        weights[k + radius] = sigma > 0 ? exp(-(k * k) / (2 * sigma * sigma)) : 1;
+        total += weights[k + radius];
+    }
+    for(int k = 0; k <= 2 * radius; k++)
+        weights[k] /= total;
+
+    //the row pass result, three interleaved float channels per pixel
+    float* temp = pool_array<float>((qint64)width * height * 3);
+
+    ConstScanlines in(source);
+    Scanlines out(*newImage);
+
+    FilterProgress* progress = FilterProgress::current();
+    progress_add_work(progress, 2 * height);
+
+    //Horizontal pass - every row is independent
+#   pragma omp parallel num_threads(thread_count) default(none) \
+        shared(progress, in, temp, weights, radius, width, height)
+    {
+        //the row with its edge pixels repeated radius times on each side
+        float* padded = new float[(size_t)(width + 2 * radius) * 3];
+
+#       pragma omp for schedule(runtime)
+        for(int r = 0; r < height; r++)
+        {
+            if(progress_cancelled(progress))
+                continue;
+
+            const QRgb* src = in[r];
+
+            for(int c = -radius; c < width + radius; c++)
+            {
+                QRgb pixel = src[qBound(0, c, width - 1)];
+                float* p = padded + (size_t)(c + radius) * 3;
+
+                p[0] = qRed(pixel);
+                p[1] = qGreen(pixel);
+                p[2] = qBlue(pixel);
+            }
+
+            float* dst = temp + (size_t)r * width * 3;
+
+            for(int i = 0; i < width * 3; i++)
+                dst[i] = 0;
+
+            for(int k = 0; k <= 2 * radius; k++)
+            {
+                const float weight = weights[k];
+                const float* tap = padded + k * 3;
+
+                for(int i = 0; i < width * 3; i++)
+                    dst[i] += weight * tap[i];
+            }
+
+            progress_advance(progress);
+        }
+
+        delete[] padded;
+    }
+
+    //Vertical pass - each output row sums whole buffered rows
+    PlacementScope placement(*newImage, thread_count);
+
+#   pragma omp parallel num_threads(thread_count) default(none) \
+        shared(progress, out, temp, weights, radius, width, height)
+    {
+        float* sum = new float[(size_t)width * 3];
+
+#       pragma omp for schedule(runtime)
+        for(int r = 0; r < height; r++)
+        {
+            if(progress_cancelled(progress))
+                continue;
+
+            for(int i = 0; i < width * 3; i++)
+                sum[i] = 0;
+
+            for(int k = -radius; k <= radius; k++)
+            {
+                const float weight = weights[k + radius];
+                const float* src = temp + (size_t)qBound(0, r + k, height - 1) * width * 3;
+
+                for(int i = 0; i < width * 3; i++)
+                    sum[i] += weight * src[i];
+            }
+
+            QRgb* dst = out[r];
+
+            for(int c = 0; c < width; c++)
+            {
+                int red   = qBound(0, (int)(sum[c * 3] + 0.5f), 255);
+                int green = qBound(0, (int)(sum[c * 3 + 1] + 0.5f), 255);
+                int blue  = qBound(0, (int)(sum[c * 3 + 2] + 0.5f), 255);
+
+                dst[c] = qRgb(red, green, blue);
+            }
+
+            progress_advance(progress);
+        }
+
+        delete[] sum;
+    }
+
+    delete[] weights;
+    pool_free(temp);
+
+    return newImage;
+}
+
+/******************************************************************************
+ * Function: box_blur
+ * Description: Averages the red, green and blue channels over a
+ *  (2*radius+1)^2 box using running sums. The row pass slides a window along
+ *  each row, adding the pixel that enters and subtracting the one that
+ *  leaves; the column pass does the same down strips of columns. Each pixel
+ *  costs a constant amount of work whatever the radius. Pixels past the
+ *  edges repeat the edge pixel. A summed-area table would give the same
+ *  constant cost but needs 64 bit sums over the whole image, 24 bytes per
+ *  pixel against the 12 of the row sums.
+ * Parameters:
+ *   image - the image to process on
+ *   radius - the box radius, in pixels
+ *   thread_count - the number of threads to use
+ * Returns: The blurred image.
+ *****************************************************************************/
+QImage* box_blur(const QImage& image, int radius, int thread_count)
+{
+    ScheduleScope schedule("box_blur");
+
+    QImage source = to_argb32(image);
+    QImage* newImage = new_output_image(source.size(), thread_count);
+    QSize size = newImage->size();
+    int width = size.width();
+    int height = size.height();
+
+    if(radius < 0)
+        radius = 0;
+
+    unsigned long long area = (unsigned long long)(2 * radius + 1) * (2 * radius + 1);
+
+    //the row window sums, three interleaved channels per pixel
+    unsigned int* temp = pool_array<unsigned int>((qint64)width * height * 3);
+
+    ConstScanlines in(source);
+    Scanlines out(*newImage);
+
+    FilterProgress* progress = FilterProgress::current();
+    progress_add_work(progress, height);
+
+    //Horizontal pass - one running sum per channel along each row
+#   pragma omp parallel for num_threads(thread_count) schedule(runtime) default(none) \
+        shared(progress, in, temp, radius, width, height)
+    for(int r = 0; r < height; r++)
+    {
+        if(progress_cancelled(progress))
+            continue;
+
+        const QRgb* src = in[r];
+        unsigned int* dst = temp + (size_t)r * width * 3;
+        unsigned int red = 0, green = 0, blue = 0;
+
+        for(int k = -radius; k <= radius; k++)
+        {
+            QRgb pixel = src[qBound(0, k, width - 1)];
+
+            red += qRed(pixel);
+            green += qGreen(pixel);
+            blue += qBlue(pixel);
+        }
+
+        for(int c = 0; c < width; c++)
+        {
+            dst[c * 3] = red;
+            dst[c * 3 + 1] = green;
+            dst[c * 3 + 2] = blue;
+
+            QRgb enter = src[qMin(c + radius + 1, width - 1)];
+            QRgb leave = src[qMax(c - radius, 0)];
+
+            red += qRed(enter) - qRed(leave);
+            green += qGreen(enter) - qGreen(leave);
+            blue += qBlue(enter) - qBlue(leave);
+        }
+
+        progress_advance(progress);
+    }
+
+    //Vertical pass - each thread runs down a strip of columns
+    int strips = (width + BOX_STRIP_WIDTH - 1) / BOX_STRIP_WIDTH;
+    progress_add_work(progress, strips);
+
+#   pragma omp parallel for num_threads(thread_count) schedule(runtime) default(none) \
+        shared(progress, out, temp, radius, width, height, strips, area)
+    for(int s = 0; s < strips; s++)
+    {
+        if(progress_cancelled(progress))
+            continue;
+
+        int first = s * BOX_STRIP_WIDTH;
+        int count = qMin(BOX_STRIP_WIDTH, width - first) * 3;
+        unsigned long long sum[BOX_STRIP_WIDTH * 3];
+
+        for(int i = 0; i < count; i++)
+            sum[i] = 0;
+
+        for(int k = -radius; k <= radius; k++)
+        {
+            const unsigned int* src = temp + ((size_t)qBound(0, k, height - 1) * width + first) * 3;
+
+            for(int i = 0; i < count; i++)
+                sum[i] += src[i];
+        }
+
+        for(int r = 0; r < height; r++)
+        {
+            QRgb* dst = out[r] + first;
+
+            for(int c = 0; c < count / 3; c++)
+            {
+                dst[c] = qRgb((sum[c * 3] + area / 2) / area,
+                              (sum[c * 3 + 1] + area / 2) / area,
+                              (sum[c * 3 + 2] + area / 2) / area);
+            }
+
+            const unsigned int* enter = temp + ((size_t)qMin(r + radius + 1, height - 1) * width + first) * 3;
+            const unsigned int* leave = temp + ((size_t)qMax(r - radius, 0) * width + first) * 3;
+
+            for(int i = 0; i < count; i++)
+                sum[i] += enter[i] - (unsigned long long)leave[i];
+        }
+
+        progress_advance(progress);
+    }
+
+    pool_free(temp);
+
+    return newImage;
+}
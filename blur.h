@@ -0,0 +1,10 @@
+#ifndef BLUR_H
+#define BLUR_H
+
+#include <QImage>
+
+QImage* gaussian_blur(const QImage& image, double sigma, int thread_count);
+
+QImage* box_blur(const QImage& image, int radius, int thread_count);
+
+#endif // BLUR_H
@@ -0,0 +1,259 @@
+#include "buffer_pool.h"
+
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include <new>
+
+/******************************************************************************
+ * Struct: IdleBuffer
+ * Description: A given back buffer waiting to be reused.
+ *****************************************************************************/
+struct IdleBuffer
+{
+    void* buffer;
+    qint64 bytes;
+};
+
+/******************************************************************************
+ * Struct: BufferPoolState
+ * Description: The pool's buffers and counters.
+ *****************************************************************************/
+struct BufferPoolState
+{
+    BufferPoolState() :
+        limit(POOL_DEFAULT_LIMIT)
+    {
+        stats.hits = stats.misses = stats.inUse = stats.idle = stats.peak = 0;
+    }
+
+    QMutex mutex;
+    QList<IdleBuffer> idle;             // least recently given back first
+    QHash<void*, qint64> pooled;        // handed out, with their sizes
+    qint64 limit;
+    BufferPoolStats stats;
+};
+
+/******************************************************************************
+ * Function: pool_state
+ * Description: The pool. It is never destroyed, so buffers held by other
+ *  static objects can still be given back while the program exits.
+ *****************************************************************************/
+static BufferPoolState& pool_state()
+{
+    static BufferPoolState* state = new BufferPoolState;
+    return *state;
+}
+
+/******************************************************************************
+ * Function: evict
+ * Description: Takes the least recently given back buffers out of the pool
+ *  until bytes more would fit under the limit. Call with pool.mutex held, and
+ *  free the evicted buffers after releasing it.
+ * Parameters:
+ *   bytes - the room to make
+ *   evicted - receives the buffers to free
+ *****************************************************************************/
+static void evict(qint64 bytes, QList<void*>& evicted)
+{
+    BufferPoolState& pool = pool_state();
+
+    while(!pool.idle.isEmpty() && pool.stats.idle + bytes > pool.limit)
+    {
+        IdleBuffer oldest = pool.idle.takeFirst();
+
+        pool.stats.idle -= oldest.bytes;
+        evicted << oldest.buffer;
+    }
+}
+
+static void free_buffers(const QList<void*>& buffers)
+{
+    for(int i = 0; i < buffers.size(); i++)
+        qFreeAligned(buffers[i]);
+}
+
+/******************************************************************************
+ * Function: pool_allocate
+ * Description: A buffer of at least the given size, aligned to POOL_ALIGNMENT,
+ *  reused from the pool if one of that size is idle. The contents are
+ *  undefined. Throws std::bad_alloc if there is no memory, after giving the
+ *  idle buffers back to the system and trying again.
+ * Parameters:
+ *   bytes - the size needed
+ * Returns: The buffer, to give back with pool_free().
+ *****************************************************************************/
+void* pool_allocate(qint64 bytes)
+{
+    if(bytes < POOL_MIN_BYTES)
+    {
+        void* buffer = qMallocAligned(qMax<qint64>(1, bytes), POOL_ALIGNMENT);
+        if(buffer == NULL)
+            throw std::bad_alloc();
+
+        return buffer;
+    }
+
+    bytes = (bytes + POOL_GRANULE - 1) / POOL_GRANULE * POOL_GRANULE;
+
+    BufferPoolState& pool = pool_state();
+
+    QList<void*> evicted;
+    {
+        QMutexLocker lock(&pool.mutex);
+
+        //the most recently given back is the likeliest to still be in cache
+        for(int i = pool.idle.size() - 1; i >= 0; i--)
+        {
+            if(pool.idle[i].bytes == bytes)
+            {
+                void* buffer = pool.idle.takeAt(i).buffer;
+
+                pool.pooled.insert(buffer, bytes);
+                pool.stats.idle -= bytes;
+                pool.stats.inUse += bytes;
+                pool.stats.hits++;
+
+                return buffer;
+            }
+        }
+
+        pool.stats.misses++;
+    }
+
+    void* buffer = qMallocAligned(bytes, POOL_ALIGNMENT);
+
+    if(buffer == NULL)
+    {
+        {
+            QMutexLocker lock(&pool.mutex);
+            evict(pool.limit + 1, evicted);
+        }
+
+        free_buffers(evicted);
+        buffer = qMallocAligned(bytes, POOL_ALIGNMENT);
+
+        if(buffer == NULL)
+            throw std::bad_alloc();
+    }
+
+    QMutexLocker lock(&pool.mutex);
+
+    pool.pooled.insert(buffer, bytes);
+    pool.stats.inUse += bytes;
+    pool.stats.peak = qMax(pool.stats.peak, pool.stats.inUse + pool.stats.idle);
+
+    return buffer;
+}
+
+/******************************************************************************
+ * Function: pool_free
+ * Description: Gives a buffer from pool_allocate() back. It is kept for reuse
+ *  unless that would take the idle buffers over the limit even after
+ *  evicting the older ones. NULL is ignored.
+ *****************************************************************************/
+void pool_free(void* buffer)
+{
+    if(buffer == NULL)
+        return;
+
+    BufferPoolState& pool = pool_state();
+    QList<void*> evicted;
+    {
+        QMutexLocker lock(&pool.mutex);
+
+        QHash<void*, qint64>::iterator entry = pool.pooled.find(buffer);
+        if(entry == pool.pooled.end())
+        {
+            //below POOL_MIN_BYTES, never pooled
+            evicted << buffer;
+        }
+        else
+        {
+            qint64 bytes = entry.value();
+            pool.pooled.erase(entry);
+            pool.stats.inUse -= bytes;
+
+            if(bytes > pool.limit)
+                evicted << buffer;
+            else
+            {
+                evict(bytes, evicted);
+
+                IdleBuffer idle = {buffer, bytes};
+                pool.idle << idle;
+                pool.stats.idle += bytes;
+            }
+        }
+    }
+
+    free_buffers(evicted);
+}
+
+static void pool_image_cleanup(void* buffer)
+{
+    pool_free(buffer);
+}
+
+/******************************************************************************
+ * Function: pool_image
+ * Description: A Format_ARGB32 image whose pixels are in a pooled buffer,
+ *  given back when the last copy of the image is destroyed. The pixels are
+ *  undefined.
+ * Parameters:
+ *   size - the image size
+ *****************************************************************************/
+QImage pool_image(const QSize& size)
+{
+    if(size.isEmpty())
+        return QImage(size, QImage::Format_ARGB32);
+
+    int stride = size.width() * 4;
+    uchar* bits = static_cast<uchar*>(pool_allocate((qint64)stride * size.height()));
+
+    return QImage(bits, size.width(), size.height(), stride, QImage::Format_ARGB32,
+                  pool_image_cleanup, bits);
+}
+
+BufferPoolStats buffer_pool_stats()
+{
+    BufferPoolState& pool = pool_state();
+
+    QMutexLocker lock(&pool.mutex);
+    return pool.stats;
+}
+
+/******************************************************************************
+ * Function: set_buffer_pool_limit
+ * Description: Sets how many bytes of idle buffers the pool keeps; 0 turns
+ *  the reuse off.
+ *****************************************************************************/
+void set_buffer_pool_limit(qint64 bytes)
+{
+    BufferPoolState& pool = pool_state();
+    QList<void*> evicted;
+    {
+        QMutexLocker lock(&pool.mutex);
+
+        pool.limit = qMax<qint64>(0, bytes);
+        evict(0, evicted);
+    }
+
+    free_buffers(evicted);
+}
+
+/******************************************************************************
+ * Function: buffer_pool_description
+ * Description: The pool counters, for reports.
+ *****************************************************************************/
+QString buffer_pool_description()
+{
+    BufferPoolStats stats = buffer_pool_stats();
+
+    return QString("%1 hits, %2 misses, peak %3 MB")
+            .arg(stats.hits)
+            .arg(stats.misses)
+            .arg(stats.peak / (1024 * 1024));
+}
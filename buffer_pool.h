@@ -0,0 +1,69 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <QImage>
+
+// Bytes of idle buffers the pool keeps by default, see set_buffer_pool_limit()
+#define POOL_DEFAULT_LIMIT ((qint64)1024 * 1024 * 1024)
+
+// Smaller requests are not pooled, malloc serves them well
+#define POOL_MIN_BYTES (256 * 1024)
+
+// Pooled sizes are rounded up to whole pages, so requests that differ by a
+// little, such as the same image in two formats, share buffers
+#define POOL_GRANULE 4096
+
+// Alignment of every buffer
+#define POOL_ALIGNMENT 64
+
+/******************************************************************************
+ * A pool of recycled buffers for filter outputs and large scratch arrays.
+ *
+ * Every filter allocates its output, and some a few scratch arrays, the size
+ * of the image. For large images a fresh allocation is a fresh mmap from the
+ * kernel, and writing it takes a page fault per 4KB page; in batch runs that
+ * is a measurable share of the time. pool_allocate() instead hands out a
+ * buffer of the same size that an earlier filter has given back, already
+ * faulted in and often still in cache. Buffers are matched by their size
+ * rounded up to POOL_GRANULE; images of the same size and format always
+ * match.
+ *
+ * Given back buffers are kept until they add up to the limit, after which the
+ * least recently returned are freed. The pool is shared by all threads.
+ *****************************************************************************/
+
+/******************************************************************************
+ * Struct: BufferPoolStats
+ * Description: Counters since the program started.
+ *****************************************************************************/
+struct BufferPoolStats
+{
+    qint64 hits;            // allocations served from the pool
+    qint64 misses;          // allocations that needed new memory
+    qint64 inUse;           // bytes handed out and not given back
+    qint64 idle;            // bytes kept for reuse
+    qint64 peak;            // the most inUse + idle has been
+};
+
+void* pool_allocate(qint64 bytes);
+void pool_free(void* buffer);
+
+/******************************************************************************
+ * Function: pool_array
+ * Description: pool_allocate() for an array of count T, as
+ *  pool_array<float>(n). The elements are not initialized; give the array
+ *  back with pool_free().
+ *****************************************************************************/
+template<class T>
+T* pool_array(qint64 count)
+{
+    return static_cast<T*>(pool_allocate(count * (qint64)sizeof(T)));
+}
+
+QImage pool_image(const QSize& size);
+
+BufferPoolStats buffer_pool_stats();
+void set_buffer_pool_limit(qint64 bytes);
+QString buffer_pool_description();
+
+#endif // BUFFER_POOL_H
@@ -1,42 +1,60 @@
 #include "chris_algorithms.h"
-
-#include <QColor>
+#include "pixel_access.h"
+#include "point_ops.h"
+#include "simd_kernels.h"
+#include "filter_progress.h"
+#include "counter_rng.h"
 
 #include <cmath>
-#include <time.h>
 
 using namespace std;
 
 /******************************************************************************
  * Function: brighten
- * Description: Sets the value to be added to each pixel to 20 in for the universal
+ * Description: Sets the value to be added to each pixel in for the universal
  * brighten_darken function
  * Parameters:
  *   image - the image to process on
  *   thread_count - the number of threads to use
+ *   params - the amount to add, 20 by default
  * Returns: the brightened image after its computed
  *****************************************************************************/
-QImage* brighten(const QImage &image, int thread_count)
+QImage* brighten(const QImage &image, int thread_count, const BrightnessParams& params)
 {
-    int bright = 20;
+    ScheduleScope schedule("brighten");
+
+    int bright = qBound(0, params.amount, 255);
     return brighten_darken(image, thread_count, bright, 255);
 }
 
+QImage* brighten(const QImage &image, int thread_count)
+{
+    return brighten(image, thread_count, BrightnessParams());
+}
+
 /******************************************************************************
  * Function: darken
- * Description: Sets the value to be added to each pixel to -20 in for the universal
- * brighten_darken function
+ * Description: Sets the value to be subtracted from each pixel in for the
+ * universal brighten_darken function
  * Parameters:
  *   image - the image to process on
  *   thread_count - the number of threads to use
+ *   params - the amount to subtract, 20 by default
  * Returns: the darkened image after its computed
  *****************************************************************************/
-QImage* darken(const QImage &image, int thread_count)
+QImage* darken(const QImage &image, int thread_count, const BrightnessParams& params)
 {
-    int dark = -20;
+    ScheduleScope schedule("darken");
+
+    int dark = -qBound(0, params.amount, 255);
     return brighten_darken(image, thread_count, dark, 0);
 }
 
+QImage* darken(const QImage &image, int thread_count)
+{
+    return darken(image, thread_count, BrightnessParams());
+}
+
 /******************************************************************************
  * Function: brighten
  * Description: Adds teh value passed in to each pixel value in parrallel
@@ -50,48 +68,16 @@ QImage* darken(const QImage &image, int thread_count)
  *****************************************************************************/
 QImage* brighten_darken(const QImage& image, const int &thread_count, const int &value, const int &limit)
 {
-    QImage* newImage = new QImage(image.size(), image.format());
-    QSize size = newImage->size();
-
-    int r;
-    int red, green, blue;
-
-#   pragma omp parallel for num_threads(thread_count) default(none) \
-        shared(size, image, newImage,value, limit) private(r, red, green, blue)
-    for(r = 0; r < size.height(); r++)
+    //brightening up to 255 and darkening down to 0 are saturating adds
+    if((value >= 0 && limit == 255) || (value <= 0 && limit == 0))
     {
-        for(int c = 0; c < size.width(); c++)
-        {
-            QColor color = QColor(image.pixel(c, r));
-
-            color.getRgb(&red, &green, &blue);
-
-            red+=value;
-            green+=value;
-            blue+=value;
-
-            if( red <  255 && red >0)
-                color.setRed( red );
-            else
-                color.setRed(limit);
-
-            if( green < 255 && green > 0)
-                color.setGreen( green );
-            else
-                color.setGreen(limit);
-
-            if(blue < 255 && blue > 0)
-                color.setBlue( blue );
-            else
-                color.setBlue(limit);
-
-            newImage->setPixel(c, r, color.rgb());
-
-
-        }
+        int amount = value;
+        return map_rows(image, [amount](const QRgb* src, QRgb* dst, int width) {
+            add_saturate_row(src, dst, width, amount);
+        }, thread_count);
     }
 
-    return newImage;
+    return apply_lut(image, brighten_darken_lut(value, limit), thread_count);
 }
 
 /******************************************************************************
@@ -105,30 +91,9 @@ QImage* brighten_darken(const QImage& image, const int &thread_count, const int
  *****************************************************************************/
 QImage* negate(const QImage& image, const int& thread_count)
 {
-    QImage* newImage = new QImage(image.size(), image.format());
-    QSize size = newImage->size();
-    int r;
-    int red, green, blue;
-
-#   pragma omp parallel for num_threads(thread_count) default(none) \
-        shared(size, image, newImage) private(r, red, green, blue)
-    for(r = 0; r < size.height(); r++)
-    {
-        for(int c = 0; c < size.width(); c++)
-        {
-            QColor color = QColor(image.pixel(c, r));
-            color.getRgb(&red, &green, &blue);
-
-            red   = 255 - red;
-            green = 255 - green;
-            blue  = 255 - blue;
-
-            color.setRgb(red, green, blue);
-            newImage->setPixel(c, r, color.rgb());
-        }
-    }
+    ScheduleScope schedule("negate");
 
-    return newImage;
+    return map_rows(image, negate_row, thread_count);
 }
 
 /******************************************************************************
@@ -138,71 +103,116 @@ QImage* negate(const QImage& image, const int& thread_count)
  * Parameters:
  *   image - the image to process on
  *   thread_count - the number of threads to use
+ *   params - the threshold, 127 by default
  * Returns: the darkened image after its computed
  *****************************************************************************/
-QImage* binary_threshold(const QImage& image, const int& thread_count)
+QImage* binary_threshold(const QImage& image, const int& thread_count, const ThresholdParams& params)
 {
-    QImage* newImage = new QImage(image.size(), image.format());
-    QSize size = newImage->size();
-    int r;
-    int red, green, blue;
+    ScheduleScope schedule("binary_threshold");
 
-#   pragma omp parallel for num_threads(thread_count) default(none) \
-        shared(size, image, newImage) private(r, red, green, blue)
-    for(r = 0; r < size.height(); r++)
-    {
-        for(int c = 0; c < size.width(); c++)
-        {
-            QColor color = QColor(image.pixel(c, r));
-            color.getRgb(&red, &green, &blue);
+    int threshold = qBound(0, params.threshold, 255);
 
-            red   = ( red   > 127 ) ? 255 : 0;
-            blue  = ( blue  > 127 ) ? 255 : 0;
-            green = ( green > 127 ) ? 255 : 0;
+    return map_rows(image, [threshold](const QRgb* src, QRgb* dst, int width) {
+        threshold_row(src, dst, width, threshold);
+    }, thread_count);
+}
 
-            color.setRgb(red, green, blue);
-            newImage->setPixel(c, r, color.rgb());
-        }
-    }
-    return newImage;
+QImage* binary_threshold(const QImage& image, const int& thread_count)
+{
+    return binary_threshold(image, thread_count, ThresholdParams());
+}
+
+/******************************************************************************
+ * Function: noise_channel
+ * Description: A channel with speckle or Gaussian noise added, rounded and
+ *  clamped to 0 - 255.
+ * Parameters:
+ *   value - the channel
+ *   normal - a standard normal random number
+ *   sigma - the standard deviation in levels
+ *   speckle - whether to scale the noise by value / 255
+ *****************************************************************************/
+static inline int noise_channel(int value, float normal, float sigma, bool speckle)
+{
+    float scale = speckle ? sigma * value * (1.0f / 255) : sigma;
+
+    return qBound(0, qRound(value + normal * scale), 255);
 }
 
 /******************************************************************************
  * Function: noise
- * Description: Adds salt and pepper noise randomly through the image in parallel
+ * Description: Adds salt and pepper, Gaussian or speckle noise to the image in
+ *  parallel. The random numbers come from a counter based generator keyed by
+ *  the seed and row and counted by column and channel, so the result only
+ *  depends on the image and the parameters, not on the threads.
  * Parameters:
  *   image - the image to process on
  *   thread_count - the number of threads to use
- * Returns: the darkened image after its computed
+ *   params - the kind and amount of noise and the seed, 2% salt and pepper
+ *            by default
+ * Returns: the noisy image
  *****************************************************************************/
-QImage* noise( const QImage& image, const int& thread_count)
+QImage* noise( const QImage& image, const int& thread_count, const NoiseParams& params)
 {
-    QImage* newImage = new QImage(image.size(), image.format());
+    ScheduleScope schedule("noise");
+
+    QImage source = to_argb32(image);
+    QImage* newImage = new_output_image(source.size(), thread_count);
     QSize size = newImage->size();
-    int r;
-    int red, green, blue;
-#   pragma omp parallel for num_threads(thread_count) default(none) \
-        shared(size, image, newImage, thread_count) private(r, red, green, blue)
-    for(r = 0; r < size.height(); r++)
-    {
-        for(int c = 0; c < size.width(); c++)
-        {
-            //Commented out since this line adds random white and black horizontal lines across image
-            //unsigned int my_time =  time(NULL)*r*r + c*r*c/(thread_count+r+c*r + time(NULL));
-            unsigned int my_time = time(NULL) * r + c;
-            int x = rand_r(&my_time) % 100;
-            QColor color = QColor(image.pixel(c, r));
-            color.getRgb(&red, &green, &blue);
-            red   = (( x == 99 ) ? 255 : ((x == 23) ? 0 : red));
-            green = (( x == 99 ) ? 255 : ((x == 23) ? 0 : green));
-            blue  = (( x == 99 ) ? 255 : ((x == 23) ? 0 : blue));
 
-            color.setRgb(red, green, blue);
+    ConstScanlines in(source);
+    Scanlines out(*newImage);
 
-            newImage->setPixel(c, r, color.rgb());
+    FilterProgress* progress = FilterProgress::current();
+    progress_add_work(progress, size.height());
+    //x in 0 - 99: the top "salt" values turn white, the bottom "pepper" black
+    int percent = qBound(0, params.percent, 100);
+    int pepper = percent / 2;
+    int salt = 100 - (percent - pepper);
 
+    NoiseType type = params.type;
+    float sigma = (float)qMax(0.0, params.sigma);
+    bool speckle = type == NOISE_SPECKLE;
+    quint32 seed = params.seed;
 
+#   pragma omp parallel for num_threads(thread_count) schedule(runtime) default(none) \
+        shared(progress, size, in, out, salt, pepper, type, sigma, speckle, seed)
+    for(int r = 0; r < size.height(); r++)
+    {
+        if(progress_cancelled(progress))
+            continue;
+
+        const QRgb* src = in[r];
+        QRgb* dst = out[r];
+        quint32 key = random_key(seed, r);
+
+        if(type == NOISE_SALT_PEPPER)
+        {
+            for(int c = 0; c < size.width(); c++)
+            {
+                int x = random_below(key, c, 100);
+
+                dst[c] = x >= salt ? qRgb(255, 255, 255) : x < pepper ? qRgb(0, 0, 0) : src[c] | 0xff000000u;
+            }
+        }
+        else
+        {
+            for(int c = 0; c < size.width(); c++)
+            {
+                int red   = noise_channel(qRed(src[c]), random_normal(key, 3 * c), sigma, speckle);
+                int green = noise_channel(qGreen(src[c]), random_normal(key, 3 * c + 1), sigma, speckle);
+                int blue  = noise_channel(qBlue(src[c]), random_normal(key, 3 * c + 2), sigma, speckle);
+
+                dst[c] = qRgb(red, green, blue);
+            }
         }
+
+        progress_advance(progress);
     }
     return newImage;
 }
+
+QImage* noise( const QImage& image, const int& thread_count)
+{
+    return noise(image, thread_count, NoiseParams());
+}
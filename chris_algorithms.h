@@ -4,16 +4,81 @@
 
 #include <QImage>
 
+/******************************************************************************
+ * Struct: BrightnessParams
+ * Description: How much brighten() adds to and darken() subtracts from each
+ *  channel, 0 - 255. Any amount runs on the saturating vector kernels.
+ *****************************************************************************/
+struct BrightnessParams
+{
+    explicit BrightnessParams(int amount = 20) :
+        amount(amount)
+    {
+    }
+
+    int amount;
+};
+
+/******************************************************************************
+ * Struct: ThresholdParams
+ * Description: Channels above threshold become 255, the rest 0.
+ *****************************************************************************/
+struct ThresholdParams
+{
+    explicit ThresholdParams(int threshold = 127) :
+        threshold(threshold)
+    {
+    }
+
+    int threshold;
+};
+
+enum NoiseType
+{
+    NOISE_SALT_PEPPER,  // pixels turned white or black
+    NOISE_GAUSSIAN,     // normal noise of sigma levels added to each channel
+    NOISE_SPECKLE       // normal noise scaled by each channel's value
+};
+
+/******************************************************************************
+ * Struct: NoiseParams
+ * Description: The noise noise() adds. Salt and pepper replaces percent of
+ *  the pixels, half with white and half with black. Gaussian noise has a
+ *  standard deviation of sigma levels; speckle noise has sigma levels at full
+ *  brightness, less in proportion on darker channels. The same seed gives the
+ *  same noise on the same image, whatever the thread count.
+ *****************************************************************************/
+struct NoiseParams
+{
+    explicit NoiseParams(int percent = 2, NoiseType type = NOISE_SALT_PEPPER,
+                         double sigma = 20, quint32 seed = 0) :
+        percent(percent),
+        type(type),
+        sigma(sigma),
+        seed(seed)
+    {
+    }
+
+    int percent;
+    NoiseType type;
+    double sigma;
+    quint32 seed;
+};
+
 QImage* brighten(const QImage& image, int thread_count);
+QImage* brighten(const QImage& image, int thread_count, const BrightnessParams& params);
 
 QImage* darken(const QImage& image, int thread_count);
+QImage* darken(const QImage& image, int thread_count, const BrightnessParams& params);
 
 QImage* brighten_darken(const QImage& image, const int &thread_count, const int &value, const int &limit);
 
 QImage* negate(const QImage& image, const int& thread_count);
 
 QImage* binary_threshold(const QImage& image, const int& thread_count);
+QImage* binary_threshold(const QImage& image, const int& thread_count, const ThresholdParams& params);
 
 QImage* noise( const QImage& image, const int& thread_count);
+QImage* noise( const QImage& image, const int& thread_count, const NoiseParams& params);
 
 #endif // CHRIS_ALGORITHMS_H
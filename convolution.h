@@ -0,0 +1,541 @@
+#ifndef CONVOLUTION_H
+#define CONVOLUTION_H
+
+#include <QImage>
+
+#include <cmath>
+
+#include "pixel_access.h"
+#include "planar_image.h"
+#include "filter_progress.h"
+
+/******************************************************************************
+ * Generic convolution engine for the kernel filters.
+ *
+ * convolve<Radius>(image, layout, edge, thread_count) runs a
+ * (2*Radius+1) x (2*Radius+1) stencil over every pixel. The kernel radius is
+ * a template parameter, so the tap loops below are expanded at compile time
+ * into straight line code for the 3x3 and 5x5 kernels. The layout decides
+ * what is accumulated per tap and how the sum becomes an output pixel (the
+ * HSV value only, each RGB channel, a gradient magnitude...), so a new kernel
+ * filter only has to supply its masks.
+ *
+ * Edge handling is hoisted out of the inner loop: the source rows for an
+ * output row are resolved once with the edge mode, the interior columns read
+ * row[c + j] directly, and only the Radius columns at either end go through
+ * the remapped column indices.
+ *
+ * The image is processed in cache sized 2D tiles rather than whole rows; see
+ * convolve(). The value and gradient kernels run on a planar float copy of
+ * the HSV values instead, see convolve_value_planar().
+ *****************************************************************************/
+
+// Default tile size for convolve(), see convolve_tile_size()
+#define CONVOLVE_TILE_WIDTH 512
+#define CONVOLVE_TILE_HEIGHT 64
+
+/******************************************************************************
+ * Column indexers: the interior of a row reads c + j, the border columns
+ * read through a table built with edge_index().
+ *****************************************************************************/
+struct InteriorColumns
+{
+    int c;
+
+    int operator()(int j) const { return c + j; }
+};
+
+template<int Radius>
+struct BorderColumns
+{
+    int index[2 * Radius + 1];
+
+    int operator()(int j) const { return index[j + Radius]; }
+};
+
+/******************************************************************************
+ * ConvolveTaps / ConvolveRows: compile time expansion of the tap loops.
+ * Remaining counts down from 2*Radius+1, giving offsets -Radius..Radius.
+ *****************************************************************************/
+template<int Radius, int Remaining>
+struct ConvolveTaps
+{
+    template<class Layout, class Columns>
+    static inline void apply(const Layout& layout, typename Layout::Accumulator& acc,
+                             int i, const QRgb* row, const Columns& columns)
+    {
+        const int j = Radius + 1 - Remaining;
+
+        layout.add(acc, i, j, row[columns(j)]);
+        ConvolveTaps<Radius, Remaining - 1>::apply(layout, acc, i, row, columns);
+    }
+};
+
+template<int Radius>
+struct ConvolveTaps<Radius, 0>
+{
+    template<class Layout, class Columns>
+    static inline void apply(const Layout&, typename Layout::Accumulator&,
+                             int, const QRgb*, const Columns&)
+    {
+    }
+};
+
+template<int Radius, int Remaining>
+struct ConvolveRows
+{
+    template<class Layout, class Columns>
+    static inline void apply(const Layout& layout, typename Layout::Accumulator& acc,
+                             const QRgb* const* rows, const Columns& columns)
+    {
+        const int i = Radius + 1 - Remaining;
+
+        ConvolveTaps<Radius, 2 * Radius + 1>::apply(layout, acc, i, rows[i + Radius], columns);
+        ConvolveRows<Radius, Remaining - 1>::apply(layout, acc, rows, columns);
+    }
+};
+
+template<int Radius>
+struct ConvolveRows<Radius, 0>
+{
+    template<class Layout, class Columns>
+    static inline void apply(const Layout&, typename Layout::Accumulator&,
+                             const QRgb* const*, const Columns&)
+    {
+    }
+};
+
+/******************************************************************************
+ * Function: convolve_pixel
+ * Description: Evaluates the whole stencil for one output pixel.
+ *****************************************************************************/
+template<int Radius, class Layout, class Columns>
+inline QRgb convolve_pixel(const Layout& layout, const QRgb* const* rows,
+                           const Columns& columns, QRgb center)
+{
+    typename Layout::Accumulator acc;
+    layout.begin(acc);
+
+    ConvolveRows<Radius, 2 * Radius + 1>::apply(layout, acc, rows, columns);
+
+    return layout.finish(acc, center);
+}
+
+/******************************************************************************
+ * Function: convolve_span
+ * Description: Convolves columns first - last of one output row. The source
+ *  rows are resolved once, then the part of the span in the left border, the
+ *  interior and the right border are run as three separate loops so the
+ *  interior never touches the edge handling.
+ * Parameters:
+ *   layout - what to accumulate and how to write it
+ *   edge - the edge mode
+ *   in - the source image rows, anything indexable as in[r] giving a row
+ *        pointer (ConstScanlines, PipelineRows)
+ *   dst - the output row
+ *   r - the output row index
+ *   size - the image size
+ *   first, last - the columns to produce, [first, last)
+ *****************************************************************************/
+template<int Radius, class Layout, class Rows>
+void convolve_span(const Layout& layout, EdgeMode edge, const Rows& in,
+                   QRgb* dst, int r, const QSize& size, int first, int last)
+{
+    const int width = size.width();
+    const QRgb* rows[2 * Radius + 1];
+
+    for(int i = -Radius; i <= Radius; i++)
+        rows[i + Radius] = in[edge_index(r + i, size.height(), edge)];
+
+    const QRgb* center = rows[Radius];
+    int left = qBound(first, qMin(Radius, width), last);
+    int right = qBound(first, qMax(qMin(Radius, width), width - Radius), last);
+
+    BorderColumns<Radius> border;
+    for(int c = first; c < left; c++)
+    {
+        for(int j = -Radius; j <= Radius; j++)
+            border.index[j + Radius] = edge_index(c + j, width, edge);
+
+        dst[c] = convolve_pixel<Radius>(layout, rows, border, center[c]);
+    }
+
+    InteriorColumns interior;
+    for(int c = left; c < right; c++)
+    {
+        interior.c = c;
+        dst[c] = convolve_pixel<Radius>(layout, rows, interior, center[c]);
+    }
+
+    for(int c = right; c < last; c++)
+    {
+        for(int j = -Radius; j <= Radius; j++)
+            border.index[j + Radius] = edge_index(c + j, width, edge);
+
+        dst[c] = convolve_pixel<Radius>(layout, rows, border, center[c]);
+    }
+}
+
+/******************************************************************************
+ * Function: convolve_row
+ * Description: Convolves one whole output row, see convolve_span().
+ *****************************************************************************/
+template<int Radius, class Layout, class Rows>
+void convolve_row(const Layout& layout, EdgeMode edge, const Rows& in,
+                  QRgb* dst, int r, const QSize& size)
+{
+    convolve_span<Radius>(layout, edge, in, dst, r, size, 0, size.width());
+}
+
+/******************************************************************************
+ * Function: convolve_tile_size
+ * Description: The tile size convolve() works in. A tile with its halo has to
+ *  stay in a core's L2 cache: the default 512 x 64 pixel tile reads 66 - 68
+ *  rows of 516 - 520 pixels, about 140KB. A width of 0 uses whole rows and a
+ *  height of 0 one row per tile, the row at a time order convolve() used
+ *  before it was tiled. Set it before running a filter, not during one.
+ *****************************************************************************/
+inline QSize& convolve_tile_size()
+{
+    static QSize tile(CONVOLVE_TILE_WIDTH, CONVOLVE_TILE_HEIGHT);
+    return tile;
+}
+
+/******************************************************************************
+ * Function: convolve_tile
+ * Description: Finds which column and row of tiles tile t is. Tiles are
+ *  numbered down each column of tiles, or across each row of tiles if
+ *  rowMajor is set; see convolve().
+ *****************************************************************************/
+inline void convolve_tile(int t, bool rowMajor, int tilesAcross, int tilesDown, int& column, int& row)
+{
+    if(rowMajor)
+    {
+        column = t % tilesAcross;
+        row = t / tilesAcross;
+    }
+    else
+    {
+        column = t / tilesDown;
+        row = t % tilesDown;
+    }
+}
+
+/******************************************************************************
+ * Function: convolve
+ * Description: Runs a (2*Radius+1)^2 stencil over the image in parallel.
+ *  The image is cut into tiles of convolve_tile_size(), so on wide images the
+ *  source rows around a tile stay in cache while the tile is produced instead
+ *  of streaming whole rows for every output row. Tiles are numbered down
+ *  each column of tiles, so a thread that takes consecutive tiles works down
+ *  a column and finds the halo rows of its next tile already in cache from
+ *  the tile above. Under SCHEDULE_PLACED, if first_touch() placed the
+ *  output's pages in row bands, tiles are numbered across each row of tiles
+ *  instead and the loop runs static, so each thread writes, to within a row
+ *  of tiles, the band it touched.
+ * Parameters:
+ *   image - the image to process on
+ *   layout - what to accumulate and how to write it
+ *   edge - how coordinates outside the image are handled
+ *   thread_count - the number of threads to use
+ * Returns: The convolved image.
+ *****************************************************************************/
+template<int Radius, class Layout>
+QImage* convolve(const QImage& image, const Layout& layout, EdgeMode edge, int thread_count)
+{
+    QImage source = to_argb32(image);
+    QImage* newImage = new_output_image(source.size(), thread_count);
+    QSize size = newImage->size();
+
+    QSize tile = convolve_tile_size();
+    int tileWidth = tile.width() > 0 ? qMin(tile.width(), size.width()) : size.width();
+    int tileHeight = tile.height() > 0 ? tile.height() : 1;
+    int tilesAcross = (size.width() + qMax(1, tileWidth) - 1) / qMax(1, tileWidth);
+    int tilesDown = (size.height() + tileHeight - 1) / tileHeight;
+    int tiles = tilesAcross * tilesDown;
+    bool rowMajor = placed_output(*newImage, thread_count);
+
+    ConstScanlines in(source);
+    Scanlines out(*newImage);
+
+    FilterProgress* progress = FilterProgress::current();
+    progress_add_work(progress, tiles);
+
+    PlacementScope placement(*newImage, thread_count);
+
+#   pragma omp parallel num_threads(thread_count) default(none) \
+        shared(progress, size, in, out, layout, edge, tileWidth, tileHeight, tilesAcross, tilesDown, tiles, rowMajor) \
+        copyin(traceOperation)
+    {
+        TraceScope trace("convolve", "tiles");
+
+#       pragma omp for schedule(runtime) nowait
+        for(int t = 0; t < tiles; t++)
+        {
+            if(progress_cancelled(progress))
+                continue;
+
+            int tileColumn, tileRow;
+            convolve_tile(t, rowMajor, tilesAcross, tilesDown, tileColumn, tileRow);
+
+            int first = tileColumn * tileWidth;
+            int last = qMin(first + tileWidth, size.width());
+            int top = tileRow * tileHeight;
+            int bottom = qMin(top + tileHeight, size.height());
+
+            for(int r = top; r < bottom; r++)
+                convolve_span<Radius>(layout, edge, in, out[r], r, size, first, last);
+
+            trace.add_count(1);
+            progress_advance(progress);
+        }
+    }
+
+    return newImage;
+}
+
+/******************************************************************************
+ * Class: ValueKernel
+ * Description: Convolves the HSV value of each pixel with one mask and writes
+ *  the clamped result back as the value of the center pixel, keeping its hue
+ *  and saturation.
+ *****************************************************************************/
+template<int Radius>
+struct ValueKernel
+{
+    typedef float Accumulator;
+
+    float mask[2 * Radius + 1][2 * Radius + 1];
+
+    void begin(Accumulator& acc) const { acc = 0; }
+
+    void add(Accumulator& acc, int i, int j, QRgb pixel) const
+    {
+        acc += mask[i + Radius][j + Radius] * pixel_value(pixel);
+    }
+
+    QRgb finish(const Accumulator& acc, QRgb center) const
+    {
+        float value = acc;
+
+        if(value < 0)
+            value = 0;
+        else if(value > 255)
+            value = 255;
+
+        return with_value(center, (int)value);
+    }
+};
+
+/******************************************************************************
+ * Class: RgbKernel
+ * Description: Convolves the red, green and blue channels independently with
+ *  one mask and clamps each to 0 - 255.
+ *****************************************************************************/
+template<int Radius>
+struct RgbKernel
+{
+    struct Accumulator
+    {
+        float r, g, b;
+    };
+
+    float mask[2 * Radius + 1][2 * Radius + 1];
+
+    void begin(Accumulator& acc) const { acc.r = acc.g = acc.b = 0; }
+
+    void add(Accumulator& acc, int i, int j, QRgb pixel) const
+    {
+        float weight = mask[i + Radius][j + Radius];
+
+        acc.r += qRed(pixel) * weight;
+        acc.g += qGreen(pixel) * weight;
+        acc.b += qBlue(pixel) * weight;
+    }
+
+    QRgb finish(const Accumulator& acc, QRgb) const
+    {
+        return qRgb((int)qBound(0.0f, acc.r, 255.0f),
+                    (int)qBound(0.0f, acc.g, 255.0f),
+                    (int)qBound(0.0f, acc.b, 255.0f));
+    }
+};
+
+/******************************************************************************
+ * Class: GradientKernel
+ * Description: Convolves the HSV value with an x and a y mask in the same
+ *  pass and writes the clamped gradient magnitude as the value of the center
+ *  pixel.
+ *****************************************************************************/
+template<int Radius>
+struct GradientKernel
+{
+    struct Accumulator
+    {
+        float x, y;
+    };
+
+    float xmask[2 * Radius + 1][2 * Radius + 1];
+    float ymask[2 * Radius + 1][2 * Radius + 1];
+
+    void begin(Accumulator& acc) const { acc.x = acc.y = 0; }
+
+    void add(Accumulator& acc, int i, int j, QRgb pixel) const
+    {
+        int value = pixel_value(pixel);
+
+        acc.x += xmask[i + Radius][j + Radius] * value;
+        acc.y += ymask[i + Radius][j + Radius] * value;
+    }
+
+    QRgb finish(const Accumulator& acc, QRgb center) const
+    {
+        float magnitude = std::sqrt(acc.x * acc.x + acc.y * acc.y);
+
+        if(magnitude > 255)
+            magnitude = 255;
+
+        return with_value(center, (int)magnitude);
+    }
+};
+
+/******************************************************************************
+ * Function: convolve_value_planar
+ * Description: convolve() for the kernels that work on the HSV value. The
+ *  value of each pixel is taken once into a float plane with a border of
+ *  Radius filled with the edge mode, instead of once per tap, and each output
+ *  row of a tile sums the taps one at a time over the whole span, so the
+ *  inner loops run over contiguous floats and vectorize. The taps are added
+ *  in the same order as the packed path, so the result is identical.
+ * Parameters:
+ *   image - the image to process on
+ *   xmask - the mask to convolve with
+ *   ymask - NULL, or the second mask of a gradient, see GradientKernel
+ *   edge - how coordinates outside the image are handled
+ *   thread_count - the number of threads to use
+ * Returns: The convolved image.
+ *****************************************************************************/
+template<int Radius>
+QImage* convolve_value_planar(const QImage& image, const float (*xmask)[2 * Radius + 1],
+                              const float (*ymask)[2 * Radius + 1], EdgeMode edge, int thread_count)
+{
+    const int Taps = 2 * Radius + 1;
+
+    QImage source = to_argb32(image);
+    PlanarImage<float>* plane = to_planar<float>(source, PLANAR_VALUE, Radius, edge, thread_count);
+    QImage* newImage = new_output_image(source.size(), thread_count);
+    QSize size = newImage->size();
+
+    QSize tile = convolve_tile_size();
+    int tileWidth = tile.width() > 0 ? qMin(tile.width(), size.width()) : size.width();
+    int tileHeight = tile.height() > 0 ? tile.height() : 1;
+    int tilesAcross = (size.width() + qMax(1, tileWidth) - 1) / qMax(1, tileWidth);
+    int tilesDown = (size.height() + tileHeight - 1) / tileHeight;
+    int tiles = tilesAcross * tilesDown;
+    bool rowMajor = placed_output(*newImage, thread_count);
+
+    ConstScanlines in(source);
+    Scanlines out(*newImage);
+
+    FilterProgress* progress = FilterProgress::current();
+    progress_add_work(progress, tiles);
+
+    PlacementScope placement(*newImage, thread_count);
+
+#   pragma omp parallel num_threads(thread_count) default(none) \
+        shared(progress, size, in, out, plane, xmask, ymask, tileWidth, tileHeight, tilesAcross, tilesDown, tiles, rowMajor) \
+        copyin(traceOperation)
+    {
+        TraceScope trace("convolve planar", "tiles");
+
+        float* xsum = new float[qMax(1, tileWidth)];
+        float* ysum = new float[qMax(1, tileWidth)];
+
+#       pragma omp for schedule(runtime) nowait
+        for(int t = 0; t < tiles; t++)
+        {
+            if(progress_cancelled(progress))
+                continue;
+
+            int tileColumn, tileRow;
+            convolve_tile(t, rowMajor, tilesAcross, tilesDown, tileColumn, tileRow);
+
+            int first = tileColumn * tileWidth;
+            int count = qMin(first + tileWidth, size.width()) - first;
+            int top = tileRow * tileHeight;
+            int bottom = qMin(top + tileHeight, size.height());
+
+            for(int r = top; r < bottom; r++)
+            {
+                for(int k = 0; k < count; k++)
+                    xsum[k] = ysum[k] = 0;
+
+                for(int i = 0; i < Taps; i++)
+                {
+                    const float* row = plane->row(0, r + i - Radius) + first - Radius;
+
+                    for(int j = 0; j < Taps; j++)
+                    {
+                        float weight = xmask[i][j];
+                        for(int k = 0; k < count; k++)
+                            xsum[k] += weight * row[k + j];
+
+                        if(ymask != NULL)
+                        {
+                            weight = ymask[i][j];
+                            for(int k = 0; k < count; k++)
+                                ysum[k] += weight * row[k + j];
+                        }
+                    }
+                }
+
+                const QRgb* center = in[r] + first;
+                QRgb* dst = out[r] + first;
+
+                for(int k = 0; k < count; k++)
+                {
+                    float value = xsum[k];
+
+                    if(ymask != NULL)
+                    {
+                        value = std::sqrt(xsum[k] * xsum[k] + ysum[k] * ysum[k]);
+
+                        if(value > 255)
+                            value = 255;
+                    }
+
+                    dst[k] = with_value(center[k], planar_byte(value));
+                }
+            }
+
+            trace.add_count(1);
+            progress_advance(progress);
+        }
+
+        delete[] xsum;
+        delete[] ysum;
+    }
+
+    delete plane;
+
+    return newImage;
+}
+
+/******************************************************************************
+ * Function: convolve
+ * Description: The value and gradient kernels run on a float value plane,
+ *  see convolve_value_planar().
+ *****************************************************************************/
+template<int Radius>
+QImage* convolve(const QImage& image, const ValueKernel<Radius>& kernel, EdgeMode edge, int thread_count)
+{
+    return convolve_value_planar<Radius>(image, kernel.mask, NULL, edge, thread_count);
+}
+
+template<int Radius>
+QImage* convolve(const QImage& image, const GradientKernel<Radius>& kernel, EdgeMode edge, int thread_count)
+{
+    return convolve_value_planar<Radius>(image, kernel.xmask, kernel.ymask, edge, thread_count);
+}
+
+#endif // CONVOLUTION_H
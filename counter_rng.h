@@ -0,0 +1,97 @@
+#ifndef COUNTER_RNG_H
+#define COUNTER_RNG_H
+
+#include <QtGlobal>
+
+#include <cmath>
+
+/******************************************************************************
+ * Counter based random numbers for the noise filters.
+ *
+ * A sequential generator such as rand_r() has state, so splitting an image
+ * between threads means either sharing the state, which serializes them, or
+ * seeding one generator per row, whose seeds collide and whose output then
+ * depends on how the rows were split. Here a random number is instead a pure
+ * function of a key and a counter: the key comes from the seed and the row,
+ * the counter from the column and channel, and the result is a hash of the
+ * two. Any thread can compute any pixel's numbers in any order, the image
+ * comes out the same for every thread count and schedule, and a loop along a
+ * row is plain 32 bit integer arithmetic the compiler can vectorize.
+ *
+ * The hash is a 32 bit integer finalizer (xor-shift, multiply, xor-shift,
+ * multiply, xor-shift), which passes the usual avalanche tests; applied to
+ * a counter it gives a sequence good enough for image noise, not for
+ * cryptography.
+ *****************************************************************************/
+
+/******************************************************************************
+ * Function: random_hash
+ * Description: Mixes the bits of x so that every input bit changes about half
+ *  of the output bits.
+ *****************************************************************************/
+inline quint32 random_hash(quint32 x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+
+    return x;
+}
+
+/******************************************************************************
+ * Function: random_key
+ * Description: The key of one stream of numbers, such as one image row.
+ * Parameters:
+ *   seed - the seed the filter was given
+ *   stream - which stream of that seed
+ *****************************************************************************/
+inline quint32 random_key(quint32 seed, quint32 stream)
+{
+    return random_hash(random_hash(seed) + 0x9e3779b9u * (stream + 1));
+}
+
+/******************************************************************************
+ * Function: random_bits
+ * Description: The counter-th random number of the key's stream.
+ *****************************************************************************/
+inline quint32 random_bits(quint32 key, quint32 counter)
+{
+    return random_hash(key ^ random_hash(counter));
+}
+
+/******************************************************************************
+ * Function: random_below
+ * Description: A random integer in 0 to n - 1, scaled rather than taken
+ *  modulo n so every value is equally likely up to 1 in 2^32.
+ *****************************************************************************/
+inline int random_below(quint32 key, quint32 counter, int n)
+{
+    return (int)(((quint64)random_bits(key, counter) * (quint32)n) >> 32);
+}
+
+/******************************************************************************
+ * Function: random_uniform
+ * Description: A random float in (0, 1], never 0 so it can be logged.
+ *****************************************************************************/
+inline float random_uniform(quint32 key, quint32 counter)
+{
+    return ((random_bits(key, counter) >> 8) + 1) * (1.0f / 16777216.0f);
+}
+
+/******************************************************************************
+ * Function: random_normal
+ * Description: A random float from the standard normal distribution, by the
+ *  Box-Muller transform of the uniforms at counters 2 * counter and
+ *  2 * counter + 1.
+ *****************************************************************************/
+inline float random_normal(quint32 key, quint32 counter)
+{
+    float u = random_uniform(key, 2 * counter);
+    float v = random_uniform(key, 2 * counter + 1);
+
+    return std::sqrt(-2.0f * std::log(u)) * std::cos(6.28318531f * v);
+}
+
+#endif // COUNTER_RNG_H
@@ -0,0 +1,321 @@
+#include "fft_engine.h"
+
+#include <cmath>
+
+using namespace std;
+
+// Largest prime radix handled directly; anything bigger goes through Bluestein
+static const int MAX_DIRECT_RADIX = 64;
+
+/******************************************************************************
+ * Function: factorize
+ * Description: Splits n into the radices used by the Stockham passes. Fours
+ *  are pulled out first since a radix-4 pass is cheaper than two radix-2
+ *  passes, then twos, then the remaining odd primes in increasing order.
+ * Parameters:
+ *   n - the length to factor
+ *   factors - receives the radices, in the order the passes will run
+ *****************************************************************************/
+static void factorize(int n, vector<int>& factors)
+{
+    while(n % 4 == 0)
+    {
+        factors.push_back(4);
+        n /= 4;
+    }
+    while(n % 2 == 0)
+    {
+        factors.push_back(2);
+        n /= 2;
+    }
+    for(int p = 3; p * p <= n; p += 2)
+    {
+        while(n % p == 0)
+        {
+            factors.push_back(p);
+            n /= p;
+        }
+    }
+    if(n > 1)
+        factors.push_back(n);
+}
+
+/******************************************************************************
+ * Function: FFTPlan::FFTPlan
+ * Description: Builds the plan for a length n transform. The direct mixed
+ *  radix factorization is used unless it has a prime factor too large for the
+ *  generic butterfly, or a rough operation count says a Bluestein transform
+ *  over the next power of two would be cheaper.
+ * Parameters:
+ *   n - the transform length
+ *****************************************************************************/
+FFTPlan::FFTPlan(int n) :
+    n(n),
+    inner(NULL)
+{
+    if(n <= 1)
+        return;
+
+    factorize(n, factors);
+
+    double directCost = 0;
+    for(size_t i = 0; i < factors.size(); i++)
+        directCost += factors[i];
+    directCost *= n;
+
+    int m = 1;
+    while(m < 2 * n - 1)
+        m *= 2;
+    double bluesteinCost = 4.0 * m * log2((double)m) + 3.0 * m;
+
+    if(factors.back() > MAX_DIRECT_RADIX || bluesteinCost < directCost)
+    {
+        factors.clear();
+
+        inner = new FFTPlan(m);
+
+        //chirp[k] = exp(-i*pi*k^2/n), with k^2 reduced mod 2n to keep the
+        //angle small enough to stay accurate for large k
+        chirp.resize(n);
+        for(int k = 0; k < n; k++)
+        {
+            long long k2 = ((long long)k * k) % (2LL * n);
+            double angle = -M_PI * k2 / n;
+            chirp[k] = fft_complex(cos(angle), sin(angle));
+        }
+
+        //the convolution filter is the conjugate chirp wrapped around both
+        //ends of a length m buffer, transformed once up front. The 1/m of the
+        //inverse transform is folded in here as well.
+        chirpFilter.assign(m, fft_complex(0, 0));
+        chirpFilter[0] = conj(chirp[0]);
+        for(int k = 1; k < n; k++)
+        {
+            chirpFilter[k] = conj(chirp[k]);
+            chirpFilter[m - k] = conj(chirp[k]);
+        }
+
+        vector<fft_complex> scratch(inner->scratch_size());
+        inner->forward(&chirpFilter[0], &scratch[0]);
+
+        for(int k = 0; k < m; k++)
+            chirpFilter[k] /= (double)m;
+    }
+    else
+    {
+        //every twiddle any pass needs is a power of the n-th root of unity
+        twiddles.resize(n);
+        for(int k = 0; k < n; k++)
+        {
+            double angle = -2 * M_PI * k / n;
+            twiddles[k] = fft_complex(cos(angle), sin(angle));
+        }
+    }
+}
+
+FFTPlan::~FFTPlan()
+{
+    delete inner;
+}
+
+/******************************************************************************
+ * Function: FFTPlan::scratch_size
+ * Description: The number of elements the scratch buffer given to forward()
+ *  must hold.
+ * Returns: The scratch size in complex elements.
+ *****************************************************************************/
+int FFTPlan::scratch_size() const
+{
+    if(inner != NULL)
+        return inner->size() + inner->scratch_size();
+
+    return n > 1 ? n : 1;
+}
+
+/******************************************************************************
+ * Function: FFTPlan::forward
+ * Description: Computes the unnormalized forward transform
+ *  X[k] = sum x[j] * exp(-2*pi*i*j*k/n) in place.
+ * Parameters:
+ *   data - the n values to transform, overwritten by the result
+ *   scratch - a work buffer of at least scratch_size() elements
+ *****************************************************************************/
+void FFTPlan::forward(fft_complex* data, fft_complex* scratch) const
+{
+    if(n <= 1)
+        return;
+
+    if(inner != NULL)
+        bluestein(data, scratch);
+    else
+        stockham(data, scratch);
+}
+
+/******************************************************************************
+ * Function: FFTPlan::stockham
+ * Description: Mixed radix Stockham autosort FFT. Each pass reads one buffer
+ *  and writes the other, so no bit reversal step is needed. For a pass of
+ *  radix p over sub-transforms of length len = p*m with stride s, the twiddle
+ *  exp(-2*pi*i*k*u/len) is twiddles[k*u*s].
+ * Parameters:
+ *   data - the n values to transform, overwritten by the result
+ *   scratch - a work buffer of at least n elements
+ *****************************************************************************/
+void FFTPlan::stockham(fft_complex* data, fft_complex* scratch) const
+{
+    fft_complex* x = data;
+    fft_complex* y = scratch;
+    int len = n;
+    int s = 1;
+
+    for(size_t f = 0; f < factors.size(); f++)
+    {
+        const int p = factors[f];
+        const int m = len / p;
+
+        if(p == 4)
+        {
+            for(int k = 0; k < m; k++)
+            {
+                fft_complex w1 = twiddles[k * s];
+                fft_complex w2 = twiddles[2 * k * s];
+                fft_complex w3 = twiddles[3 * k * s];
+
+                for(int q = 0; q < s; q++)
+                {
+                    fft_complex a0 = x[q + s * k];
+                    fft_complex a1 = x[q + s * (k + m)];
+                    fft_complex a2 = x[q + s * (k + 2 * m)];
+                    fft_complex a3 = x[q + s * (k + 3 * m)];
+
+                    fft_complex b0 = a0 + a2;
+                    fft_complex b1 = a0 - a2;
+                    fft_complex b2 = a1 + a3;
+                    fft_complex d = a1 - a3;
+                    //multiply by -i
+                    fft_complex b3(d.imag(), -d.real());
+
+                    fft_complex* out = y + q + s * 4 * k;
+                    out[0] = b0 + b2;
+                    out[s] = (b1 + b3) * w1;
+                    out[2 * s] = (b0 - b2) * w2;
+                    out[3 * s] = (b1 - b3) * w3;
+                }
+            }
+        }
+        else if(p == 2)
+        {
+            for(int k = 0; k < m; k++)
+            {
+                fft_complex w1 = twiddles[k * s];
+
+                for(int q = 0; q < s; q++)
+                {
+                    fft_complex a0 = x[q + s * k];
+                    fft_complex a1 = x[q + s * (k + m)];
+
+                    fft_complex* out = y + q + s * 2 * k;
+                    out[0] = a0 + a1;
+                    out[s] = (a0 - a1) * w1;
+                }
+            }
+        }
+        else if(p == 3)
+        {
+            const double sin60 = sqrt(3.0) / 2;
+
+            for(int k = 0; k < m; k++)
+            {
+                fft_complex w1 = twiddles[k * s];
+                fft_complex w2 = twiddles[2 * k * s];
+
+                for(int q = 0; q < s; q++)
+                {
+                    fft_complex a0 = x[q + s * k];
+                    fft_complex a1 = x[q + s * (k + m)];
+                    fft_complex a2 = x[q + s * (k + 2 * m)];
+
+                    fft_complex t1 = a1 + a2;
+                    fft_complex t2 = a0 - 0.5 * t1;
+                    fft_complex d = (a1 - a2) * sin60;
+                    //multiply by -i
+                    fft_complex t3(d.imag(), -d.real());
+
+                    fft_complex* out = y + q + s * 3 * k;
+                    out[0] = a0 + t1;
+                    out[s] = (t2 + t3) * w1;
+                    out[2 * s] = (t2 - t3) * w2;
+                }
+            }
+        }
+        else
+        {
+            //generic odd prime radix, O(p) work per output
+            const int step = n / p;
+            fft_complex a[MAX_DIRECT_RADIX];
+
+            for(int k = 0; k < m; k++)
+            {
+                for(int q = 0; q < s; q++)
+                {
+                    for(int r = 0; r < p; r++)
+                        a[r] = x[q + s * (k + r * m)];
+
+                    fft_complex* out = y + q + s * p * k;
+                    for(int u = 0; u < p; u++)
+                    {
+                        fft_complex sum = a[0];
+                        for(int r = 1; r < p; r++)
+                            sum += a[r] * twiddles[((r * u) % p) * step];
+
+                        out[u * s] = sum * twiddles[k * u * s];
+                    }
+                }
+            }
+        }
+
+        fft_complex* temp = x;
+        x = y;
+        y = temp;
+
+        len = m;
+        s *= p;
+    }
+
+    //an odd number of passes leaves the result in the scratch buffer
+    if(x != data)
+        for(int i = 0; i < n; i++)
+            data[i] = x[i];
+}
+
+/******************************************************************************
+ * Function: FFTPlan::bluestein
+ * Description: Bluestein's chirp-z transform. The length n DFT is rewritten
+ *  as a circular convolution of the chirped input with the conjugate chirp,
+ *  which is evaluated with power of two transforms of length m >= 2n-1. The
+ *  inverse transform is done as conj(FFT(conj(x))).
+ * Parameters:
+ *   data - the n values to transform, overwritten by the result
+ *   scratch - a work buffer of at least scratch_size() elements
+ *****************************************************************************/
+void FFTPlan::bluestein(fft_complex* data, fft_complex* scratch) const
+{
+    const int m = inner->size();
+    fft_complex* a = scratch;
+    fft_complex* innerScratch = scratch + m;
+
+    for(int k = 0; k < n; k++)
+        a[k] = data[k] * chirp[k];
+    for(int k = n; k < m; k++)
+        a[k] = fft_complex(0, 0);
+
+    inner->forward(a, innerScratch);
+
+    for(int k = 0; k < m; k++)
+        a[k] = conj(a[k] * chirpFilter[k]);
+
+    inner->forward(a, innerScratch);
+
+    for(int k = 0; k < n; k++)
+        data[k] = conj(a[k]) * chirp[k];
+}
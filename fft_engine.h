@@ -0,0 +1,47 @@
+#ifndef FFT_ENGINE_H
+#define FFT_ENGINE_H
+
+#include <complex>
+#include <vector>
+
+typedef std::complex<double> fft_complex;
+
+/******************************************************************************
+ * Class: FFTPlan
+ * Description: A precomputed plan for a forward 1D FFT of a fixed length.
+ *  Lengths that factor into small primes are handled with a mixed-radix
+ *  (4, 2, 3, 5 and generic) Stockham FFT driven by a single twiddle table.
+ *  Lengths with a large prime factor use Bluestein's algorithm on top of a
+ *  power of two plan. A plan is immutable once built, so one plan can be
+ *  shared by every thread as long as each thread passes its own scratch
+ *  buffer of at least scratch_size() elements.
+ *****************************************************************************/
+class FFTPlan
+{
+public:
+    explicit FFTPlan(int n);
+    ~FFTPlan();
+
+    int size() const { return n; }
+    int scratch_size() const;
+
+    void forward(fft_complex* data, fft_complex* scratch) const;
+
+private:
+    FFTPlan(const FFTPlan&);
+    FFTPlan& operator=(const FFTPlan&);
+
+    void stockham(fft_complex* data, fft_complex* scratch) const;
+    void bluestein(fft_complex* data, fft_complex* scratch) const;
+
+    int n;
+    std::vector<int> factors;
+    std::vector<fft_complex> twiddles;
+
+    // Bluestein state, only used when the plan is not a direct factorization
+    FFTPlan* inner;
+    std::vector<fft_complex> chirp;
+    std::vector<fft_complex> chirpFilter;
+};
+
+#endif // FFT_ENGINE_H
@@ -0,0 +1,49 @@
+#include "filter_progress.h"
+
+// The progress of the job running on this thread, if any
+static thread_local FilterProgress* currentProgress = NULL;
+
+FilterProgress::FilterProgress() :
+    total(0),
+    done(0),
+    cancelled(false)
+{
+}
+
+/******************************************************************************
+ * Function: FilterProgress::percent
+ * Description: How far the work announced so far has got. Multi pass filters
+ *  announce each pass as they reach it, so this can step back slightly when
+ *  a new pass starts.
+ * Returns: The progress, 0 - 100.
+ *****************************************************************************/
+int FilterProgress::percent() const
+{
+    int units = total.load(std::memory_order_relaxed);
+
+    if(units <= 0)
+        return 0;
+
+    return qMin(100, (int)(100LL * done.load(std::memory_order_relaxed) / units));
+}
+
+/******************************************************************************
+ * Function: FilterProgress::current
+ * Description: The progress installed on the calling thread.
+ * Returns: The progress, or NULL when no job is running on this thread.
+ *****************************************************************************/
+FilterProgress* FilterProgress::current()
+{
+    return currentProgress;
+}
+
+/******************************************************************************
+ * Function: FilterProgress::set_current
+ * Description: Installs the progress filters on the calling thread report to.
+ * Parameters:
+ *   progress - the progress, or NULL to detach
+ *****************************************************************************/
+void FilterProgress::set_current(FilterProgress* progress)
+{
+    currentProgress = progress;
+}
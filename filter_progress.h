@@ -0,0 +1,59 @@
+#ifndef FILTER_PROGRESS_H
+#define FILTER_PROGRESS_H
+
+#include <QtGlobal>
+
+#include <atomic>
+
+/******************************************************************************
+ * Class: FilterProgress
+ * Description: Progress and cancellation shared between a running filter and
+ *  whoever started it. A job installs its FilterProgress as the current one
+ *  on the thread that calls the filter; the filter picks it up with
+ *  FilterProgress::current() before its parallel regions, announces how many
+ *  rows (or other units) it will process, and advances the counter as rows
+ *  complete. Once cancel() is called the remaining loop iterations are
+ *  skipped, so the OpenMP loop drains quickly and the filter returns an
+ *  incomplete image that the caller throws away.
+ *
+ * Filters called without a job (batch mode, benchmarks) see a NULL current
+ * progress, and the progress_*() helpers below do nothing.
+ *****************************************************************************/
+class FilterProgress
+{
+public:
+    FilterProgress();
+
+    void add_work(int units) { total.fetch_add(units, std::memory_order_relaxed); }
+    void advance(int units) { done.fetch_add(units, std::memory_order_relaxed); }
+    void cancel() { cancelled.store(true, std::memory_order_relaxed); }
+    bool is_cancelled() const { return cancelled.load(std::memory_order_relaxed); }
+    int percent() const;
+
+    static FilterProgress* current();
+    static void set_current(FilterProgress* progress);
+
+private:
+    std::atomic<int> total;
+    std::atomic<int> done;
+    std::atomic<bool> cancelled;
+};
+
+inline void progress_add_work(FilterProgress* progress, int units)
+{
+    if(progress != NULL)
+        progress->add_work(units);
+}
+
+inline void progress_advance(FilterProgress* progress, int units = 1)
+{
+    if(progress != NULL)
+        progress->advance(units);
+}
+
+inline bool progress_cancelled(const FilterProgress* progress)
+{
+    return progress != NULL && progress->is_cancelled();
+}
+
+#endif // FILTER_PROGRESS_H
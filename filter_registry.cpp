@@ -0,0 +1,199 @@
+#include "filter_registry.h"
+
+#include "matt_algorithms.h"
+#include "chris_algorithms.h"
+#include "ian_algorithms.h"
+#include "blur.h"
+#include "adaptive_filters.h"
+#include "histogram.h"
+#include "pyramid.h"
+#include "point_ops.h"
+#include "simd_kernels.h"
+
+/******************************************************************************
+ * Adapters for the filters whose signatures differ from FilterFunction.
+ *****************************************************************************/
+static QImage* negate_filter(const QImage& image, int thread_count)
+{
+    return negate(image, thread_count);
+}
+
+static QImage* binary_threshold_filter(const QImage& image, int thread_count)
+{
+    return binary_threshold(image, thread_count);
+}
+
+static QImage* noise_filter(const QImage& image, int thread_count)
+{
+    return noise(image, thread_count);
+}
+
+static QImage* gaussian_noise_filter(const QImage& image, int thread_count)
+{
+    return noise(image, thread_count, NoiseParams(0, NOISE_GAUSSIAN));
+}
+
+static QImage* speckle_noise_filter(const QImage& image, int thread_count)
+{
+    return noise(image, thread_count, NoiseParams(0, NOISE_SPECKLE));
+}
+
+static QImage* scharr_gradient_filter(const QImage& image, int thread_count)
+{
+    return gradient(image, thread_count, GradientParams(GRADIENT_SCHARR));
+}
+
+static QImage* gaussian_blur_filter(const QImage& image, int thread_count)
+{
+    return gaussian_blur(image, 2.0, thread_count);
+}
+
+static QImage* box_blur_filter(const QImage& image, int thread_count)
+{
+    return box_blur(image, 2, thread_count);
+}
+
+/******************************************************************************
+ * Pipeline steps for the filters that can be fused, with the same parameters
+ * as the filter functions.
+ *****************************************************************************/
+static void grayscale_stage(Pipeline& pipeline)
+{
+    pipeline.add_row_stage(new RowKernelStage(grayscale_row));
+}
+
+static void smooth_stage(Pipeline& pipeline)
+{
+    pipeline.add_row_stage(new StencilStage<1, ValueKernel<1> >(smooth_kernel(), EDGE_WRAP));
+}
+
+static void gaussian_stage(Pipeline& pipeline)
+{
+    pipeline.add_row_stage(new StencilStage<2, ValueKernel<2> >(gaussian_kernel(), EDGE_WRAP));
+}
+
+static void sharpen_stage(Pipeline& pipeline)
+{
+    pipeline.add_row_stage(new StencilStage<1, RgbKernel<1> >(sharpen_kernel(), EDGE_CLAMP));
+}
+
+static void brighten_stage(Pipeline& pipeline)
+{
+    pipeline.add_point(brighten_darken_lut(20, 255));
+}
+
+static void darken_stage(Pipeline& pipeline)
+{
+    pipeline.add_point(brighten_darken_lut(-20, 0));
+}
+
+static void negate_stage(Pipeline& pipeline)
+{
+    pipeline.add_point(negate_lut());
+}
+
+static void binary_threshold_stage(Pipeline& pipeline)
+{
+    pipeline.add_point(threshold_lut(127));
+}
+
+static void enhance_contrast_stage(Pipeline& pipeline)
+{
+    pipeline.add_point(enhance_contrast_lut());
+}
+
+static void reduce_contrast_stage(Pipeline& pipeline)
+{
+    pipeline.add_point(reduce_contrast_lut());
+}
+
+static void posterize_stage(Pipeline& pipeline)
+{
+    pipeline.add_point(posterize_lut(4));
+}
+
+static void gamma_stage(Pipeline& pipeline)
+{
+    pipeline.add_point(gamma_lut(0.5));
+}
+
+static const FilterInfo filters[] =
+{
+    {"grayscale", grayscale, grayscale_stage},
+    {"smooth", smooth, smooth_stage},
+    {"gradient", gradient, NULL},
+    {"scharr_gradient", scharr_gradient_filter, NULL},
+    {"laplacian", laplacian, NULL},
+    {"gaussian", gaussian, gaussian_stage},
+    {"brighten", brighten, brighten_stage},
+    {"darken", darken, darken_stage},
+    {"negate", negate_filter, negate_stage},
+    {"binary_threshold", binary_threshold_filter, binary_threshold_stage},
+    {"noise", noise_filter, NULL},
+    {"gaussian_noise", gaussian_noise_filter, NULL},
+    {"speckle_noise", speckle_noise_filter, NULL},
+    {"sharpen", sharpen, sharpen_stage},
+    {"emboss", emboss, NULL},
+    {"enhance_contrast", enhance_contrast, enhance_contrast_stage},
+    {"reduce_contrast", reduce_contrast, reduce_contrast_stage},
+    {"posterize", posterize, posterize_stage},
+    {"gamma", gamma, gamma_stage},
+    {"fft", fft, NULL},
+    {"gaussian_blur", gaussian_blur_filter, NULL},
+    {"box_blur", box_blur_filter, NULL},
+    {"local_contrast", local_contrast, NULL},
+    {"adaptive_threshold", adaptive_threshold, NULL},
+    {"equalize", equalize, NULL},
+    {"auto_levels", auto_levels, NULL},
+    {"clahe", clahe, NULL},
+    {"pyramid_blur", pyramid_blur, NULL},
+    {"enhance_detail", enhance_detail, NULL}
+};
+
+static const int filter_count = sizeof(filters) / sizeof(filters[0]);
+
+/******************************************************************************
+ * Function: find_filter
+ * Description: Looks up a filter by name.
+ * Parameters:
+ *   name - the filter name, e.g. "grayscale"
+ * Returns: The filter, or NULL if there is no filter with that name.
+ *****************************************************************************/
+const FilterInfo* find_filter(const QString& name)
+{
+    for(int i = 0; i < filter_count; i++)
+        if(name == QLatin1String(filters[i].name))
+            return &filters[i];
+
+    return NULL;
+}
+
+/******************************************************************************
+ * Function: filter_names
+ * Description: The names of all registered filters, in menu order.
+ *****************************************************************************/
+QStringList filter_names()
+{
+    QStringList names;
+
+    for(int i = 0; i < filter_count; i++)
+        names << filters[i].name;
+
+    return names;
+}
+
+/******************************************************************************
+ * Function: append_filter
+ * Description: Appends a filter to a pipeline, as a fusable step when it has
+ *  one and as a whole image step otherwise.
+ * Parameters:
+ *   pipeline - the pipeline to extend
+ *   filter - the filter
+ *****************************************************************************/
+void append_filter(Pipeline& pipeline, const FilterInfo* filter)
+{
+    if(filter->stage != NULL)
+        filter->stage(pipeline);
+    else
+        pipeline.add_filter(filter->function);
+}
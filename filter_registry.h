@@ -0,0 +1,33 @@
+#ifndef FILTER_REGISTRY_H
+#define FILTER_REGISTRY_H
+
+#include <QImage>
+#include <QString>
+#include <QStringList>
+
+#include "pipeline.h"
+
+typedef void (*StageBuilder)(Pipeline& pipeline);
+
+/******************************************************************************
+ * Struct: FilterInfo
+ * Description: A filter that can be looked up by name, used by the command
+ *  line batch mode and the benchmarks. Filters that take more than the image
+ *  and a thread count are registered with the same defaults the GUI uses.
+ *  Point and row filters also register a StageBuilder that appends them to a
+ *  Pipeline as a fusable step; the others run as whole image steps.
+ *****************************************************************************/
+struct FilterInfo
+{
+    const char* name;
+    FilterFunction function;
+    StageBuilder stage;
+};
+
+const FilterInfo* find_filter(const QString& name);
+
+QStringList filter_names();
+
+void append_filter(Pipeline& pipeline, const FilterInfo* filter);
+
+#endif // FILTER_REGISTRY_H
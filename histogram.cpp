@@ -0,0 +1,418 @@
+#include "histogram.h"
+#include "pixel_access.h"
+#include "filter_progress.h"
+
+#include <cstring>
+
+Histogram::Histogram() :
+    pixels(0)
+{
+    for(int i = 0; i < 256; i++)
+        red[i] = green[i] = blue[i] = 0;
+}
+
+/******************************************************************************
+ * Function: image_histogram
+ * Description: Counts the channel values of an image in parallel. Every
+ *  thread counts its rows into private bins, which the reduction adds up at
+ *  the end, so the threads never write to shared counters.
+ * Parameters:
+ *   image - the image to count
+ *   thread_count - the number of threads to use
+ * Returns: The histogram.
+ *****************************************************************************/
+Histogram image_histogram(const QImage& image, int thread_count)
+{
+    QImage source = to_argb32(image);
+    ConstScanlines in(source);
+
+    int width = source.width();
+    int height = source.height();
+
+    //red, green and blue bins one after another
+    quint64 bins[3 * 256] = {0};
+
+    FilterProgress* progress = FilterProgress::current();
+    progress_add_work(progress, height);
+
+#   pragma omp parallel for num_threads(thread_count) schedule(runtime) default(none) \
+        shared(progress, in, width, height) reduction(+:bins)
+    for(int r = 0; r < height; r++)
+    {
+        if(progress_cancelled(progress))
+            continue;
+
+        const QRgb* src = in[r];
+
+        for(int c = 0; c < width; c++)
+        {
+            bins[qRed(src[c])]++;
+            bins[256 + qGreen(src[c])]++;
+            bins[512 + qBlue(src[c])]++;
+        }
+
+        progress_advance(progress);
+    }
+
+    Histogram histogram;
+    histogram.pixels = (quint64)width * height;
+
+    for(int i = 0; i < 256; i++)
+    {
+        histogram.red[i] = bins[i];
+        histogram.green[i] = bins[256 + i];
+        histogram.blue[i] = bins[512 + i];
+    }
+
+    return histogram;
+}
+
+/******************************************************************************
+ * Function: equalize_lut
+ * Description: The table that spreads the channel values evenly over 0 - 255.
+ *  The three channels are counted together and share one table, so colours
+ *  keep their balance.
+ *****************************************************************************/
+PointLut equalize_lut(const Histogram& histogram)
+{
+    quint64 cdf[256];
+    quint64 total = 0;
+
+    for(int i = 0; i < 256; i++)
+    {
+        total += histogram.red[i] + histogram.green[i] + histogram.blue[i];
+        cdf[i] = total;
+    }
+
+    //the count below the darkest value present maps to 0
+    quint64 first = 0;
+    for(int i = 0; i < 256 && first == 0; i++)
+        first = cdf[i];
+
+    //a single value, nothing to spread
+    if(total == first)
+        return PointLut();
+
+    quint64 range = total - first;
+
+    return PointLut::from_function([&](int value) {
+        return cdf[value] <= first ? 0 : (int)(((cdf[value] - first) * 255 + range / 2) / range);
+    });
+}
+
+/******************************************************************************
+ * Function: stretch_table
+ * Description: Stretches the values between two percentiles of a set of
+ *  counts out to 0 - 255.
+ * Parameters:
+ *   counts - the count of each value
+ *   low, high - the percentiles, 0 - 100
+ *   table - receives the 256 entry table
+ *****************************************************************************/
+static void stretch_table(const quint64* counts, double low, double high, uchar* table)
+{
+    quint64 total = 0;
+    for(int i = 0; i < 256; i++)
+        total += counts[i];
+
+    quint64 lowCount = (quint64)(total * qBound(0.0, low, 100.0) / 100);
+    quint64 highCount = (quint64)(total * qBound(0.0, high, 100.0) / 100);
+
+    int lowValue = -1;
+    int highValue = -1;
+    quint64 cdf = 0;
+
+    for(int i = 0; i < 256; i++)
+    {
+        cdf += counts[i];
+
+        if(lowValue < 0 && cdf > lowCount)
+            lowValue = i;
+        if(highValue < 0 && cdf >= highCount)
+            highValue = i;
+    }
+
+    for(int i = 0; i < 256; i++)
+    {
+        if(lowValue < 0 || highValue <= lowValue)
+            table[i] = i;
+        else
+            table[i] = qBound(0, ((i - lowValue) * 255 + (highValue - lowValue) / 2) / (highValue - lowValue), 255);
+    }
+}
+
+/******************************************************************************
+ * Function: auto_levels_lut
+ * Description: The table that stretches the given percentiles of the channel
+ *  values out to 0 - 255, for all three channels together or each on its
+ *  own.
+ *****************************************************************************/
+PointLut auto_levels_lut(const Histogram& histogram, const AutoLevelsParams& params)
+{
+    uchar red[256], green[256], blue[256];
+
+    if(params.perChannel)
+    {
+        stretch_table(histogram.red, params.low, params.high, red);
+        stretch_table(histogram.green, params.low, params.high, green);
+        stretch_table(histogram.blue, params.low, params.high, blue);
+    }
+    else
+    {
+        quint64 counts[256];
+        for(int i = 0; i < 256; i++)
+            counts[i] = histogram.red[i] + histogram.green[i] + histogram.blue[i];
+
+        stretch_table(counts, params.low, params.high, red);
+        memcpy(green, red, sizeof(red));
+        memcpy(blue, red, sizeof(red));
+    }
+
+    return PointLut::from_tables(red, green, blue);
+}
+
+/******************************************************************************
+ * Function: equalize
+ * Description: Histogram equalization in one read and one write pass.
+ * Parameters:
+ *   image - the image to process on
+ *   thread_count - the number of threads to use
+ * Returns: The equalized image.
+ *****************************************************************************/
+QImage* equalize(const QImage& image, int thread_count)
+{
+    ScheduleScope schedule("equalize");
+
+    QImage source = to_argb32(image);
+    Histogram histogram = image_histogram(source, thread_count);
+
+    return apply_lut(source, equalize_lut(histogram), thread_count);
+}
+
+/******************************************************************************
+ * Function: auto_levels
+ * Description: Percentile auto-levels in one read and one write pass.
+ * Parameters:
+ *   image - the image to process on
+ *   thread_count - the number of threads to use
+ *   params - the percentiles, and whether the channels are stretched apart
+ * Returns: The stretched image.
+ *****************************************************************************/
+QImage* auto_levels(const QImage& image, int thread_count, const AutoLevelsParams& params)
+{
+    ScheduleScope schedule("auto_levels");
+
+    QImage source = to_argb32(image);
+    Histogram histogram = image_histogram(source, thread_count);
+
+    return apply_lut(source, auto_levels_lut(histogram, params), thread_count);
+}
+
+QImage* auto_levels(const QImage& image, int thread_count)
+{
+    return auto_levels(image, thread_count, AutoLevelsParams());
+}
+
+/******************************************************************************
+ * Function: clahe_table
+ * Description: The equalization table of one CLAHE tile. Counts above the
+ *  clip limit are cut off and spread evenly over all the values first.
+ * Parameters:
+ *   counts - the tile's value counts, clipped in place
+ *   pixels - the number of pixels in the tile
+ *   clipLimit - the largest count as a multiple of pixels / 256, or 0 for
+ *    no limit
+ *   table - receives the 256 entry table
+ *****************************************************************************/
+static void clahe_table(quint64* counts, quint64 pixels, double clipLimit, uchar* table)
+{
+    if(pixels == 0)
+    {
+        for(int i = 0; i < 256; i++)
+            table[i] = i;
+        return;
+    }
+
+    if(clipLimit > 0)
+    {
+        quint64 limit = qMax<quint64>(1, (quint64)(clipLimit * pixels / 256));
+        quint64 excess = 0;
+
+        for(int i = 0; i < 256; i++)
+        {
+            if(counts[i] > limit)
+            {
+                excess += counts[i] - limit;
+                counts[i] = limit;
+            }
+        }
+
+        quint64 share = excess / 256;
+        quint64 rest = excess % 256;
+
+        for(int i = 0; i < 256; i++)
+            counts[i] += share;
+
+        //the remainder one each to values spaced over the whole range
+        for(quint64 i = 0; i < rest; i++)
+            counts[i * 256 / rest]++;
+    }
+
+    quint64 cdf = 0;
+
+    for(int i = 0; i < 256; i++)
+    {
+        cdf += counts[i];
+        table[i] = (uchar)qMin<quint64>(255, (cdf * 255 + pixels / 2) / pixels);
+    }
+}
+
+/******************************************************************************
+ * Function: tile_position
+ * Description: Where a pixel falls between the centres of the tiles along
+ *  one axis, for the bilinear blend of their tables.
+ * Parameters:
+ *   pixel - the pixel's column or row
+ *   length - the image width or height
+ *   tiles - the number of tiles along the axis
+ *   first - receives the tile before the pixel
+ *   weight - receives the weight of the tile after it, 0 - 1
+ *****************************************************************************/
+static void tile_position(int pixel, int length, int tiles, int& first, float& weight)
+{
+    float position = (pixel + 0.5f) * tiles / length - 0.5f;
+
+    if(position <= 0)
+    {
+        first = 0;
+        weight = 0;
+    }
+    else if(position >= tiles - 1)
+    {
+        first = tiles - 1;
+        weight = 0;
+    }
+    else
+    {
+        first = (int)position;
+        weight = position - first;
+    }
+}
+
+/******************************************************************************
+ * Function: clahe
+ * Description: Contrast limited adaptive histogram equalization of the HSV
+ *  value. The read pass counts each tile and builds its clipped table; the
+ *  write pass maps every pixel through the tables of the four nearest tile
+ *  centres, blended bilinearly so no tile edges show, and keeps the pixel's
+ *  hue and saturation.
+ * Parameters:
+ *   image - the image to process on
+ *   thread_count - the number of threads to use
+ *   params - the tile grid and clip limit
+ * Returns: The equalized image.
+ *****************************************************************************/
+QImage* clahe(const QImage& image, int thread_count, const ClaheParams& params)
+{
+    ScheduleScope schedule("clahe");
+
+    QImage source = to_argb32(image);
+    QImage* newImage = new_output_image(source.size(), thread_count);
+
+    int width = source.width();
+    int height = source.height();
+    int tilesX = qBound(1, params.tiles, qMax(1, width));
+    int tilesY = qBound(1, params.tiles, qMax(1, height));
+    int tiles = tilesX * tilesY;
+    double clipLimit = params.clipLimit;
+
+    uchar* tables = new uchar[tiles * 256];
+
+    ConstScanlines in(source);
+    Scanlines out(*newImage);
+
+    FilterProgress* progress = FilterProgress::current();
+    progress_add_work(progress, tiles + height);
+
+    //Read pass - every tile is counted by one thread
+#   pragma omp parallel for num_threads(thread_count) schedule(runtime) default(none) \
+        shared(progress, in, tables, width, height, tilesX, tilesY, tiles, clipLimit)
+    for(int t = 0; t < tiles; t++)
+    {
+        if(progress_cancelled(progress))
+            continue;
+
+        int left = (t % tilesX) * width / tilesX;
+        int right = (t % tilesX + 1) * width / tilesX;
+        int top = (t / tilesX) * height / tilesY;
+        int bottom = (t / tilesX + 1) * height / tilesY;
+
+        quint64 counts[256] = {0};
+
+        for(int r = top; r < bottom; r++)
+        {
+            const QRgb* src = in[r];
+
+            for(int c = left; c < right; c++)
+                counts[pixel_value(src[c])]++;
+        }
+
+        clahe_table(counts, (quint64)(right - left) * (bottom - top), clipLimit, tables + t * 256);
+
+        progress_advance(progress);
+    }
+
+    //the tile columns each image column blends, the same for every row
+    int* columnTile = new int[qMax(1, width)];
+    float* columnWeight = new float[qMax(1, width)];
+
+    for(int c = 0; c < width; c++)
+        tile_position(c, width, tilesX, columnTile[c], columnWeight[c]);
+
+    //Write pass - every row is independent
+    PlacementScope placement(*newImage, thread_count);
+
+#   pragma omp parallel for num_threads(thread_count) schedule(runtime) default(none) \
+        shared(progress, in, out, tables, width, height, tilesX, tilesY, columnTile, columnWeight)
+    for(int r = 0; r < height; r++)
+    {
+        if(progress_cancelled(progress))
+            continue;
+
+        int tileRow;
+        float rowWeight;
+        tile_position(r, height, tilesY, tileRow, rowWeight);
+
+        const uchar* above = tables + tileRow * tilesX * 256;
+        const uchar* below = rowWeight > 0 ? above + tilesX * 256 : above;
+
+        const QRgb* src = in[r];
+        QRgb* dst = out[r];
+
+        for(int c = 0; c < width; c++)
+        {
+            int value = pixel_value(src[c]);
+            int left = columnTile[c] * 256 + value;
+            int right = columnWeight[c] > 0 ? left + 256 : left;
+            float weight = columnWeight[c];
+
+            float top = above[left] + weight * (above[right] - above[left]);
+            float bottom = below[left] + weight * (below[right] - below[left]);
+
+            dst[c] = with_value(src[c], (int)(top + rowWeight * (bottom - top) + 0.5f));
+        }
+
+        progress_advance(progress);
+    }
+
+    delete[] tables;
+    delete[] columnTile;
+    delete[] columnWeight;
+
+    return newImage;
+}
+
+QImage* clahe(const QImage& image, int thread_count)
+{
+    return clahe(image, thread_count, ClaheParams());
+}
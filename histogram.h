@@ -0,0 +1,82 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <QImage>
+
+#include "point_ops.h"
+
+/******************************************************************************
+ * Histogram driven contrast filters. equalize() and auto_levels() count the
+ * image in one parallel read pass, each thread into its own bins merged by
+ * an OpenMP reduction, turn the counts into a PointLut and apply it in one
+ * write pass. clahe() counts each tile on its own in the read pass and
+ * blends the tiles' tables in the write pass.
+ *****************************************************************************/
+
+/******************************************************************************
+ * Struct: Histogram
+ * Description: Pixel counts per channel value.
+ *****************************************************************************/
+struct Histogram
+{
+    Histogram();
+
+    quint64 red[256];
+    quint64 green[256];
+    quint64 blue[256];
+    quint64 pixels;
+};
+
+/******************************************************************************
+ * Struct: AutoLevelsParams
+ * Description: auto_levels() stretches the channel values between the low
+ *  and high percentiles out to 0 - 255, clipping the rest. perChannel
+ *  stretches each channel on its own, which also removes a colour cast;
+ *  otherwise all three share one stretch and the colours keep their balance.
+ *****************************************************************************/
+struct AutoLevelsParams
+{
+    explicit AutoLevelsParams(double low = 0.5, double high = 99.5, bool perChannel = false) :
+        low(low),
+        high(high),
+        perChannel(perChannel)
+    {
+    }
+
+    double low;
+    double high;
+    bool perChannel;
+};
+
+/******************************************************************************
+ * Struct: ClaheParams
+ * Description: clahe() equalizes tiles x tiles regions of the image on their
+ *  own. No value may take more than clipLimit times its share of a tile's
+ *  pixels, which limits how much flat regions are stretched.
+ *****************************************************************************/
+struct ClaheParams
+{
+    explicit ClaheParams(int tiles = 8, double clipLimit = 2.0) :
+        tiles(tiles),
+        clipLimit(clipLimit)
+    {
+    }
+
+    int tiles;
+    double clipLimit;
+};
+
+Histogram image_histogram(const QImage& image, int thread_count);
+
+PointLut equalize_lut(const Histogram& histogram);
+PointLut auto_levels_lut(const Histogram& histogram, const AutoLevelsParams& params);
+
+QImage* equalize(const QImage& image, int thread_count);
+
+QImage* auto_levels(const QImage& image, int thread_count);
+QImage* auto_levels(const QImage& image, int thread_count, const AutoLevelsParams& params);
+
+QImage* clahe(const QImage& image, int thread_count);
+QImage* clahe(const QImage& image, int thread_count, const ClaheParams& params);
+
+#endif // HISTOGRAM_H
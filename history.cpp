@@ -0,0 +1,320 @@
+#include "history.h"
+#include "pixel_access.h"
+
+#include <cstring>
+
+EditHistory::EditHistory(qint64 budget) :
+    memoryBudget(budget)
+{
+}
+
+EditHistory::~EditHistory()
+{
+    clear();
+}
+
+/******************************************************************************
+ * Function: EditHistory::push
+ * Description: Records an edit. Clears the redo history.
+ * Parameters:
+ *   previous - the image before the edit; the history takes ownership
+ *   replay - the edit as a point operation, or NULL if it is not one
+ *****************************************************************************/
+void EditHistory::push(QImage* previous, const PointLut* replay)
+{
+    while(!redoEntries.isEmpty())
+    {
+        release(redoEntries.last());
+        redoEntries.removeLast();
+    }
+
+    Entry entry;
+    entry.kind = Entry::FULL;
+    entry.image = previous;
+    entry.nextIsPointOp = (replay != NULL);
+    if(replay != NULL)
+        entry.lut = *replay;
+
+    undoEntries << entry;
+}
+
+/******************************************************************************
+ * Function: EditHistory::undo
+ * Description: Steps back one edit. A point operation is remembered for redo
+ *  as its table rather than as the image it produced.
+ * Parameters:
+ *   current - the current image; the history takes ownership
+ *   thread_count - the number of threads to use
+ * Returns: The previous image, owned by the caller.
+ *****************************************************************************/
+QImage* EditHistory::undo(QImage* current, int thread_count)
+{
+    Entry entry = undoEntries.takeLast();
+    QImage* previous = entry.image;
+
+    if(entry.kind == Entry::DELTA)
+        previous = restore(entry, *current, thread_count);
+
+    Entry redoEntry;
+    redoEntry.image = NULL;
+    redoEntry.nextIsPointOp = false;
+
+    if(entry.nextIsPointOp)
+    {
+        redoEntry.kind = Entry::REPLAY;
+        redoEntry.lut = entry.lut;
+        delete current;
+    }
+    else
+    {
+        redoEntry.kind = Entry::FULL;
+        redoEntry.image = current;
+    }
+
+    redoEntries << redoEntry;
+
+    return previous;
+}
+
+/******************************************************************************
+ * Function: EditHistory::redo
+ * Description: Steps forward one edit, reapplying it if it was a point
+ *  operation.
+ * Parameters:
+ *   current - the current image; the history takes ownership
+ *   thread_count - the number of threads to use
+ * Returns: The next image, owned by the caller.
+ *****************************************************************************/
+QImage* EditHistory::redo(QImage* current, int thread_count)
+{
+    Entry entry = redoEntries.takeLast();
+    QImage* next = entry.image;
+
+    if(entry.kind == Entry::REPLAY)
+        next = apply_lut(*current, entry.lut, thread_count);
+    else if(entry.kind == Entry::DELTA)
+        next = restore(entry, *current, thread_count);
+
+    Entry undoEntry;
+    undoEntry.kind = Entry::FULL;
+    undoEntry.image = current;
+    undoEntry.nextIsPointOp = (entry.kind == Entry::REPLAY);
+    undoEntry.lut = entry.lut;
+
+    undoEntries << undoEntry;
+
+    return next;
+}
+
+/******************************************************************************
+ * Function: EditHistory::trim
+ * Description: Brings the history within the memory budget: compresses the
+ *  full entries furthest from the current image first, then the ones next to
+ *  it, then drops the oldest undo steps and finally the furthest redo steps.
+ * Parameters:
+ *   current - the current image
+ *   thread_count - the number of threads to compress with
+ *****************************************************************************/
+void EditHistory::trim(const QImage* current, int thread_count)
+{
+    while(memory_used() > memoryBudget)
+    {
+        if(compress_furthest(undoEntries, current, true, thread_count) ||
+           compress_furthest(redoEntries, current, true, thread_count) ||
+           compress_furthest(undoEntries, current, false, thread_count) ||
+           compress_furthest(redoEntries, current, false, thread_count))
+            continue;
+
+        if(!undoEntries.isEmpty())
+        {
+            release(undoEntries.first());
+            undoEntries.removeFirst();
+        }
+        else if(!redoEntries.isEmpty())
+        {
+            release(redoEntries.first());
+            redoEntries.removeFirst();
+        }
+        else
+            break;
+    }
+}
+
+void EditHistory::clear()
+{
+    for(int i = 0; i < undoEntries.size(); i++)
+        release(undoEntries[i]);
+    for(int i = 0; i < redoEntries.size(); i++)
+        release(redoEntries[i]);
+
+    undoEntries.clear();
+    redoEntries.clear();
+}
+
+qint64 EditHistory::memory_used() const
+{
+    qint64 bytes = 0;
+
+    for(int i = 0; i < undoEntries.size(); i++)
+        bytes += entry_bytes(undoEntries[i]);
+    for(int i = 0; i < redoEntries.size(); i++)
+        bytes += entry_bytes(redoEntries[i]);
+
+    return bytes;
+}
+
+qint64 EditHistory::entry_bytes(const Entry& entry)
+{
+    qint64 bytes = sizeof(Entry);
+
+    if(entry.kind == Entry::FULL)
+        bytes += (qint64)entry.image->bytesPerLine() * entry.image->height();
+    else if(entry.kind == Entry::DELTA)
+        for(int i = 0; i < entry.tiles.size(); i++)
+            bytes += sizeof(Tile) + entry.tiles[i].data.size();
+
+    return bytes;
+}
+
+/******************************************************************************
+ * Function: EditHistory::compress_furthest
+ * Description: Turns the full entry furthest from the current image into a
+ *  delta. Only entries whose nearer neighbour is a full image (or the current
+ *  image) can be compressed, since the delta is taken against it.
+ * Parameters:
+ *   entries - the undo or redo entries
+ *   current - the current image
+ *   keepNearest - leave the entry next to the current image full
+ *   thread_count - the number of threads to compress with
+ * Returns: true if an entry was compressed.
+ *****************************************************************************/
+bool EditHistory::compress_furthest(QList<Entry>& entries, const QImage* current,
+                                    bool keepNearest, int thread_count)
+{
+    int count = keepNearest ? entries.size() - 1 : entries.size();
+
+    for(int i = 0; i < count; i++)
+    {
+        if(entries[i].kind != Entry::FULL)
+            continue;
+
+        const QImage* neighbour = current;
+        if(i + 1 < entries.size())
+        {
+            if(entries[i + 1].kind != Entry::FULL)
+                continue;
+            neighbour = entries[i + 1].image;
+        }
+
+        compress(entries[i], *neighbour, thread_count);
+        return true;
+    }
+
+    return false;
+}
+
+/******************************************************************************
+ * Function: EditHistory::compress
+ * Description: Replaces a full entry by the tiles where it differs from its
+ *  neighbour, each compressed on its own so the tiles are compressed and
+ *  restored in parallel. If the sizes differ every tile is kept.
+ *****************************************************************************/
+void EditHistory::compress(Entry& entry, const QImage& neighbour, int thread_count)
+{
+    QImage image = to_argb32(*entry.image);
+    QImage other = to_argb32(neighbour);
+    bool sameSize = (image.size() == other.size());
+
+    int width = image.width();
+    int height = image.height();
+    int across = (width + HISTORY_TILE_SIZE - 1) / HISTORY_TILE_SIZE;
+    int down = (height + HISTORY_TILE_SIZE - 1) / HISTORY_TILE_SIZE;
+    int count = across * down;
+
+    QVector<Tile> tiles(count);
+    Tile* tile = tiles.data();
+
+    ConstScanlines in(image);
+    ConstScanlines previous(other);
+
+#   pragma omp parallel for num_threads(thread_count) schedule(dynamic) default(none) \
+        shared(tile, in, previous, sameSize, width, height, across, count)
+    for(int t = 0; t < count; t++)
+    {
+        int x = (t % across) * HISTORY_TILE_SIZE;
+        int y = (t / across) * HISTORY_TILE_SIZE;
+        int w = qMin(HISTORY_TILE_SIZE, width - x);
+        int h = qMin(HISTORY_TILE_SIZE, height - y);
+
+        tile[t].x = x;
+        tile[t].y = y;
+        tile[t].width = w;
+        tile[t].height = h;
+
+        bool changed = !sameSize;
+        for(int r = y; r < y + h && !changed; r++)
+            changed = memcmp(in[r] + x, previous[r] + x, w * sizeof(QRgb)) != 0;
+
+        if(!changed)
+            continue;
+
+        QByteArray raw(w * h * (int)sizeof(QRgb), Qt::Uninitialized);
+        for(int r = 0; r < h; r++)
+            memcpy(raw.data() + r * w * sizeof(QRgb), in[y + r] + x, w * sizeof(QRgb));
+
+        tile[t].data = qCompress(raw, 1);
+    }
+
+    entry.tiles.clear();
+    for(int t = 0; t < count; t++)
+        if(!tiles[t].data.isEmpty())
+            entry.tiles << tiles[t];
+
+    entry.size = image.size();
+    entry.kind = Entry::DELTA;
+    delete entry.image;
+    entry.image = NULL;
+}
+
+/******************************************************************************
+ * Function: EditHistory::restore
+ * Description: Rebuilds the image of a delta entry from its neighbour.
+ *  Restored images are Format_ARGB32.
+ * Returns: The image, owned by the caller.
+ *****************************************************************************/
+QImage* EditHistory::restore(const Entry& entry, const QImage& neighbour, int thread_count)
+{
+    QImage* image;
+
+    if(entry.size == neighbour.size())
+        image = new QImage(to_argb32(neighbour).copy());
+    else
+        image = new_output_image(entry.size, thread_count);
+
+    const Tile* tile = entry.tiles.constData();
+    int count = entry.tiles.size();
+
+    Scanlines out(*image);
+
+#   pragma omp parallel for num_threads(thread_count) schedule(dynamic) default(none) \
+        shared(tile, out, count)
+    for(int t = 0; t < count; t++)
+    {
+        QByteArray raw = qUncompress(tile[t].data);
+        int w = tile[t].width;
+
+        for(int r = 0; r < tile[t].height; r++)
+            memcpy(out[tile[t].y + r] + tile[t].x, raw.constData() + r * w * sizeof(QRgb), w * sizeof(QRgb));
+    }
+
+    return image;
+}
+
+void EditHistory::release(Entry& entry)
+{
+    if(entry.kind == Entry::FULL)
+        delete entry.image;
+
+    entry.image = NULL;
+    entry.tiles.clear();
+}
@@ -0,0 +1,91 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QList>
+#include <QVector>
+
+#include "point_ops.h"
+
+// Side of the square tiles edits are compared and compressed in
+#define HISTORY_TILE_SIZE 128
+
+/******************************************************************************
+ * Class: EditHistory
+ * Description: The undo and redo history, kept within a memory budget
+ *  instead of a fixed number of images.
+ *
+ * Each entry holds one image state, in one of three forms:
+ *
+ *   full    - the image itself
+ *   delta   - only the tiles that differ from the neighbouring state nearer
+ *             the current image, compressed
+ *   replay  - for redoing a point operation, its lookup table; the state is
+ *             recomputed from the neighbouring state
+ *
+ * New entries go in full, so undoing or redoing the last step is a pointer
+ * swap. trim() brings the history back within budget: it first compresses
+ * the full entries furthest from the current image into deltas, keeping the
+ * one next to the current image on each side full as long as it can, and
+ * only then drops the oldest steps. A delta is always relative to its
+ * neighbour nearer the current image, and stepping through the history
+ * always passes through that neighbour first, so a delta is only ever
+ * applied to the exact image it was computed against.
+ *****************************************************************************/
+class EditHistory
+{
+public:
+    explicit EditHistory(qint64 budget);
+    ~EditHistory();
+
+    void push(QImage* previous, const PointLut* replay);
+    QImage* undo(QImage* current, int thread_count);
+    QImage* redo(QImage* current, int thread_count);
+    void trim(const QImage* current, int thread_count);
+    void clear();
+
+    bool can_undo() const { return !undoEntries.isEmpty(); }
+    bool can_redo() const { return !redoEntries.isEmpty(); }
+
+    qint64 budget() const { return memoryBudget; }
+    void set_budget(qint64 budget) { memoryBudget = budget; }
+    qint64 memory_used() const;
+
+private:
+    struct Tile
+    {
+        int x, y, width, height;
+        QByteArray data;
+    };
+
+    struct Entry
+    {
+        enum Kind { FULL, DELTA, REPLAY };
+
+        Kind kind;
+        QImage* image;          // FULL
+        QSize size;             // DELTA
+        QVector<Tile> tiles;    // DELTA
+        PointLut lut;           // REPLAY, or the step forward when nextIsPointOp
+        bool nextIsPointOp;     // undo entries: the step from this state to the
+                                // next one is the point operation lut
+    };
+
+    static qint64 entry_bytes(const Entry& entry);
+    static QImage* restore(const Entry& entry, const QImage& neighbour, int thread_count);
+    static void compress(Entry& entry, const QImage& neighbour, int thread_count);
+    static void release(Entry& entry);
+
+    bool compress_furthest(QList<Entry>& entries, const QImage* current, bool keepNearest, int thread_count);
+
+    QList<Entry> undoEntries;   // back() is the state before the current one
+    QList<Entry> redoEntries;   // back() is the state after the current one
+
+    qint64 memoryBudget;
+
+    EditHistory(const EditHistory&);
+    EditHistory& operator=(const EditHistory&);
+};
+
+#endif // HISTORY_H
@@ -1,83 +1,56 @@
 #include "ian_algorithms.h"
 #include "matt_algorithms.h"
+#include "fft_engine.h"
+#include "pixel_access.h"
+#include "buffer_pool.h"
+#include "point_ops.h"
+#include "filter_progress.h"
+#include "convolution.h"
 #include <QColor>
 #include <cmath>
 
+/******************************************************************************
+ * Function: sharpen_kernel
+ * Description: The sharpen mask, applied to each RGB channel
+ * Parameters:
+ *   amount - the weight of each neighbour, 1 for the usual mask
+ *****************************************************************************/
+RgbKernel<1> sharpen_kernel(float amount)
+{
+    //Mask
+    //0  -1  0
+    //-1  5 -1
+    //0  -1  0
+    float a = amount;
+    RgbKernel<1> kernel = {{{0, -a, 0}, {-a, 1 + 4*a, -a}, {0, -a, 0}}};
+
+    return kernel;
+}
+
 /******************************************************************************
  * Function: sharpen
  * Description: Convolves an image with a sharpen mask to sharpen the image
  * Parameters:
  *   image - the image to process on
  *   thread_count - the number of threads to use
+ *   params - the strength and edge mode
  * Returns: The sharpened image.
  *****************************************************************************/
-QImage* sharpen(const QImage& image, int thread_count)
+QImage* sharpen(const QImage& image, int thread_count, const SharpenParams& params)
 {
-    QImage* newImage = new QImage(image.size(), image.format());
-    QSize size = newImage->size();
-
-    float mask[3][3];
-    int row,col;
+    ScheduleScope schedule("sharpen");
 
-    //Mask
-    //0  -1  0
-    //-1  1 -1
-    //0  -1  0
-    //generate the mask
-    for(row = 0; row < 3; row++)
-        for(int col = 0; col < 3; col++)
-            mask[row][col] = -1;
-    mask[1][1] = 5;
-    for(row = 0; row < 3; row+=2)
-        for(col = 0; col < 3; col+=2)
-            mask[row][col] = 0;
-
-    //Apply the mask to each pixel, excluding the boundary
-#   pragma omp parallel for num_threads(thread_count) default(none) \
-        shared(size, image, newImage, mask) private(row,col)
-    for(row = 1; row < size.height()-1; row++)
-    {
-        for(col = 1; col < size.width()-1; col++)
-        {
-            float r=0,g=0,b=0,a;
-
-            // Convolve
-            for(int i = -1; i <= 1; i++)
-            {
-                for(int j = -1; j <= 1; j++)
-                {
-                    QColor color = QColor(image.pixel( col + j, row + i));
-
-                    //grab the original transparency value
-                    if(i == 0 && j == 0) a = color.alpha();
-
-                    //update the colors
-                    r+=color.red()*mask[i+1][j+1];
-                    b+=color.blue()*mask[i+1][j+1];
-                    g+=color.green()*mask[i+1][j+1];
-                }
-            }
+    //an identity mask, only copy
+    if(params.amount == 0)
+        return apply_lut(image, PointLut(), thread_count);
 
-            //range checking
-            if(r > 255)r = 255;
-            if(r < 0)r = 0;
-            if(g < 0) g = 0;
-            if(g > 255) g = 255;
-            if(b < 0) b = 0;
-            if(b > 255) b = 255;
-
-            //put the new pixel back in the image
-            QColor color = QColor(image.pixel(col, row));
-            color.setRed((int)r);
-            color.setGreen((int)g);
-            color.setBlue((int)b);
-            color.setAlpha((int)a);
-
-            newImage->setPixel(col, row, color.rgb());
-        }
-    }
+    return convolve<1>(image, sharpen_kernel(params.amount), params.edge, thread_count);
+}
 
-    return newImage;
+QImage* sharpen(const QImage& image, int thread_count)
+{
+    //the border pixels sample the nearest edge pixel
+    return sharpen(image, thread_count, SharpenParams());
 }
 
 /******************************************************************************
@@ -86,44 +59,19 @@ QImage* sharpen(const QImage& image, int thread_count)
  * Parameters:
  *   image - the image to process on
  *   thread_count - the number of threads to use
+ *   params - the range stretched to 0 - 255
  * Returns: The new image
  *****************************************************************************/
-QImage* enhance_contrast(const QImage& image, int thread_count)
+QImage* enhance_contrast(const QImage& image, int thread_count, const ContrastParams& params)
 {
-    QImage* newImage = new QImage(image.size(), image.format());
-    QSize size = newImage->size();
-
-    int row,col;
-
-#   pragma omp parallel for num_threads(thread_count) default(none) \
-        shared(size, image, newImage) private(row,col)
-    for(row = 0; row < size.height(); row++)
-    {
-        for(col = 0; col < size.width(); col++)
-        {
-            //scale the current rgb values
-            QColor color = QColor(image.pixel(col, row));
-            float r = (color.red()-64.0)*(255.0/(128.0));
-            float g = (color.green()-64.0)*(255.0/(128.0));
-            float b = (color.blue()-64.0)*(255.0/(128.0));
+    ScheduleScope schedule("enhance_contrast");
 
-            //range checking
-            if(r > 255)r=255;
-            if(r < 0) r = 0;
-            if(g > 255)g=255;
-            if(g < 0) g = 0;
-            if(b > 255)b=255;
-            if(b < 0) b = 0;
-
-            //set the new color values
-            color.setRed((int)r);
-            color.setGreen((int)g);
-            color.setBlue((int)b);
-            newImage->setPixel(col, row, color.rgb());
-        }
-    }
+    return apply_lut(image, enhance_contrast_lut(params.low, params.high), thread_count);
+}
 
-    return newImage;
+QImage* enhance_contrast(const QImage& image, int thread_count)
+{
+    return enhance_contrast(image, thread_count, ContrastParams());
 }
 
 /******************************************************************************
@@ -132,44 +80,19 @@ QImage* enhance_contrast(const QImage& image, int thread_count)
  * Parameters:
  *   image - the image to process on
  *   thread_count - the number of threads to use
+ *   params - the range 0 - 255 is squeezed into
  * Returns: The new image
  *****************************************************************************/
-QImage* reduce_contrast(const QImage& image, int thread_count)
+QImage* reduce_contrast(const QImage& image, int thread_count, const ContrastParams& params)
 {
-    QImage* newImage = new QImage(image.size(), image.format());
-    QSize size = newImage->size();
-
-    int row,col;
-
-#   pragma omp parallel for num_threads(thread_count) default(none) \
-        shared(size, image, newImage) private(row,col)
-    for(row = 0; row < size.height(); row++)
-    {
-        for(col = 0; col < size.width(); col++)
-        {
-            //scale the rgb values
-            QColor color = QColor(image.pixel(col, row));
-            float r = (color.red())*(128/(255.0)) + 64;
-            float g = (color.green())*(128/(255.0)) + 64;
-            float b = (color.blue())*(128/(255.0)) + 64;
+    ScheduleScope schedule("reduce_contrast");
 
-            //range checking
-            if(r > 255)r=255;
-            if(r < 0) r = 0;
-            if(g > 255)g=255;
-            if(g < 0) g = 0;
-            if(b > 255)b=255;
-            if(b < 0) b = 0;
-
-            //put the new rgb values back in the image
-            color.setRed((int)r);
-            color.setGreen((int)g);
-            color.setBlue((int)b);
-            newImage->setPixel(col, row, color.rgb());
-        }
-    }
+    return apply_lut(image, reduce_contrast_lut(params.low, params.high), thread_count);
+}
 
-    return newImage;
+QImage* reduce_contrast(const QImage& image, int thread_count)
+{
+    return reduce_contrast(image, thread_count, ContrastParams());
 }
 
 
@@ -179,13 +102,24 @@ QImage* reduce_contrast(const QImage& image, int thread_count)
  * Parameters:
  *   image - the image to process on
  *   thread_count - the number of threads to use
+ *   params - the gray level of flat areas
  * Returns: The embossed image
  *****************************************************************************/
-QImage* emboss(const QImage& image, int thread_count)
+QImage* emboss(const QImage& image, int thread_count, const EmbossParams& params)
 {
-    QImage* newImage = new QImage(image.size(), image.format());
+    ScheduleScope schedule("emboss");
+
+    QImage source = to_argb32(image);
+    QImage* newImage = new_output_image(source.size(), thread_count);
     QSize size = newImage->size();
 
+    ConstScanlines in(source);
+    Scanlines out(*newImage);
+
+    FilterProgress* progress = FilterProgress::current();
+    progress_add_work(progress, size.height()-1);
+
+    int offset = params.offset;
     int row,col;
 
     //Mask
@@ -193,31 +127,45 @@ QImage* emboss(const QImage& image, int thread_count)
     //0  -1
     //actually more efficient to just hardcode this one
 
-#   pragma omp parallel for num_threads(thread_count) default(none) \
-        shared(size, image, newImage) private(row,col)
-    for(row = 0; row < size.height()-1; row++)
+    PlacementScope placement(*newImage, thread_count);
+
+    //the loop covers the last row too, which has no row below to compare
+    //with, so a static schedule splits it as first_touch() did
+#   pragma omp parallel for num_threads(thread_count) schedule(runtime) default(none) \
+        shared(progress, size, in, out, offset) private(row,col)
+    for(row = 0; row < size.height(); row++)
     {
+        if(row == size.height()-1 || progress_cancelled(progress))
+            continue;
+
+        const QRgb* src1 = in[row];
+        const QRgb* src2 = in[row+1];
+        QRgb* dst = out[row];
+
         for(col = 0; col < size.width()-1; col++)
         {
-            QColor color1 = QColor(image.pixel(col, row));
-            QColor color2 = QColor(image.pixel(col+1, row+1));
-
             //apply the "mask"
-            float val = qGray(color1.red(),color1.green(),color1.blue()) - qGray(color2.red(),color2.green(),color2.blue()) + 128;
+            float val = qGray(src1[col]) - qGray(src2[col+1]) + offset;
 
             //range checking
             if( val > 255) val=255;
             if(val < 0) val = 0;
 
             //put the new rgb values back in the image
-            color1.setRgb((int)val,(int)val,(int)val);
-            newImage->setPixel(col, row, color1.rgb());
+            dst[col] = qRgb((int)val,(int)val,(int)val);
         }
+
+        progress_advance(progress);
     }
 
     return newImage;
 }
 
+QImage* emboss(const QImage& image, int thread_count)
+{
+    return emboss(image, thread_count, EmbossParams());
+}
+
 /******************************************************************************
  * Function: posterize
  * Description: Reduce the number of allowed colors for
@@ -225,39 +173,19 @@ QImage* emboss(const QImage& image, int thread_count)
  * Parameters:
  *   image - the image to process on
  *   thread_count - the number of threads to use
+ *   params - the levels per channel
  * Returns: The new image
  *****************************************************************************/
-QImage* posterize(const QImage& image, int thread_count)
+QImage* posterize(const QImage& image, int thread_count, const PosterizeParams& params)
 {
-    QImage* newImage = new QImage(image.size(), image.format());
-    QSize size = newImage->size();
-
-    //some up front math
-    const int levels = 4;
-    int interval = 256/levels;
-    int quanta = 255/(levels-1);
-    int row,col;
+    ScheduleScope schedule("posterize");
 
-#   pragma omp parallel for num_threads(thread_count) default(none) \
-        shared(size, image, newImage,interval,quanta) private(row,col)
-    for(row = 0; row < size.height(); row++)
-    {
-        for(col = 0; col < size.width(); col++)
-        {
-            //compress each color channel
-            QColor color = QColor(image.pixel(col, row));
-            int r = (color.red()/interval)*quanta;
-            int g = (color.green()/interval)*quanta;
-            int b = (color.blue()/interval)*quanta;
-
-            color.setRed(r);
-            color.setGreen(g);
-            color.setBlue(b);
-            newImage->setPixel(col, row, color.rgb());
-        }
-    }
+    return apply_lut(image, posterize_lut(params.levels), thread_count);
+}
 
-    return newImage;
+QImage* posterize(const QImage& image, int thread_count)
+{
+    return posterize(image, thread_count, PosterizeParams());
 }
 
 /******************************************************************************
@@ -266,48 +194,192 @@ QImage* posterize(const QImage& image, int thread_count)
  * Parameters:
  *   image - the image to process on
  *   thread_count - the number of threads to use
+ *   params - the power
  * Returns: The new image
  *****************************************************************************/
+QImage* gamma(const QImage& image, int thread_count, const GammaParams& params)
+{
+    ScheduleScope schedule("gamma");
+
+    return apply_lut(image, gamma_lut(params.gamma), thread_count);
+}
+
 QImage* gamma(const QImage& image, int thread_count)
 {
-    QImage* newImage = new QImage(image.size(), image.format());
+    return gamma(image, thread_count, GammaParams());
+}
+
+/******************************************************************************
+ * Function: fft
+ * Description: perform a 2D fft on the image by doing 1D fft's in the rows
+ *  and then in the columns. Each line is transformed with a precomputed
+ *  FFTPlan, so any image size runs in O(N log N) per line. The output matches
+ *  dft(): the column pass there transforms the real and imaginary parts of
+ *  the row spectra separately, keeping the real part of the first and the
+ *  imaginary part of the second. Both come out of a single complex column
+ *  transform Z, as (Re Z[r] + Re Z[-r])/2 and (Re Z[-r] - Re Z[r])/2.
+ * Parameters:
+ *   image - the image to process on
+ *   thread_count - the number of threads to use
+ * Returns: The new image
+ *****************************************************************************/
+QImage* fft(const QImage& image, int thread_count)
+{
+    ScheduleScope schedule("fft");
+
+    //start off by grayscaling the image
+    QImage source = to_argb32(image);
+    QImage* newImage = grayscale(source,thread_count);
     QSize size = newImage->size();
+    int width = size.width();
+    int height = size.height();
 
-    const double gamma = 0.5;
-    int row,col;
+    ConstScanlines in(source);
+    Scanlines out(*newImage);
 
-#   pragma omp parallel for num_threads(thread_count) default(none) \
-        shared(size, image, newImage) private(row,col)
-    for(row = 0; row < size.height(); row++)
+    FilterProgress* progress = FilterProgress::current();
+    progress_add_work(progress, 3*height + width);
+
+    //the row spectra, transformed in place by the column pass
+    fft_complex * spectrum = pool_array<fft_complex>((qint64)width*height);
+
+    //save all the magnitudes to assist with scaling at the end
+    double * magnitude = pool_array<double>((qint64)width*height);
+
+    FFTPlan rowPlan(width);
+    FFTPlan columnPlan(height);
+
+    //First do a 1D fft on each row - each thread gets its own scratch space
+#   pragma omp parallel num_threads(thread_count) default(none) \
+        shared(progress,spectrum,in,rowPlan,width,height)
+    {
+        fft_complex * scratch = new fft_complex[rowPlan.scratch_size()];
+
+#       pragma omp for schedule(runtime)
+        for(int r = 0; r < height; r++)
+        {
+            if(progress_cancelled(progress))
+                continue;
+
+            fft_complex * row = spectrum + r*width;
+            const QRgb * src = in[r];
+
+            for(int c = 0; c < width; c++)
+                row[c] = pixel_value(src[c]);
+
+            rowPlan.forward(row, scratch);
+
+            progress_advance(progress);
+        }
+
+        delete[] scratch;
+    }
+
+    //now go through each column and do an fft on the column
+#   pragma omp parallel num_threads(thread_count) default(none) \
+        shared(progress,spectrum,magnitude,columnPlan,width,height)
+    {
+        fft_complex * column = new fft_complex[height];
+        fft_complex * scratch = new fft_complex[columnPlan.scratch_size()];
+
+#       pragma omp for schedule(runtime)
+        for(int c = 0; c < width; c++)
+        {
+            if(progress_cancelled(progress))
+                continue;
+
+            for(int r = 0; r < height; r++)
+                column[r] = spectrum[r*width+c];
+
+            columnPlan.forward(column, scratch);
+
+            //get the magnitude, and take the log to scale things nicely
+            for(int r = 0; r < height; r++)
+            {
+                double z = column[r].real();
+                double mirror = column[(height-r)%height].real();
+                double real = (z + mirror)/2;
+                double complex = (mirror - z)/2;
+
+                magnitude[r*width+c] = log(sqrt(real*real + complex*complex));
+            }
+
+            progress_advance(progress);
+        }
+
+        delete[] column;
+        delete[] scratch;
+    }
+
+    double max=-1,min=-1;
+    //find the range of the magnitudes
+#   pragma omp parallel for num_threads(thread_count) schedule(runtime) default(none) \
+        shared(progress,magnitude,size) reduction(max:max) reduction(min:min)
+    for(int r = 0; r < size.height(); r++)
+    {
+        if(progress_cancelled(progress))
+            continue;
+
+        for(int c = 0; c < size.width(); c++)
+        {
+            if(max == -1)
+                max = magnitude[r*size.width()+c];
+            if(min == -1)
+                min = magnitude[r*size.width()+c];
+            if(magnitude[r*size.width()+c] > max)
+                max = magnitude[r*size.width()+c];
+            if(magnitude[r*size.width()+c] < min)
+                min = magnitude[r*size.width()+c];
+        }
+
+        progress_advance(progress);
+    }
+
+    //the log gives us really small numbers, normalize before setting the pixels in the image
+
+
+    //go through and set each pixel in the new image, by output row so each
+    //thread writes the rows it first touched
+    PlacementScope placement(*newImage, thread_count);
+
+#   pragma omp parallel for num_threads(thread_count) schedule(runtime) default(none) \
+        shared(progress,min,max,out,magnitude,size)
+    for(int row = 0; row < size.height(); row++)
     {
-        for(col = 0; col < size.width(); col++)
+        if(progress_cancelled(progress))
+            continue;
+
+        int r = (row + size.height() - size.height()/2)%size.height();
+        QRgb * dst = out[row];
+
+        for(int c = 0; c < size.width(); c++)
         {
-            //apply the new gamma
-            QColor color = QColor(image.pixel(col, row));
-            int r = pow(color.red()/255.0,gamma)*255+0.5;
-            int g = pow(color.green()/255.0,gamma)*255+0.5;
-            int b = pow(color.blue()/255.0,gamma)*255+0.5;
-
-            color.setRed(r);
-            color.setGreen(g);
-            color.setBlue(b);
-            newImage->setPixel(col, row, color.rgb());
+            int norm_mag = (magnitude[r*size.width()+c]-min)/(max-min)*255;
+            dst[(c+size.width()/2)%size.width()] = qRgb(norm_mag,norm_mag,norm_mag);
         }
+
+        progress_advance(progress);
     }
 
+    //no memory leaks!
+    pool_free(spectrum);
+    pool_free(magnitude);
+
     return newImage;
 }
 
 /******************************************************************************
- * Function: fft
- * Description: perform a 2D fft on the image by doing 1D fft's in the rows
- *  and then in the columns.
+ * Function: dft
+ * Description: perform a 2D fourier transform on the image by doing direct
+ *  1D dft's in the rows and then in the columns. This is the original O(N^2)
+ *  per line implementation, kept as the reference fft() is benchmarked and
+ *  checked against.
  * Parameters:
  *   image - the image to process on
  *   thread_count - the number of threads to use
  * Returns: The new image
  *****************************************************************************/
-QImage* fft(const QImage& image, int thread_count)
+QImage* dft(const QImage& image, int thread_count)
 {
     //start off by grayscaling the image
     QImage* newImage = grayscale(image,thread_count);
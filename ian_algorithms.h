@@ -3,11 +3,100 @@
 
 #include <QImage>
 
+#include "convolution.h"
+
+/******************************************************************************
+ * Struct: SharpenParams
+ * Description: The strength of sharpen(): the centre weight is 1 + 4*amount
+ *  and each neighbour -amount, so fractions give gentler masks. An amount of
+ *  0 leaves the image as it is.
+ *****************************************************************************/
+struct SharpenParams
+{
+    explicit SharpenParams(float amount = 1, EdgeMode edge = EDGE_CLAMP) :
+        amount(amount),
+        edge(edge)
+    {
+    }
+
+    float amount;
+    EdgeMode edge;
+};
+
+/******************************************************************************
+ * Struct: EmbossParams
+ * Description: The gray level emboss() maps flat areas to.
+ *****************************************************************************/
+struct EmbossParams
+{
+    explicit EmbossParams(int offset = 128) :
+        offset(offset)
+    {
+    }
+
+    int offset;
+};
+
+/******************************************************************************
+ * Struct: ContrastParams
+ * Description: enhance_contrast() stretches low - high out to 0 - 255;
+ *  reduce_contrast() squeezes 0 - 255 into low - high.
+ *****************************************************************************/
+struct ContrastParams
+{
+    explicit ContrastParams(int low = 64, int high = 192) :
+        low(low),
+        high(high)
+    {
+    }
+
+    int low;
+    int high;
+};
+
+/******************************************************************************
+ * Struct: PosterizeParams
+ * Description: The number of levels posterize() leaves per channel, 2 - 256.
+ *****************************************************************************/
+struct PosterizeParams
+{
+    explicit PosterizeParams(int levels = 4) :
+        levels(levels)
+    {
+    }
+
+    int levels;
+};
+
+/******************************************************************************
+ * Struct: GammaParams
+ * Description: The power gamma() raises each normalized channel to; powers
+ *  below GAMMA_MIN are raised to it.
+ *****************************************************************************/
+struct GammaParams
+{
+    explicit GammaParams(double gamma = 0.5) :
+        gamma(gamma)
+    {
+    }
+
+    double gamma;
+};
+
+RgbKernel<1> sharpen_kernel(float amount = 1);
+
 QImage* sharpen(const QImage& image, int thread_count);
+QImage* sharpen(const QImage& image, int thread_count, const SharpenParams& params);
 QImage* emboss(const QImage& image, int thread_count);
+QImage* emboss(const QImage& image, int thread_count, const EmbossParams& params);
 QImage* enhance_contrast(const QImage& image, int thread_count);
+QImage* enhance_contrast(const QImage& image, int thread_count, const ContrastParams& params);
 QImage* reduce_contrast(const QImage& image, int thread_count);
+QImage* reduce_contrast(const QImage& image, int thread_count, const ContrastParams& params);
 QImage* posterize(const QImage& image, int thread_count);
+QImage* posterize(const QImage& image, int thread_count, const PosterizeParams& params);
 QImage* gamma(const QImage& image, int thread_count);
+QImage* gamma(const QImage& image, int thread_count, const GammaParams& params);
 QImage* fft(const QImage& image, int thread_count);
+QImage* dft(const QImage& image, int thread_count);
 #endif // IAN_ALGORITHMS_H
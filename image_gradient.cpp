@@ -0,0 +1,194 @@
+#include "image_gradient.h"
+#include "pixel_access.h"
+#include "filter_progress.h"
+
+#include <cmath>
+
+GradientField::GradientField(int width, int height, bool direction) :
+    magnitudes(new PlanarImage<float>(width, height, 1, 1)),
+    directions(direction ? new PlanarImage<uchar>(width, height, 1) : NULL)
+{
+}
+
+GradientField::~GradientField()
+{
+    delete magnitudes;
+    delete directions;
+}
+
+/******************************************************************************
+ * Function: zero_border
+ * Description: Sets the border of the first plane of a float plane to 0: the
+ *  whole rows above and below the image and the border columns either side
+ *  of each row, not the pixels inside.
+ *****************************************************************************/
+static void zero_border(PlanarImage<float>& plane)
+{
+    int border = plane.border();
+    int width = plane.width();
+    int height = plane.height();
+
+    for(int r = -border; r < height + border; r++)
+    {
+        float* line = plane.row(0, r);
+
+        if(r < 0 || r >= height)
+        {
+            for(int c = -border; c < width + border; c++)
+                line[c] = 0;
+        }
+        else
+        {
+            for(int c = 1; c <= border; c++)
+                line[-c] = line[width - 1 + c] = 0;
+        }
+    }
+}
+
+/******************************************************************************
+ * Function: image_gradient
+ * Description: Computes the gradient magnitude, and optionally the direction,
+ *  of the luma of an image in parallel. Each output row takes its three luma
+ *  rows into a vertically smoothed and a vertically differenced integer row,
+ *  border columns included, then finishes both derivatives along them; see
+ *  image_gradient.h.
+ * Parameters:
+ *   image - the image to process on
+ *   params - the operator, norm, edge mode and whether to find the direction
+ *   thread_count - the number of threads to use
+ * Returns: The gradient field.
+ *****************************************************************************/
+GradientField* image_gradient(const QImage& image, const GradientParams& params, int thread_count)
+{
+    PlanarImage<uchar>* luma = to_planar<uchar>(image, PLANAR_LUMA, 1, params.edge, thread_count);
+    int width = luma->width();
+    int height = luma->height();
+
+    GradientField* field = new GradientField(width, height, params.direction);
+    zero_border(field->magnitude());
+
+    //the smoothing column (side, middle, side), scaled so half a mask adds up to 1
+    int side = params.op == GRADIENT_SCHARR ? 3 : 1;
+    int middle = params.op == GRADIENT_SCHARR ? 10 : 2;
+    float scale = 1.0f / (2 * side + middle);
+    GradientNorm norm = params.norm;
+
+    PlanarImage<float>* magnitude = &field->magnitude();
+    PlanarImage<uchar>* direction = field->direction();
+
+    FilterProgress* progress = FilterProgress::current();
+    progress_add_work(progress, height);
+
+#   pragma omp parallel num_threads(thread_count) default(none) \
+        shared(progress, luma, magnitude, direction, width, height, side, middle, scale, norm) \
+        copyin(traceOperation)
+    {
+        TraceScope trace("gradient rows", "rows");
+
+        //the vertical passes, with a column on either side
+        int* smoothRow = new int[width + 2] + 1;
+        int* diffRow = new int[width + 2] + 1;
+        float* xRow = new float[qMax(1, width)];
+        float* yRow = new float[qMax(1, width)];
+
+#       pragma omp for schedule(runtime) nowait
+        for(int r = 0; r < height; r++)
+        {
+            if(progress_cancelled(progress))
+                continue;
+
+            const uchar* up = luma->row(0, r - 1);
+            const uchar* center = luma->row(0, r);
+            const uchar* down = luma->row(0, r + 1);
+
+            for(int c = -1; c <= width; c++)
+            {
+                smoothRow[c] = side * (up[c] + down[c]) + middle * center[c];
+                diffRow[c] = down[c] - up[c];
+            }
+
+            for(int c = 0; c < width; c++)
+            {
+                xRow[c] = (smoothRow[c + 1] - smoothRow[c - 1]) * scale;
+                yRow[c] = (side * (diffRow[c - 1] + diffRow[c + 1]) + middle * diffRow[c]) * scale;
+            }
+
+            float* dst = magnitude->row(0, r);
+
+            if(norm == GRADIENT_L1)
+            {
+                for(int c = 0; c < width; c++)
+                    dst[c] = std::fabs(xRow[c]) + std::fabs(yRow[c]);
+            }
+            else if(norm == GRADIENT_L2_FAST)
+            {
+                for(int c = 0; c < width; c++)
+                {
+                    float x = std::fabs(xRow[c]);
+                    float y = std::fabs(yRow[c]);
+
+                    dst[c] = 0.960434f * qMax(x, y) + 0.397825f * qMin(x, y);
+                }
+            }
+            else
+            {
+                for(int c = 0; c < width; c++)
+                    dst[c] = std::sqrt(xRow[c] * xRow[c] + yRow[c] * yRow[c]);
+            }
+
+            if(direction != NULL)
+            {
+                uchar* sector = direction->row(0, r);
+
+                //tan(22.5) and tan(67.5) split the angles between the axes
+                for(int c = 0; c < width; c++)
+                {
+                    float x = std::fabs(xRow[c]);
+                    float y = std::fabs(yRow[c]);
+
+                    if(y <= 0.414214f * x)
+                        sector[c] = GRADIENT_HORIZONTAL;
+                    else if(y >= 2.414214f * x)
+                        sector[c] = GRADIENT_VERTICAL;
+                    else
+                        sector[c] = (xRow[c] > 0) == (yRow[c] > 0) ? GRADIENT_DIAGONAL : GRADIENT_ANTIDIAGONAL;
+                }
+            }
+
+            trace.add_count(1);
+            progress_advance(progress);
+        }
+
+        delete[] (smoothRow - 1);
+        delete[] (diffRow - 1);
+        delete[] xRow;
+        delete[] yRow;
+    }
+
+    delete luma;
+
+    return field;
+}
+
+/******************************************************************************
+ * Function: gradient_image
+ * Description: The gradient magnitude of an image as a gray image, clamped to
+ *  0 - 255 and truncated like the kernel filters.
+ * Parameters:
+ *   image - the image to process on
+ *   params - the operator, norm and edge mode; the direction is not computed
+ *   thread_count - the number of threads to use
+ * Returns: The gradient image.
+ *****************************************************************************/
+QImage* gradient_image(const QImage& image, const GradientParams& params, int thread_count)
+{
+    GradientParams magnitudeOnly = params;
+    magnitudeOnly.direction = false;
+
+    GradientField* field = image_gradient(image, magnitudeOnly, thread_count);
+    QImage* newImage = from_planar(field->magnitude(), PLANAR_LUMA, QImage(), thread_count);
+
+    delete field;
+
+    return newImage;
+}
@@ -0,0 +1,179 @@
+#include "integral_image.h"
+#include "pixel_access.h"
+#include "buffer_pool.h"
+#include "filter_progress.h"
+
+/******************************************************************************
+ * Function: IntegralImage::IntegralImage
+ * Description: Builds the table in parallel. Each thread first runs prefix
+ *  sums along whole rows, then down strips of columns, adding each table row
+ *  to the one below it.
+ * Parameters:
+ *   image - the image to sum
+ *   source - which values are summed
+ *   squares - also sum the squares of the values
+ *   thread_count - the number of threads to use
+ *****************************************************************************/
+IntegralImage::IntegralImage(const QImage& image, Source source, bool squares, int thread_count)
+{
+    QImage input = to_argb32(image);
+
+    imageWidth = input.width();
+    imageHeight = input.height();
+
+    int values = (source == SOURCE_RGB) ? 3 : 1;
+    planeCount = squares ? 2 * values : values;
+
+    int width = imageWidth;
+    int height = imageHeight;
+    int planes = planeCount;
+    qptrdiff stride = (qptrdiff)(width + 1) * planes;
+
+    table = pool_array<quint64>(stride * (height + 1));
+
+    //the zero first row
+    for(qptrdiff i = 0; i < stride; i++)
+        table[i] = 0;
+
+    ConstScanlines in(input);
+    quint64* sums = table;
+
+    int strips = (int)((stride + INTEGRAL_STRIP_WIDTH - 1) / INTEGRAL_STRIP_WIDTH);
+
+    FilterProgress* progress = FilterProgress::current();
+    progress_add_work(progress, height + strips);
+
+    //Row pass - every row is independent
+#   pragma omp parallel for num_threads(thread_count) schedule(runtime) default(none) \
+        shared(progress, in, sums, width, height, planes, values, stride)
+    for(int r = 0; r < height; r++)
+    {
+        if(progress_cancelled(progress))
+            continue;
+
+        const QRgb* src = in[r];
+        quint64* row = sums + (r + 1) * stride;
+        quint64 total[INTEGRAL_MAX_PLANES] = {0};
+
+        //the zero first column
+        for(int p = 0; p < planes; p++)
+            row[p] = 0;
+
+        for(int c = 0; c < width; c++)
+        {
+            quint64 value[3];
+
+            if(values == 3)
+            {
+                value[0] = qRed(src[c]);
+                value[1] = qGreen(src[c]);
+                value[2] = qBlue(src[c]);
+            }
+            else
+                value[0] = (qRed(src[c]) + qGreen(src[c]) + qBlue(src[c])) / 3;
+
+            quint64* dst = row + (qptrdiff)(c + 1) * planes;
+
+            for(int p = 0; p < values; p++)
+                dst[p] = total[p] += value[p];
+
+            for(int p = values; p < planes; p++)
+                dst[p] = total[p] += value[p - values] * value[p - values];
+        }
+
+        progress_advance(progress);
+    }
+
+    //Column pass - each thread runs down a strip of columns
+#   pragma omp parallel for num_threads(thread_count) schedule(runtime) default(none) \
+        shared(progress, sums, height, stride, strips)
+    for(int s = 0; s < strips; s++)
+    {
+        if(progress_cancelled(progress))
+            continue;
+
+        qptrdiff first = (qptrdiff)s * INTEGRAL_STRIP_WIDTH;
+        qptrdiff last = qMin(first + INTEGRAL_STRIP_WIDTH, stride);
+
+        for(int r = 1; r <= height; r++)
+        {
+            const quint64* above = sums + (r - 1) * stride;
+            quint64* row = sums + r * stride;
+
+            for(qptrdiff i = first; i < last; i++)
+                row[i] += above[i];
+        }
+
+        progress_advance(progress);
+    }
+}
+
+IntegralImage::~IntegralImage()
+{
+    pool_free(table);
+}
+
+/******************************************************************************
+ * Function: IntegralImage::clamped_sum
+ * Description: The sums over the (2*radius+1)^2 window centred on a pixel,
+ *  with the pixels past the edges repeating the edge pixels. The part of the
+ *  window past an edge adds the edge row or column that many more times,
+ *  and past a corner the corner pixel, so this is still a constant number
+ *  of lookups.
+ * Parameters:
+ *   x, y - the pixel, inside the image
+ *   radius - the window radius
+ *   sums - receives planes() sums
+ *****************************************************************************/
+void IntegralImage::clamped_sum(int x, int y, int radius, quint64* sums) const
+{
+    int right = imageWidth - 1;
+    int bottom = imageHeight - 1;
+
+    //how far the window runs past each edge
+    quint64 beforeX = qMax(0, radius - x);
+    quint64 afterX = qMax(0, x + radius - right);
+    quint64 beforeY = qMax(0, radius - y);
+    quint64 afterY = qMax(0, y + radius - bottom);
+
+    int x0 = qMax(0, x - radius);
+    int x1 = qMin(right, x + radius);
+    int y0 = qMax(0, y - radius);
+    int y1 = qMin(bottom, y + radius);
+
+    box_sum(x0, y0, x1, y1, sums);
+
+    if((beforeX | afterX | beforeY | afterY) == 0)
+        return;
+
+    quint64 part[INTEGRAL_MAX_PLANES];
+
+    struct Edge
+    {
+        quint64 times;
+        int left, top, right, bottom;
+    };
+
+    const Edge edges[] =
+    {
+        {beforeX, 0, y0, 0, y1},
+        {afterX, right, y0, right, y1},
+        {beforeY, x0, 0, x1, 0},
+        {afterY, x0, bottom, x1, bottom},
+        {beforeX * beforeY, 0, 0, 0, 0},
+        {afterX * beforeY, right, 0, right, 0},
+        {beforeX * afterY, 0, bottom, 0, bottom},
+        {afterX * afterY, right, bottom, right, bottom}
+    };
+
+    for(int e = 0; e < 8; e++)
+    {
+        if(edges[e].times == 0)
+            continue;
+
+        box_sum(edges[e].left, edges[e].top, edges[e].right, edges[e].bottom, part);
+
+        for(int p = 0; p < planeCount; p++)
+            sums[p] += edges[e].times * part[p];
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef INTEGRAL_IMAGE_H
+#define INTEGRAL_IMAGE_H
+
+#include <QImage>
+
+// Number of table columns each thread owns in the column pass
+#define INTEGRAL_STRIP_WIDTH 64
+
+// The most planes a table has: red, green, blue and their squares
+#define INTEGRAL_MAX_PLANES 6
+
+/******************************************************************************
+ * Class: IntegralImage
+ * Description: A summed-area table: entry (x, y) holds the sum of every pixel
+ *  above and to the left of (x, y), so the sum over any rectangle is four
+ *  lookups whatever its size. Filters that average over large windows are
+ *  built on it so their cost does not grow with the window.
+ *
+ * The table has one or more planes: the red, green and blue channels, or the
+ * grayscale average of the channels, optionally followed by the squares of
+ * the same values for local variances. Sums are 64 bit, enough for the
+ * squares of the largest images.
+ *
+ * It is built in two parallel passes, prefix sums along each row and then
+ * down strips of INTEGRAL_STRIP_WIDTH columns.
+ *****************************************************************************/
+class IntegralImage
+{
+public:
+    enum Source
+    {
+        SOURCE_RGB,         // three planes, red, green and blue
+        SOURCE_GRAY         // one plane, (red + green + blue) / 3
+    };
+
+    IntegralImage(const QImage& image, Source source, bool squares, int thread_count);
+    ~IntegralImage();
+
+    int width() const { return imageWidth; }
+    int height() const { return imageHeight; }
+    int planes() const { return planeCount; }
+
+    // The planes() sums over columns left - right and rows top - bottom,
+    // inclusive, which must lie inside the image
+    void box_sum(int left, int top, int right, int bottom, quint64* sums) const
+    {
+        const quint64* a = entry(left, top);
+        const quint64* b = entry(right + 1, top);
+        const quint64* c = entry(left, bottom + 1);
+        const quint64* d = entry(right + 1, bottom + 1);
+
+        for(int p = 0; p < planeCount; p++)
+            sums[p] = d[p] - b[p] - c[p] + a[p];
+    }
+
+    void clamped_sum(int x, int y, int radius, quint64* sums) const;
+
+private:
+    const quint64* entry(int x, int y) const
+    {
+        return table + ((qptrdiff)y * (imageWidth + 1) + x) * planeCount;
+    }
+
+    quint64* table;     // (width + 1) x (height + 1) entries of planeCount sums,
+                        // the first row and column zero
+    int imageWidth;
+    int imageHeight;
+    int planeCount;
+
+    IntegralImage(const IntegralImage&);
+    IntegralImage& operator=(const IntegralImage&);
+};
+
+#endif // INTEGRAL_IMAGE_H
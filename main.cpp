@@ -1,9 +1,22 @@
 #include "mainwindow.h"
+#include "batch.h"
+#include "thread_policy.h"
+#include "trace.h"
 #include <QApplication>
 
 int main(int argc, char *argv[])
 {
+    setup_threads();
+
+    // Batch mode runs without a display, so it must not create a QApplication
+    if(is_batch_invocation(argc, argv))
+    {
+        QCoreApplication a(argc, argv);
+        return run_batch(a.arguments());
+    }
+
     QApplication a(argc, argv);
+    trace_set_enabled(true);
     MainWindow w;
     w.show();
 
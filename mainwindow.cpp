@@ -6,29 +6,203 @@
 #include <QFileDialog>
 #include <QMessageBox>
 #include <QInputDialog>
+#include <QLabel>
+#include <QProgressBar>
+#include <QPushButton>
+#include <QSettings>
+#include <QStyle>
+#include <QTimer>
+#include <QtConcurrentRun>
 
 #include "matt_algorithms.h"
 #include "chris_algorithms.h"
 #include "ian_algorithms.h"
+#include "blur.h"
+#include "adaptive_filters.h"
+#include "histogram.h"
+#include "pyramid.h"
+#include "filter_progress.h"
+#include "pipeline.h"
+#include "simd_kernels.h"
+#include "point_ops.h"
+#include "trace.h"
+#include "thread_tuner.h"
+
+// The default memory budget of the undo and redo history
+#define DEFAULT_HISTORY_MB 1024
+
+// Filters are previewed on the visible area first when the image is at least
+// this many times larger than it
+#define PREVIEW_MIN_RATIO 4
+
+// Pixels filtered around the previewed area, so kernel filters have real
+// neighbours at its edges
+#define PREVIEW_MARGIN 32
+
+// Whether the noise filters preview: their noise is a hash of each pixel's
+// coordinates, which in a crop count from its corner, so a preview would
+// show other noise than the result
+#define PREVIEW_NOISE false
+
+// Whether the histogram filters preview: equalize and auto levels map each
+// pixel by the histogram of the whole image and CLAHE by those of the tiles
+// around it, which a crop does not have, so a preview would show other tones
+#define PREVIEW_HISTOGRAM false
+
+// How many operations View > Dump Trace offers to write by default
+#define TRACE_DUMP_OPERATIONS 10
+
+/******************************************************************************
+ * Function: threshold_grayscale
+ * Description: Binary threshold runs on the grayscale image. Both steps are
+ *  fused into one pass, so no intermediate grayscale image is built.
+ *****************************************************************************/
+static QImage* threshold_grayscale(const QImage& image, int thread_count)
+{
+    Pipeline pipeline;
+    pipeline.add_row_stage(new RowKernelStage(grayscale_row));
+    pipeline.add_point(threshold_lut(127));
+
+    return pipeline.run(image, thread_count);
+}
+
+// ::gamma from <math.h> would make the bare name ambiguous
+static QImage* gamma_filter(const QImage& image, int thread_count)
+{
+    return gamma(image, thread_count);
+}
+
+/******************************************************************************
+ * Function: run_filter_task
+ * Description: The body of a background filter job. Installs the job's
+ *  progress as the current one on the pool thread so the filter reports to
+ *  it and can be cancelled. If there is a preview area, the filter first
+ *  runs on just that part of the image (with a margin), without caching
+ *  pyramids of the crop, and the result is handed to the window's
+ *  show_preview() while the full image is filtered. Times the full filter.
+ * Parameters:
+ *   task - the filter to run
+ *   image - a copy of the image to process on
+ *   threads - the number of threads the filter may use
+ *   progress - the job's progress and cancellation flag
+ *   previewRect - the area to preview, in image coordinates, or empty
+ *   window - receives the preview
+ *   name - the operation name for the trace
+ * Returns: The new image and the time it took.
+ *****************************************************************************/
+static FilterResult run_filter_task(FilterTask task, QImage image, int threads, FilterProgress* progress,
+                                    QRect previewRect, QObject* window, QString name)
+{
+    TraceOperation operation(name);
+
+    FilterProgress::set_current(progress);
+
+    if(!previewRect.isEmpty())
+    {
+        QRect crop = previewRect.adjusted(-PREVIEW_MARGIN, -PREVIEW_MARGIN, PREVIEW_MARGIN, PREVIEW_MARGIN) & image.rect();
+
+        TraceScope trace("preview");
+
+        //the crop is a new image every time, its pyramids would never be reused
+        set_pyramid_caching(false);
+        QImage* filtered = task(image.copy(crop), threads);
+        set_pyramid_caching(true);
+
+        QImage preview = filtered->copy(previewRect.translated(-crop.topLeft()));
+        delete filtered;
+
+        QMetaObject::invokeMethod(window, "show_preview", Qt::QueuedConnection,
+                                  Q_ARG(QImage, preview), Q_ARG(QRect, previewRect));
+    }
+
+    FilterResult result;
+    result.image = NULL;
+    result.time = 0;
+
+    if(!progress->is_cancelled())
+    {
+        double start = omp_get_wtime();
+        result.image = task(image, threads);
+        result.time = omp_get_wtime() - start;
+    }
+
+    FilterProgress::set_current(NULL);
+
+    return result;
+}
 
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
-    ui(new Ui::MainWindow)
+    ui(new Ui::MainWindow),
+    history((qint64)DEFAULT_HISTORY_MB * 1024 * 1024)
 {
     ui->setupUi(this);
 
-    thread_count = 8;
+    //0 picks the thread count per filter and image size
+    thread_count = QSettings("prog4", "prog4").value("threadCount", 0).toInt();
+    thread_count = qBound(0, thread_count, tuner.max_threads());
+
+    blurSigma = 2.0;
+    blurRadius = 2;
+    contrastRadius = LocalContrastParams().radius;
+    thresholdRadius = AdaptiveThresholdParams().radius;
+    noiseSigma = NoiseParams().sigma;
+    pyramidSigma = PyramidBlurParams().sigma;
+    detailGain = DetailParams().gain;
 
     image = NULL;
+
+    pendingIsPointOp = false;
+
+    filterProgress = NULL;
+    filterWatcher = new QFutureWatcher<FilterResult>(this);
+    filterResultPending = false;
+    connect(filterWatcher, SIGNAL(finished()), this, SLOT(filter_finished()));
+
+    progressBar = new QProgressBar(this);
+    progressBar->setRange(0, 100);
+    progressBar->setMaximumWidth(200);
+    progressBar->hide();
+    ui->statusBar->addPermanentWidget(progressBar);
+
+    cancelButton = new QPushButton(tr("Cancel"), this);
+    cancelButton->hide();
+    ui->statusBar->addPermanentWidget(cancelButton);
+    connect(cancelButton, SIGNAL(clicked()), this, SLOT(cancel_filter()));
+
+    progressTimer = new QTimer(this);
+    progressTimer->setInterval(100);
+    connect(progressTimer, SIGNAL(timeout()), this, SLOT(update_progress()));
+
+    // Shown over the part of the image being previewed
+    previewLabel = new QLabel(ui->imageLabel);
+    previewLabel->hide();
+
+    calibrationWatcher = new QFutureWatcher<void>(this);
+    connect(calibrationWatcher, SIGNAL(finished()), this, SLOT(calibration_finished()));
+
+    if(!tuner.load())
+        calibrate_threads();
 }
 
 MainWindow::~MainWindow()
 {
+    tuner.cancel();
+    calibrationWatcher->waitForFinished();
+
+    // Don't leave a job writing into freed memory, or a result that
+    // filter_finished() was never called for
+    if(filterWatcher->isRunning())
+        filterProgress->cancel();
+    filterWatcher->waitForFinished();
+
+    if(filterResultPending)
+        delete filterWatcher->result().image;
+    delete filterProgress;
+
     if(image != NULL)
         delete image;
 
-    clear_stacks();
-
     delete ui;
 }
 
@@ -46,15 +220,18 @@ void MainWindow::on_actionOpen_triggered()
         if(image != NULL)
             delete image;
 
-        image = new QImage(imageFileName);//, QImage::Format_RGB32);
+        {
+            TraceOperation operation("Open " + imageFileName);
+            image = new QImage(imageFileName);//, QImage::Format_RGB32);
+        }
 
         if(image->isNull())
             QMessageBox::information(this, tr("prog4"), tr("Unable to load image %1.").arg(imageFileName));
         else
         {
-            clear_stacks();
+            history.clear();
             update_undo_redo_actions();
-            ui->imageLabel->setPixmap(QPixmap::fromImage(*image));
+            display_image();
         }
     }
 }
@@ -73,26 +250,12 @@ void MainWindow::on_actionSave_triggered()
 
 void MainWindow::on_actionGrayscale_triggered()
 {
-    if(image == NULL)
-        return;
-
-    double start = omp_get_wtime();
-    QImage* newImage = grayscale(*image, thread_count);
-    double end = omp_get_wtime();
-
-    set_image(newImage, end - start);
+    run_filter(grayscale, threads_for("grayscale"));
 }
 
 void MainWindow::on_actionSmooth_triggered()
 {
-    if(image == NULL)
-        return;
-
-    double start = omp_get_wtime();
-    QImage *newImage = smooth(*image, thread_count);
-    double end = omp_get_wtime();
-
-    set_image(newImage, end - start);
+    run_filter(smooth, threads_for("smooth"));
 }
 
 void MainWindow::on_actionUndo_triggered()
@@ -105,58 +268,33 @@ void MainWindow::on_actionRedo_triggered()
     redo();
 }
 
-void MainWindow::clear_undo_stack()
-{
-    while(!undoStack.isEmpty())
-    {
-        QImage* temp = undoStack.back();
-        undoStack.pop_back();
-        delete temp;
-    }
-}
-
-void MainWindow::clear_redo_stack()
-{
-    while(!redoStack.isEmpty())
-    {
-        QImage* temp = redoStack.back();
-        redoStack.pop_back();
-        delete temp;
-    }
-}
-
-void MainWindow::clear_stacks()
-{
-    clear_undo_stack();
-    clear_redo_stack();
-}
-
 void MainWindow::save_image(QString fileName)
 {
     if(image != NULL)
     {
+        TraceOperation operation("Save");
         image->save(fileName.isEmpty() ? imageFileName : fileName);
     }
 }
 
+/******************************************************************************
+ * Function: set_image
+ * Description: Shows the result of a filter and records the image it
+ *  replaced in the history.
+ *****************************************************************************/
 void MainWindow::set_image(QImage *newImage, double time)
 {
     if(image != NULL)
     {
-        undoStack.push_back(image);
-        clear_redo_stack();
+        {
+            TraceScope trace("history");
+            history.push(image, pendingIsPointOp ? &pendingLut : NULL);
+            history.trim(newImage, threads_for("history"));
+        }
 
         image = newImage;
 
-        ui->imageLabel->setPixmap(QPixmap::fromImage(*image));
-
-        // Undo stack can only save 15 images
-        if(undoStack.size() > 15)
-        {
-            QImage* temp = undoStack.front();
-            undoStack.pop_front();
-            delete temp;
-        }
+        display_image();
 
         update_undo_redo_actions();
 
@@ -166,420 +304,733 @@ void MainWindow::set_image(QImage *newImage, double time)
 
 void MainWindow::undo()
 {
-    redoStack.push_back(image);
+    TraceOperation operation("Undo");
 
-    image = undoStack.back();
-    undoStack.pop_back();
+    image = history.undo(image, threads_for("history"));
 
-    ui->imageLabel->setPixmap(QPixmap::fromImage(*image));
+    display_image();
 
     update_undo_redo_actions();
+
+    // Compress after the new image is on screen, not before
+    QTimer::singleShot(0, this, SLOT(trim_history()));
 }
 
 void MainWindow::redo()
 {
-    undoStack.push_back(image);
+    TraceOperation operation("Redo");
 
-    image = redoStack.back();
-    redoStack.pop_back();
+    image = history.redo(image, threads_for("history"));
 
-    ui->imageLabel->setPixmap(QPixmap::fromImage(*image));
+    display_image();
 
     update_undo_redo_actions();
+
+    QTimer::singleShot(0, this, SLOT(trim_history()));
 }
 
-void MainWindow::update_undo_redo_actions()
+void MainWindow::trim_history()
 {
-    ui->actionUndo->setEnabled(!undoStack.isEmpty());
-    ui->actionRedo->setEnabled(!redoStack.isEmpty());
+    if(image != NULL)
+    {
+        TraceScope trace("history");
+        history.trim(image, threads_for("history"));
+    }
 }
 
-void MainWindow::on_actionGradient_triggered()
+void MainWindow::display_image()
 {
-    if(image == NULL)
+    TraceScope trace("display");
+    ui->imageLabel->setPixmap(QPixmap::fromImage(*image));
+}
+
+/******************************************************************************
+ * Function: on_actionDump_Trace_triggered
+ * Description: Writes the trace of the latest operations as a Chrome trace
+ *  JSON file, for chrome://tracing or Perfetto.
+ *****************************************************************************/
+void MainWindow::on_actionDump_Trace_triggered()
+{
+    bool ok;
+    int operations = QInputDialog::getInt(this, "Dump Trace", "Operations", TRACE_DUMP_OPERATIONS,
+                                          1, TRACE_MAX_OPERATIONS, 1, &ok);
+    if(!ok)
         return;
 
-    double start = omp_get_wtime();
-    QImage* newImage = gradient(*image, thread_count);
-    double end = omp_get_wtime();
+    QString fileName = QFileDialog::getSaveFileName(this, tr("Save Trace"), QString(), tr("Chrome Trace (*.json)"));
+    if(fileName.isEmpty())
+        return;
 
-    set_image(newImage, end - start);
+    if(!trace_write_chrome_json(fileName, operations))
+        QMessageBox::information(this, tr("prog4"), tr("Unable to write %1.").arg(fileName));
 }
 
-void MainWindow::on_actionLaplacian_triggered()
+void MainWindow::update_undo_redo_actions()
 {
-    if(image == NULL)
-        return;
+    ui->actionUndo->setEnabled(history.can_undo());
+    ui->actionRedo->setEnabled(history.can_redo());
+}
 
-    double start = omp_get_wtime();
-    QImage* newImage = laplacian(*image, thread_count);
-    double end = omp_get_wtime();
+void MainWindow::on_actionGradient_triggered()
+{
+    run_filter(gradient, threads_for("gradient"));
+}
 
-    set_image(newImage, end - start);
+void MainWindow::on_actionLaplacian_triggered()
+{
+    run_filter(laplacian, threads_for("laplacian"));
 }
 
 void MainWindow::on_actionBrighten_triggered()
 {
-    if(image == NULL)
-        return;
+    PointLut lut = brighten_darken_lut(20, 255);
+    run_filter(brighten, threads_for("brighten"), &lut);
+}
 
-    double start = omp_get_wtime();
-    QImage* newImage = brighten(*image, thread_count);
-    double end = omp_get_wtime();
+void MainWindow::on_actionDarken_triggered()
+{
+    PointLut lut = brighten_darken_lut(-20, 0);
+    run_filter(darken, threads_for("darken"), &lut);
+}
 
-    set_image(newImage, end - start);
+void MainWindow::on_actionSharpen_triggered()
+{
+    run_filter(sharpen, threads_for("sharpen"));
 }
 
-void MainWindow::on_actionDarken_triggered()
+void MainWindow::on_actionNegate_triggered()
 {
-    if(image == NULL)
-        return;
+    PointLut lut = negate_lut();
+    run_filter(negate, threads_for("negate"), &lut);
+}
 
-    double start = omp_get_wtime();
-    QImage* newImage = darken(*image, thread_count);
-    double end = omp_get_wtime();
 
-    set_image(newImage, end - start);
+void MainWindow::on_actionFFT_triggered()
+{
+    // a transform of the whole image, a part of it previews nothing useful
+    run_filter(fft, threads_for("fft"), NULL, false);
 }
 
-void MainWindow::on_actionSharpen_triggered()
+void MainWindow::on_actionEmboss_triggered()
 {
-    if(image == NULL)
-        return;
+    run_filter(emboss, threads_for("emboss"));
+}
 
-    double start = omp_get_wtime();
-    QImage* newImage = sharpen(*image, thread_count);
-    double end = omp_get_wtime();
+void MainWindow::on_actionBinary_Threshold_triggered()
+{
+    run_filter(threshold_grayscale, threads_for("binary_threshold"));
+}
 
-    set_image(newImage, end - start);
+void MainWindow::on_actionEnhanceContrast_triggered()
+{
+    PointLut lut = enhance_contrast_lut();
+    run_filter(enhance_contrast, threads_for("enhance_contrast"), &lut);
 }
 
-void MainWindow::on_actionNegate_triggered()
+void MainWindow::on_actionNoise_triggered()
 {
-    if(image == NULL)
-        return;
+    run_filter(noise, threads_for("noise"), NULL, PREVIEW_NOISE);
+}
 
-    double start = omp_get_wtime();
-    QImage* newImage = negate(*image, thread_count);
-    double end = omp_get_wtime();
+void MainWindow::on_actionReduce_Contrast_triggered()
+{
+    PointLut lut = reduce_contrast_lut();
+    run_filter(reduce_contrast, threads_for("reduce_contrast"), &lut);
+}
 
-    set_image(newImage, end - start);
+void MainWindow::on_actionPosterize_triggered()
+{
+    PointLut lut = posterize_lut(4);
+    run_filter(posterize, threads_for("posterize"), &lut);
 }
 
+void MainWindow::on_actionGamma_triggered()
+{
+    PointLut lut = gamma_lut(0.5);
+    run_filter(gamma_filter, threads_for("gamma"), &lut);
+}
 
-void MainWindow::on_actionFFT_triggered()
+void MainWindow::on_actionGaussian_triggered()
 {
-    if(image == NULL)
-        return;
+    run_filter(gaussian, threads_for("gaussian"));
+}
 
-    double start = omp_get_wtime();
-    QImage* newImage = fft(*image, thread_count);
-    double end = omp_get_wtime();
+void MainWindow::on_actionSmooth_Sequential_triggered()
+{
+    run_filter(smooth, 1);
+}
 
-    set_image(newImage, end - start);
+void MainWindow::on_actionGrayscale_Sequential_triggered()
+{
+    run_filter(grayscale, 1);
 }
 
-void MainWindow::on_actionEmboss_triggered()
+void MainWindow::on_actionGradient_Sequential_triggered()
 {
-    if(image == NULL)
-        return;
+    run_filter(gradient, 1);
+}
 
-    double start = omp_get_wtime();
-    QImage* newImage = emboss(*image, thread_count);
-    double end = omp_get_wtime();
+void MainWindow::on_actionBrighten_Sequential_triggered()
+{
+    PointLut lut = brighten_darken_lut(20, 255);
+    run_filter(brighten, 1, &lut);
+}
 
-    set_image(newImage, end - start);
+void MainWindow::on_actionDarken_Sequential_triggered()
+{
+    PointLut lut = brighten_darken_lut(-20, 0);
+    run_filter(darken, 1, &lut);
 }
 
-void MainWindow::on_actionBinary_Threshold_triggered()
+void MainWindow::on_actionLaplacian_Sequential_triggered()
 {
-    if(image == NULL)
-        return;
+    run_filter(laplacian, 1);
+}
 
-    double start = omp_get_wtime();
-    QImage* newImage = binary_threshold( *grayscale(*image, thread_count) , thread_count);
-    double end = omp_get_wtime();
+void MainWindow::on_actionNoise_Sequential_triggered()
+{
+    run_filter(noise, 1, NULL, PREVIEW_NOISE);
+}
 
-    set_image(newImage, end - start);
+void MainWindow::on_actionBinary_Threshold_Sequential_triggered()
+{
+    run_filter(threshold_grayscale, 1);
 }
 
-void MainWindow::on_actionEnhanceContrast_triggered()
+void MainWindow::on_actionNegate_Sequential_triggered()
 {
-    if(image == NULL)
-        return;
+    PointLut lut = negate_lut();
+    run_filter(negate, 1, &lut);
+}
 
-    double start = omp_get_wtime();
-    QImage* newImage = enhance_contrast(*image, thread_count);
-    double end = omp_get_wtime();
+void MainWindow::on_actionSharpen_Sequential_triggered()
+{
+    run_filter(sharpen, 1);
+}
 
-    set_image(newImage, end - start);
+void MainWindow::on_actionGamma_Sequential_triggered()
+{
+    PointLut lut = gamma_lut(0.5);
+    run_filter(gamma_filter, 1, &lut);
 }
 
-void MainWindow::on_actionNoise_triggered()
+void MainWindow::on_actionEnhanceContrast_Sequential_triggered()
 {
-    if(image == NULL)
-        return;
+    PointLut lut = enhance_contrast_lut();
+    run_filter(enhance_contrast, 1, &lut);
+}
 
-    double start = omp_get_wtime();
-    QImage* newImage = noise(*image , thread_count);
-    double end = omp_get_wtime();
+void MainWindow::on_actionReduce_Contrast_Sequential_triggered()
+{
+    PointLut lut = reduce_contrast_lut();
+    run_filter(reduce_contrast, 1, &lut);
+}
 
-    set_image(newImage, end - start);
+void MainWindow::on_actionEmboss_Sequential_triggered()
+{
+    run_filter(emboss, 1);
 }
 
-void MainWindow::on_actionReduce_Contrast_triggered()
+void MainWindow::on_actionPosterize_Sequential_triggered()
 {
-    if(image == NULL)
+    PointLut lut = posterize_lut(4);
+    run_filter(posterize, 1, &lut);
+}
+
+void MainWindow::on_actionGaussian_Sequential_triggered()
+{
+    run_filter(gaussian, 1);
+}
+
+/******************************************************************************
+ * Function: on_actionSet_Thread_Count_triggered
+ * Description: Sets the number of threads the filters use, from one to all
+ *  the processors, or 0 to have the tuner pick it for each filter and image
+ *  size. The choice is kept for the next run.
+ *****************************************************************************/
+void MainWindow::on_actionSet_Thread_Count_triggered()
+{
+    bool ok;
+    int count = QInputDialog::getInt(this, "Set Thread Count", "Thread count (0 for automatic)", thread_count,
+                                     0, tuner.max_threads(), 1, &ok);
+    if(!ok)
         return;
 
-    double start = omp_get_wtime();
-    QImage* newImage = reduce_contrast(*image, thread_count);
-    double end = omp_get_wtime();
+    thread_count = count;
+    QSettings("prog4", "prog4").setValue("threadCount", thread_count);
+}
 
-    set_image(newImage, end - start);
+void MainWindow::on_actionCalibrate_Threads_triggered()
+{
+    calibrate_threads();
 }
 
-void MainWindow::on_actionPosterize_triggered()
+/******************************************************************************
+ * Function: calibrate_threads
+ * Description: Times the filters on the thread pool to find the best thread
+ *  counts for this machine. The tuner keeps answering from what it has
+ *  measured so far in the meantime, and set_busy() pauses the calibration
+ *  while a filter runs.
+ *****************************************************************************/
+void MainWindow::calibrate_threads()
 {
-    if(image == NULL)
+    if(calibrationWatcher->isRunning())
         return;
 
-    double start = omp_get_wtime();
-    QImage* newImage = posterize(*image, thread_count);
-    double end = omp_get_wtime();
+    ui->actionCalibrate_Threads->setEnabled(false);
+    ui->statusBar->showMessage("Calibrating thread counts...");
 
-    set_image(newImage, end - start);
+    ThreadTuner* threadTuner = &tuner;
+    calibrationWatcher->setFuture(QtConcurrent::run([threadTuner]() {
+        threadTuner->calibrate();
+    }));
 }
 
-void MainWindow::on_actionGamma_triggered()
+void MainWindow::calibration_finished()
 {
-    if(image == NULL)
-        return;
+    ui->actionCalibrate_Threads->setEnabled(true);
+
+    if(!filterWatcher->isRunning())
+        ui->statusBar->showMessage("Thread counts calibrated", 5000);
+}
 
-    double start = omp_get_wtime();
-    QImage* newImage = gamma(*image, thread_count);
-    double end = omp_get_wtime();
+/******************************************************************************
+ * Function: threads_for
+ * Description: The number of threads to run a filter with on the current
+ *  image: the count the user set, or the tuner's pick.
+ * Parameters:
+ *   filter - the filter name, as in the filter registry
+ *****************************************************************************/
+int MainWindow::threads_for(const QString& filter) const
+{
+    if(thread_count > 0)
+        return thread_count;
 
-    set_image(newImage, end - start);
+    return tuner.threads(filter, image != NULL ? image->size() : QSize());
 }
 
-void MainWindow::on_actionGaussian_triggered()
+/******************************************************************************
+ * Function: on_actionSet_History_Memory_triggered
+ * Description: Sets how much memory the undo and redo history may use.
+ *****************************************************************************/
+void MainWindow::on_actionSet_History_Memory_triggered()
 {
-    if(image == NULL)
+    bool ok;
+    int megabytes = QInputDialog::getInt(this, "Set History Memory", "History memory (MB)",
+                                         (int)(history.budget() / (1024 * 1024)), 16, 65536, 16, &ok);
+    if(!ok)
         return;
 
-    double start = omp_get_wtime();
-    QImage* newImage = gaussian(*image, thread_count);
-    double end = omp_get_wtime();
+    history.set_budget((qint64)megabytes * 1024 * 1024);
+    trim_history();
+}
 
-    set_image(newImage, end - start);
+void MainWindow::on_actionFFT_Sequential_triggered()
+{
+    run_filter(fft, 1, NULL, false);
 }
 
-void MainWindow::on_actionSmooth_Sequential_triggered()
+void MainWindow::run_gaussian_blur(int threads)
 {
     if(image == NULL)
         return;
 
-    double start = omp_get_wtime();
-    QImage *newImage = smooth(*image, 1);
-    double end = omp_get_wtime();
+    bool ok;
+    double sigma = QInputDialog::getDouble(this, "Gaussian Blur", "Sigma (pixels)", blurSigma, 0.1, 200, 1, &ok);
+    if(!ok)
+        return;
+    blurSigma = sigma;
 
-    set_image(newImage, end - start);
+    run_filter([sigma](const QImage& input, int count) {
+        return gaussian_blur(input, sigma, count);
+    }, threads);
 }
 
-void MainWindow::on_actionGrayscale_Sequential_triggered()
+void MainWindow::run_box_blur(int threads)
 {
     if(image == NULL)
         return;
 
-    double start = omp_get_wtime();
-    QImage* newImage = grayscale(*image, 1);
-    double end = omp_get_wtime();
+    bool ok;
+    int radius = QInputDialog::getInt(this, "Box Blur", "Radius (pixels)", blurRadius, 1, 1000, 1, &ok);
+    if(!ok)
+        return;
+    blurRadius = radius;
 
-    set_image(newImage, end - start);
+    run_filter([radius](const QImage& input, int count) {
+        return box_blur(input, radius, count);
+    }, threads);
 }
 
-void MainWindow::on_actionGradient_Sequential_triggered()
+void MainWindow::run_local_contrast(int threads)
 {
     if(image == NULL)
         return;
 
-    double start = omp_get_wtime();
-    QImage* newImage = gradient(*image, 1);
-    double end = omp_get_wtime();
+    bool ok;
+    int radius = QInputDialog::getInt(this, "Local Contrast", "Radius (pixels)", contrastRadius, 1, 10000, 1, &ok);
+    if(!ok)
+        return;
+    contrastRadius = radius;
 
-    set_image(newImage, end - start);
+    run_filter([radius](const QImage& input, int count) {
+        return local_contrast(input, count, LocalContrastParams(radius));
+    }, threads);
 }
 
-void MainWindow::on_actionBrighten_Sequential_triggered()
+void MainWindow::run_adaptive_threshold(int threads)
 {
     if(image == NULL)
         return;
 
-    double start = omp_get_wtime();
-    QImage* newImage = brighten(*image, 1);
-    double end = omp_get_wtime();
+    bool ok;
+    int radius = QInputDialog::getInt(this, "Adaptive Threshold", "Radius (pixels)", thresholdRadius, 1, 10000, 1, &ok);
+    if(!ok)
+        return;
+    thresholdRadius = radius;
 
-    set_image(newImage, end - start);
+    run_filter([radius](const QImage& input, int count) {
+        return adaptive_threshold(input, count, AdaptiveThresholdParams(radius));
+    }, threads);
 }
 
-void MainWindow::on_actionDarken_Sequential_triggered()
+void MainWindow::run_noise(NoiseType type, int threads)
 {
     if(image == NULL)
         return;
 
-    double start = omp_get_wtime();
-    QImage* newImage = darken(*image, 1);
-    double end = omp_get_wtime();
+    bool ok;
+    double sigma = QInputDialog::getDouble(this, type == NOISE_SPECKLE ? "Speckle Noise" : "Gaussian Noise",
+                                           "Sigma (levels)", noiseSigma, 0, 255, 1, &ok);
+    if(!ok)
+        return;
+    noiseSigma = sigma;
 
-    set_image(newImage, end - start);
+    run_filter([type, sigma](const QImage& input, int count) {
+        return noise(input, count, NoiseParams(0, type, sigma));
+    }, threads, NULL, PREVIEW_NOISE);
 }
 
-void MainWindow::on_actionLaplacian_Sequential_triggered()
+void MainWindow::run_pyramid_blur(int threads)
 {
     if(image == NULL)
         return;
 
-    double start = omp_get_wtime();
-    QImage* newImage = laplacian(*image, 1);
-    double end = omp_get_wtime();
+    bool ok;
+    double sigma = QInputDialog::getDouble(this, "Pyramid Blur", "Sigma (pixels)", pyramidSigma, 0.1, 1000, 1, &ok);
+    if(!ok)
+        return;
+    pyramidSigma = sigma;
 
-    set_image(newImage, end - start);
+    run_filter([sigma](const QImage& input, int count) {
+        return pyramid_blur(input, count, PyramidBlurParams(sigma));
+    }, threads);
 }
 
-void MainWindow::on_actionNoise_Sequential_triggered()
+void MainWindow::run_enhance_detail(int threads)
 {
     if(image == NULL)
         return;
 
-    double start = omp_get_wtime();
-    QImage* newImage = noise(*image , 1);
-    double end = omp_get_wtime();
+    bool ok;
+    double gain = QInputDialog::getDouble(this, "Enhance Detail", "Detail gain", detailGain, 0, 10, 2, &ok);
+    if(!ok)
+        return;
+    detailGain = gain;
 
-    set_image(newImage, end - start);
+    run_filter([gain](const QImage& input, int count) {
+        return enhance_detail(input, count, DetailParams(gain));
+    }, threads);
 }
 
-void MainWindow::on_actionBinary_Threshold_Sequential_triggered()
+void MainWindow::on_actionGaussian_Blur_triggered()
 {
-    if(image == NULL)
-        return;
+    run_gaussian_blur(threads_for("gaussian_blur"));
+}
 
-    double start = omp_get_wtime();
-    QImage* newImage = binary_threshold( *grayscale(*image, 1) , 1);
-    double end = omp_get_wtime();
+void MainWindow::on_actionBox_Blur_triggered()
+{
+    run_box_blur(threads_for("box_blur"));
+}
 
-    set_image(newImage, end - start);
+void MainWindow::on_actionGaussian_Blur_Sequential_triggered()
+{
+    run_gaussian_blur(1);
 }
 
-void MainWindow::on_actionNegate_Sequential_triggered()
+void MainWindow::on_actionBox_Blur_Sequential_triggered()
 {
-    if(image == NULL)
-        return;
+    run_box_blur(1);
+}
 
-    double start = omp_get_wtime();
-    QImage* newImage = negate(*image, 1);
-    double end = omp_get_wtime();
+void MainWindow::on_actionLocal_Contrast_triggered()
+{
+    run_local_contrast(threads_for("local_contrast"));
+}
 
-    set_image(newImage, end - start);
+void MainWindow::on_actionAdaptive_Threshold_triggered()
+{
+    run_adaptive_threshold(threads_for("adaptive_threshold"));
 }
 
-void MainWindow::on_actionSharpen_Sequential_triggered()
+void MainWindow::on_actionLocal_Contrast_Sequential_triggered()
 {
-    if(image == NULL)
-        return;
+    run_local_contrast(1);
+}
 
-    double start = omp_get_wtime();
-    QImage* newImage = sharpen(*image, 1);
-    double end = omp_get_wtime();
+void MainWindow::on_actionAdaptive_Threshold_Sequential_triggered()
+{
+    run_adaptive_threshold(1);
+}
 
-    set_image(newImage, end - start);
+void MainWindow::on_actionEqualize_triggered()
+{
+    run_filter(equalize, threads_for("equalize"), NULL, PREVIEW_HISTOGRAM);
 }
 
-void MainWindow::on_actionGamma_Sequential_triggered()
+void MainWindow::on_actionAuto_Levels_triggered()
 {
-    if(image == NULL)
-        return;
+    run_filter(auto_levels, threads_for("auto_levels"), NULL, PREVIEW_HISTOGRAM);
+}
 
-    double start = omp_get_wtime();
-    QImage* newImage = gamma(*image, 1);
-    double end = omp_get_wtime();
+void MainWindow::on_actionCLAHE_triggered()
+{
+    run_filter(clahe, threads_for("clahe"), NULL, PREVIEW_HISTOGRAM);
+}
 
-    set_image(newImage, end - start);
+void MainWindow::on_actionEqualize_Sequential_triggered()
+{
+    run_filter(equalize, 1, NULL, PREVIEW_HISTOGRAM);
 }
 
-void MainWindow::on_actionEnhanceContrast_Sequential_triggered()
+void MainWindow::on_actionAuto_Levels_Sequential_triggered()
 {
-    if(image == NULL)
-        return;
+    run_filter(auto_levels, 1, NULL, PREVIEW_HISTOGRAM);
+}
 
-    double start = omp_get_wtime();
-    QImage* newImage = enhance_contrast(*image, 1);
-    double end = omp_get_wtime();
+void MainWindow::on_actionCLAHE_Sequential_triggered()
+{
+    run_filter(clahe, 1, NULL, PREVIEW_HISTOGRAM);
+}
 
-    set_image(newImage, end - start);
+void MainWindow::on_actionGaussian_Noise_triggered()
+{
+    run_noise(NOISE_GAUSSIAN, threads_for("gaussian_noise"));
 }
 
-void MainWindow::on_actionReduce_Contrast_Sequential_triggered()
+void MainWindow::on_actionSpeckle_Noise_triggered()
 {
-    if(image == NULL)
-        return;
+    run_noise(NOISE_SPECKLE, threads_for("speckle_noise"));
+}
 
-    double start = omp_get_wtime();
-    QImage* newImage = reduce_contrast(*image, 1);
-    double end = omp_get_wtime();
+void MainWindow::on_actionGaussian_Noise_Sequential_triggered()
+{
+    run_noise(NOISE_GAUSSIAN, 1);
+}
 
-    set_image(newImage, end - start);
+void MainWindow::on_actionSpeckle_Noise_Sequential_triggered()
+{
+    run_noise(NOISE_SPECKLE, 1);
 }
 
-void MainWindow::on_actionEmboss_Sequential_triggered()
+void MainWindow::on_actionPyramid_Blur_triggered()
 {
-    if(image == NULL)
-        return;
+    run_pyramid_blur(threads_for("pyramid_blur"));
+}
 
-    double start = omp_get_wtime();
-    QImage* newImage = emboss(*image, 1);
-    double end = omp_get_wtime();
+void MainWindow::on_actionEnhance_Detail_triggered()
+{
+    run_enhance_detail(threads_for("enhance_detail"));
+}
 
-    set_image(newImage, end - start);
+void MainWindow::on_actionPyramid_Blur_Sequential_triggered()
+{
+    run_pyramid_blur(1);
 }
 
-void MainWindow::on_actionPosterize_Sequential_triggered()
+void MainWindow::on_actionEnhance_Detail_Sequential_triggered()
 {
-    if(image == NULL)
+    run_enhance_detail(1);
+}
+
+/******************************************************************************
+ * Function: run_filter
+ * Description: Starts a filter on a copy of the current image on the thread
+ *  pool and returns right away, so the window keeps repainting while the
+ *  filter runs. Only one job runs at a time; the result is applied by
+ *  filter_finished().
+ * Parameters:
+ *   task - the filter to run
+ *   threads - the number of threads the filter may use
+ *   replay - the filter as a point operation, if it is one; redo then
+ *    reapplies the table instead of keeping the result image
+ *   preview - show the filter on the visible area first, for large images
+ *****************************************************************************/
+void MainWindow::run_filter(FilterTask task, int threads, const PointLut* replay, bool preview)
+{
+    if(image == NULL || filterWatcher->isRunning())
         return;
 
-    double start = omp_get_wtime();
-    QImage* newImage = posterize(*image, 1);
-    double end = omp_get_wtime();
+    QRect previewRect = preview ? preview_rect() : QRect();
+
+    //the menu entry that started the filter names it in the trace
+    QAction* action = qobject_cast<QAction*>(sender());
+    QString name = QString("%1 (%2 threads)").arg(action != NULL ? action->text() : QString("Filter")).arg(threads);
+
+    pendingIsPointOp = (replay != NULL);
+    if(replay != NULL)
+        pendingLut = *replay;
+
+    delete filterProgress;
+    filterProgress = new FilterProgress;
 
-    set_image(newImage, end - start);
+    set_busy(true);
+
+    QImage source = *image;
+    FilterProgress* progress = filterProgress;
+
+    filterResultPending = true;
+    filterWatcher->setFuture(QtConcurrent::run([=]() {
+        return run_filter_task(task, source, threads, progress, previewRect, this, name);
+    }));
 }
 
-void MainWindow::on_actionGaussian_Sequential_triggered()
+/******************************************************************************
+ * Function: run_filter
+ * Description: Picks the image and thread count form of a filter whose other
+ *  overloads take a parameter struct, so the bare name can be passed.
+ *****************************************************************************/
+void MainWindow::run_filter(FilterFunction function, int threads, const PointLut* replay, bool preview)
 {
-    if(image == NULL)
+    run_filter(FilterTask(function), threads, replay, preview);
+}
+
+/******************************************************************************
+ * Function: image_display_rect
+ * Description: Where the image is drawn within imageLabel.
+ *****************************************************************************/
+QRect MainWindow::image_display_rect() const
+{
+    return QStyle::alignedRect(ui->imageLabel->layoutDirection(), ui->imageLabel->alignment(),
+                               image->size(), ui->imageLabel->contentsRect());
+}
+
+/******************************************************************************
+ * Function: preview_rect
+ * Description: The part of the image visible in the scroll area, if the
+ *  image is large enough compared to it to be worth previewing.
+ * Returns: The area in image coordinates, or an empty rectangle.
+ *****************************************************************************/
+QRect MainWindow::preview_rect() const
+{
+    QWidget* viewport = ui->scrollArea->viewport();
+    QRect visible(ui->imageLabel->mapFrom(viewport, QPoint(0, 0)), viewport->size());
+    visible = visible.translated(-image_display_rect().topLeft()) & image->rect();
+
+    qint64 visibleArea = (qint64)visible.width() * visible.height();
+    qint64 imageArea = (qint64)image->width() * image->height();
+
+    if(visible.isEmpty() || visibleArea * PREVIEW_MIN_RATIO > imageArea)
+        return QRect();
+
+    return visible;
+}
+
+/******************************************************************************
+ * Function: set_busy
+ * Description: Shows the progress bar and cancel button while a job runs and
+ *  disables everything that would start another job or change the image.
+ *  Thread calibration is paused meanwhile, so the two don't share the cores.
+ *****************************************************************************/
+void MainWindow::set_busy(bool busy)
+{
+    if(busy)
+        tuner.pause();
+    else
+        tuner.resume();
+
+    //the filters' own actions too, or their shortcuts would still start jobs
+    ui->menuEdit->menuAction()->setEnabled(!busy);
+    ui->menuSequential->menuAction()->setEnabled(!busy);
+
+    QList<QAction*> filters = ui->menuEdit->actions() + ui->menuSequential->actions();
+    for(int i = 0; i < filters.size(); i++)
+        filters[i]->setEnabled(!busy);
+
+    ui->actionSet_Thread_Count->setEnabled(!busy);
+    ui->actionSet_History_Memory->setEnabled(!busy);
+    ui->actionOpen->setEnabled(!busy);
+
+    progressBar->setValue(0);
+    progressBar->setVisible(busy);
+    cancelButton->setEnabled(true);
+    cancelButton->setVisible(busy);
+
+    if(busy)
+    {
+        ui->actionUndo->setEnabled(false);
+        ui->actionRedo->setEnabled(false);
+        ui->statusBar->showMessage("Running...");
+        progressTimer->start();
+    }
+    else
+    {
+        progressTimer->stop();
+        previewLabel->hide();
+        update_undo_redo_actions();
+    }
+}
+
+void MainWindow::filter_finished()
+{
+    FilterResult result = filterWatcher->result();
+    bool cancelled = filterProgress->is_cancelled();
+    filterResultPending = false;
+
+    set_busy(false);
+
+    if(cancelled)
+    {
+        delete result.image;
+        ui->statusBar->showMessage("Cancelled");
         return;
+    }
 
-    double start = omp_get_wtime();
-    QImage* newImage = gaussian(*image, 1);
-    double end = omp_get_wtime();
+    set_image(result.image, result.time);
+}
 
-    set_image(newImage, end - start);
+void MainWindow::cancel_filter()
+{
+    if(filterProgress != NULL)
+        filterProgress->cancel();
+
+    cancelButton->setEnabled(false);
+    ui->statusBar->showMessage("Cancelling...");
 }
 
-void MainWindow::on_actionSet_Thread_Count_triggered()
+void MainWindow::update_progress()
 {
-    thread_count = QInputDialog::getInt(this, "Set Thread Count", "Thread Count", thread_count, 2, 16);
+    if(filterProgress != NULL)
+        progressBar->setValue(filterProgress->percent());
 }
 
-void MainWindow::on_actionFFT_Sequential_triggered()
+/******************************************************************************
+ * Function: show_preview
+ * Description: Shows a job's preview over the area it was computed for,
+ *  until the full image is done.
+ * Parameters:
+ *   preview - the filtered area
+ *   rect - the area, in image coordinates
+ *****************************************************************************/
+void MainWindow::show_preview(const QImage& preview, const QRect& rect)
 {
-    if(image == NULL)
+    if(!filterWatcher->isRunning() || filterProgress->is_cancelled())
         return;
 
-    double start = omp_get_wtime();
-    QImage* newImage = fft(*image, 1);
-    double end = omp_get_wtime();
+    previewLabel->setPixmap(QPixmap::fromImage(preview));
+    previewLabel->setGeometry(rect.translated(image_display_rect().topLeft()));
+    previewLabel->show();
+    previewLabel->raise();
 
-    set_image(newImage, end - start);
+    ui->statusBar->showMessage("Previewing the visible area, filtering the full image...");
 }
@@ -4,6 +4,36 @@
 #include <QMainWindow>
 #include <QImage>
 #include <QList>
+#include <QFutureWatcher>
+
+#include <functional>
+
+#include "chris_algorithms.h"
+#include "history.h"
+#include "pipeline.h"
+#include "thread_tuner.h"
+
+class QLabel;
+class QProgressBar;
+class QPushButton;
+class QTimer;
+class FilterProgress;
+
+/******************************************************************************
+ * A filter job run by MainWindow::run_filter(): takes the image and the
+ * thread count and returns the new image.
+ *****************************************************************************/
+typedef std::function<QImage* (const QImage& image, int thread_count)> FilterTask;
+
+/******************************************************************************
+ * Struct: FilterResult
+ * Description: What a background filter job hands back to the GUI thread.
+ *****************************************************************************/
+struct FilterResult
+{
+    QImage* image;
+    double time;
+};
 
 namespace Ui {
 class MainWindow;
@@ -58,28 +88,94 @@ private slots:
     void on_actionPosterize_Sequential_triggered();
     void on_actionGaussian_Sequential_triggered();
     void on_actionSet_Thread_Count_triggered();
+    void on_actionCalibrate_Threads_triggered();
     void on_actionFFT_triggered();
     void on_actionFFT_Sequential_triggered();
+    void on_actionGaussian_Blur_triggered();
+    void on_actionBox_Blur_triggered();
+    void on_actionGaussian_Blur_Sequential_triggered();
+    void on_actionBox_Blur_Sequential_triggered();
+    void on_actionLocal_Contrast_triggered();
+    void on_actionAdaptive_Threshold_triggered();
+    void on_actionLocal_Contrast_Sequential_triggered();
+    void on_actionAdaptive_Threshold_Sequential_triggered();
+    void on_actionEqualize_triggered();
+    void on_actionAuto_Levels_triggered();
+    void on_actionCLAHE_triggered();
+    void on_actionEqualize_Sequential_triggered();
+    void on_actionAuto_Levels_Sequential_triggered();
+    void on_actionCLAHE_Sequential_triggered();
+    void on_actionGaussian_Noise_triggered();
+    void on_actionSpeckle_Noise_triggered();
+    void on_actionGaussian_Noise_Sequential_triggered();
+    void on_actionSpeckle_Noise_Sequential_triggered();
+    void on_actionPyramid_Blur_triggered();
+    void on_actionEnhance_Detail_triggered();
+    void on_actionPyramid_Blur_Sequential_triggered();
+    void on_actionEnhance_Detail_Sequential_triggered();
+    void on_actionSet_History_Memory_triggered();
+    void on_actionDump_Trace_triggered();
+
+    void filter_finished();
+    void cancel_filter();
+    void update_progress();
+    void show_preview(const QImage& preview, const QRect& rect);
+    void trim_history();
+    void calibration_finished();
 
 private:
-    void clear_undo_stack();
-    void clear_redo_stack();
-    void clear_stacks();
     void save_image(QString fileName = QString());
     void set_image(QImage *newImage, double time);
     void undo();
     void redo();
     void update_undo_redo_actions();
+    void display_image();
+    void run_gaussian_blur(int threads);
+    void run_box_blur(int threads);
+    void run_local_contrast(int threads);
+    void run_adaptive_threshold(int threads);
+    void run_noise(NoiseType type, int threads);
+    void run_pyramid_blur(int threads);
+    void run_enhance_detail(int threads);
+    void run_filter(FilterTask task, int threads, const PointLut* replay = NULL, bool preview = true);
+    void run_filter(FilterFunction function, int threads, const PointLut* replay = NULL, bool preview = true);
+    QRect image_display_rect() const;
+    QRect preview_rect() const;
+    void set_busy(bool busy);
+    void calibrate_threads();
+    int threads_for(const QString& filter) const;
 
     Ui::MainWindow *ui;
 
+    // The thread count the user set, or 0 for the tuner's pick
     int thread_count;
+    ThreadTuner tuner;
+    QFutureWatcher<void>* calibrationWatcher;
+
+    double blurSigma;
+    int blurRadius;
+    int contrastRadius;
+    int thresholdRadius;
+    double noiseSigma;
+    double pyramidSigma;
+    double detailGain;
 
     QImage* image;
     QString imageFileName;
 
-    QList<QImage*> undoStack;
-    QList<QImage*> redoStack;
+    EditHistory history;
+
+    // The running job as a point operation, for the history to replay
+    PointLut pendingLut;
+    bool pendingIsPointOp;
+
+    QFutureWatcher<FilterResult>* filterWatcher;
+    bool filterResultPending;           // finished or not, filter_finished() has not run
+    FilterProgress* filterProgress;
+    QProgressBar* progressBar;
+    QPushButton* cancelButton;
+    QTimer* progressTimer;
+    QLabel* previewLabel;
 };
 
 #endif // MAINWINDOW_H
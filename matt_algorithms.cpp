@@ -1,45 +1,54 @@
 #include "matt_algorithms.h"
-
-#include <QColor>
-
-#include <cmath>
-
-using namespace std;
+#include "pixel_access.h"
+#include "filter_progress.h"
+#include "convolution.h"
+#include "image_gradient.h"
+#include "simd_kernels.h"
 
 /******************************************************************************
  * Function: grayscale
- * Description: Converts an image to grayscale in parallel.
+ * Description: Converts an image to grayscale in parallel. The channel
+ *  average, the default, runs on the vector kernel for the processor.
  * Parameters:
  *   image - the image to process on
  *   thread_count - the number of threads to use
+ *   params - how the channels are weighed
  * Returns: The grayscale image.
  *****************************************************************************/
-QImage* grayscale(const QImage& image, int thread_count)
+QImage* grayscale(const QImage& image, int thread_count, const GrayscaleParams& params)
 {
-    QImage* newImage = new QImage(image.size(), image.format());
-    QSize size = newImage->size();
+    ScheduleScope schedule("grayscale");
 
-    int r;
+    if(params.method == GrayscaleParams::GRAY_AVERAGE)
+        return map_rows(image, grayscale_row, thread_count);
 
-#   pragma omp parallel for num_threads(thread_count) default(none) \
-        shared(size, image, newImage) private(r)
-    for(r = 0; r < size.height(); r++)
-    {
-        for(int c = 0; c < size.width(); c++)
+    return map_rows(image, [](const QRgb* src, QRgb* dst, int width) {
+        for(int c = 0; c < width; c++)
         {
-            QColor color = QColor(image.pixel(c, r));
+            int gray = qGray(src[c]);
+            dst[c] = qRgb(gray, gray, gray);
+        }
+    }, thread_count);
+}
 
-            int gray = (color.red() + color.green() + color.blue()) / 3.0;
+QImage* grayscale(const QImage& image, int thread_count)
+{
+    return grayscale(image, thread_count, GrayscaleParams());
+}
 
-            color.setRed(gray);
-            color.setGreen(gray);
-            color.setBlue(gray);
+/******************************************************************************
+ * Function: smooth_kernel
+ * Description: The 3x3 mean of the HSV value used by smooth().
+ *****************************************************************************/
+ValueKernel<1> smooth_kernel()
+{
+    ValueKernel<1> kernel;
 
-            newImage->setPixel(c, r, color.rgb());
-        }
-    }
+    for(int r = 0; r < 3; r++)
+        for(int c = 0; c < 3; c++)
+            kernel.mask[r][c] = 1.0 / 9.0;
 
-    return newImage;
+    return kernel;
 }
 
 /******************************************************************************
@@ -48,113 +57,47 @@ QImage* grayscale(const QImage& image, int thread_count)
  * Parameters:
  *   image - the image to process on
  *   thread_count - the number of threads to use
+ *   params - the edge mode
  * Returns: The smoothed image.
  *****************************************************************************/
-QImage* smooth(const QImage& image, int thread_count)
+QImage* smooth(const QImage& image, int thread_count, const KernelParams& params)
 {
-    QImage* newImage = new QImage(image.size(), image.format());
-    QSize size = newImage->size();
-
-    float mask[3][3];
-    int r;
+    ScheduleScope schedule("smooth");
 
-    for(r = 0; r < 3; r++)
-        for(int c = 0; c < 3; c++)
-            mask[r][c] = 1.0 / 9.0;
-
-#   pragma omp parallel for num_threads(thread_count) default(none) \
-        shared(size, image, newImage, mask) private(r)
-    for(r = 0; r < size.height(); r++)
-    {
-        for(int c = 0; c < size.width(); c++)
-        {
-            float value = 0;
-
-            // Convolve
-            for(int i = -1; i <= 1; i++)
-            {
-                for(int j = -1; j <= 1; j++)
-                {
-                    QColor color = QColor(image.pixel((c + j + size.width()) % size.width(), (r + i + size.height()) % size.height()));
-                    value += mask[i+1][j+1] * color.value();
-                }
-            }
-
-            QColor color = QColor(image.pixel(c, r));
-
-            color.setHsv(color.hue(), color.saturation(), (int)value);
-
-            newImage->setPixel(c, r, color.rgb());
-        }
-    }
+    return convolve<1>(image, smooth_kernel(), params.edge, thread_count);
+}
 
-    return newImage;
+QImage* smooth(const QImage& image, int thread_count)
+{
+    return smooth(image, thread_count, KernelParams());
 }
 
 /******************************************************************************
  * Function: gradient
- * Description: Computes the gradient of an image in parallel.
+ * Description: Computes the gradient magnitude of the luma of an image in
+ *  parallel, with separable Sobel or Scharr passes; see image_gradient().
  * Parameters:
  *   image - the image to process on
  *   thread_count - the number of threads to use
+ *   params - the operator, norm and edge mode, Sobel, L2 and wrapping by
+ *            default; with KernelParams, just the edge mode
  * Returns: The gradient image of the given image.
  *****************************************************************************/
-QImage* gradient(const QImage& image, int thread_count)
+QImage* gradient(const QImage& image, int thread_count, const GradientParams& params)
 {
-    QImage* newImage = new QImage(image.size(), image.format());
-    QSize size = newImage->size();
-
-    QImage grayscaleImage = image.convertToFormat(QImage::Format_Mono);
-
-    float xmask[3][3] = {{-1/4.0, -2/4.0, -1/4.0}, {0, 0, 0}, {1/4.0, 2/4.0, 1/4.0}};
-    float ymask[3][3] = {{-1/4.0, 0, 1/4.0}, {-2/4.0, 0, 2/4.0}, {-1/4.0, 0, 1/4.0}};
-    int r;
-
-#   pragma omp parallel for num_threads(thread_count) default(none) \
-        shared(size, grayscaleImage, newImage, xmask, ymask) private(r)
-    for(r = 0; r < size.height(); r++)
-    {
-        for(int c = 0; c < size.width(); c++)
-        {
-            float xvalue = 0;
-            float yvalue = 0;
-            float magnitude;
-
-            // Convolve x mask
-            for(int i = -1; i <= 1; i++)
-            {
-                for(int j = -1; j <= 1; j++)
-                {
-                    QColor color = QColor(grayscaleImage.pixel((c + j + size.width()) % size.width(), (r + i + size.height()) % size.height()));
-                    xvalue += xmask[i+1][j+1] * color.value();
-                }
-            }
-
-            // Convolve y mask
-            for(int i = -1; i <= 1; i++)
-            {
-                for(int j = -1; j <= 1; j++)
-                {
-                    QColor color = QColor(grayscaleImage.pixel((c + j + size.width()) % size.width(), (r + i + size.height()) % size.height()));
-                    yvalue += ymask[i+1][j+1] * color.value();
-                }
-            }
-
-            magnitude = sqrt(xvalue*xvalue + yvalue*yvalue);
-
-            if(magnitude < 0)
-                magnitude = 0;
-            else if(magnitude > 255)
-                magnitude = 255;
+    ScheduleScope schedule("gradient");
 
-            QColor color = QColor(grayscaleImage.pixel(c, r));
-            color.setHsv(color.hue(), color.saturation(), (int)magnitude);
+    return gradient_image(image, params, thread_count);
+}
 
-            newImage->setPixel(c, r, color.rgb());
-        }
-    }
+QImage* gradient(const QImage& image, int thread_count, const KernelParams& params)
+{
+    return gradient(image, thread_count, GradientParams(GRADIENT_SOBEL, GRADIENT_L2, params.edge));
+}
 
-    return newImage;
+QImage* gradient(const QImage& image, int thread_count)
+{
+    return gradient(image, thread_count, GradientParams());
 }
 
 /******************************************************************************
@@ -163,50 +106,46 @@ QImage* gradient(const QImage& image, int thread_count)
  * Parameters:
  *   image - the image to process on
  *   thread_count - the number of threads to use
+ *   params - the edge mode
  * Returns: The laplacian image of the given image.
  *****************************************************************************/
-QImage* laplacian(const QImage& image, int thread_count)
+QImage* laplacian(const QImage& image, int thread_count, const KernelParams& params)
 {
-    QImage* newImage = new QImage(image.size(), image.format());
-    QSize size = newImage->size();
-
-    QImage grayscaleImage = image.convertToFormat(QImage::Format_Mono);
+    ScheduleScope schedule("laplacian");
 
-    float mask[3][3] = {{0, 1, 0}, {1, -4, 1}, {0, 1, 0}};
-    int r;
-
-#   pragma omp parallel for num_threads(thread_count) default(none) \
-        shared(size, grayscaleImage, newImage, mask) private(r)
-    for(r = 0; r < size.height(); r++)
+    QImage grayscaleImage;
     {
-        for(int c = 0; c < size.width(); c++)
-        {
-            float value = 0;
+        TraceScope trace("convert to Mono");
+        grayscaleImage = image.convertToFormat(QImage::Format_Mono);
+    }
 
-            // Convolve
-            for(int i = -1; i <= 1; i++)
-            {
-                for(int j = -1; j <= 1; j++)
-                {
-                    QColor color = QColor(grayscaleImage.pixel((c + j + size.width()) % size.width(), (r + i + size.height()) % size.height()));
-                    value += mask[i+1][j+1] * color.value();
-                }
-            }
+    ValueKernel<1> kernel = {{{0, 1, 0}, {1, -4, 1}, {0, 1, 0}}};
 
-            if(value < 0)
-                value = 0;
-            else if(value > 255)
-                value = 255;
+    return convolve<1>(grayscaleImage, kernel, params.edge, thread_count);
+}
 
-            QColor color = QColor(grayscaleImage.pixel(c, r));
+QImage* laplacian(const QImage& image, int thread_count)
+{
+    return laplacian(image, thread_count, KernelParams());
+}
 
-            color.setHsv(color.hue(), color.saturation(), (int)value);
+/******************************************************************************
+ * Function: gaussian_kernel
+ * Description: The 5x5 Gaussian of the HSV value used by gaussian().
+ *****************************************************************************/
+ValueKernel<2> gaussian_kernel()
+{
+    ValueKernel<2> kernel = {{{1, 4, 7, 4, 1},
+                              {4, 16, 26, 16, 4},
+                              {7, 26, 41, 26, 7},
+                              {4, 16, 26, 16, 4},
+                              {1, 4, 7, 4, 1}}};
 
-            newImage->setPixel(c, r, color.rgb());
-        }
-    }
+    for(int i = 0; i < 5; i++)
+        for(int j = 0; j < 5; j++)
+            kernel.mask[i][j] /= 273.0;
 
-    return newImage;
+    return kernel;
 }
 
 /******************************************************************************
@@ -215,55 +154,17 @@ QImage* laplacian(const QImage& image, int thread_count)
  * Parameters:
  *   image - the image to process on
  *   thread_count - the number of threads to use
+ *   params - the edge mode
  * Returns: The smoothed image.
  *****************************************************************************/
-QImage* gaussian(const QImage& image, int thread_count)
+QImage* gaussian(const QImage& image, int thread_count, const KernelParams& params)
 {
-    QImage* newImage = new QImage(image.size(), image.format());
-    QSize size = newImage->size();
-
-    float mask[5][5] = {{1, 4, 7, 4, 1},
-                        {4, 16, 26, 16, 4},
-                        {7, 26, 41, 26, 7},
-                        {4, 16, 26, 16, 4},
-                        {1, 4, 7, 4, 1}};
-
-    for(int i = 0; i < 5; i++)
-        for(int j = 0; j < 5; j++)
-            mask[i][j] /= 273.0;
-
-    int r;
-
-#   pragma omp parallel for num_threads(thread_count) default(none) \
-        shared(size, image, newImage, mask) private(r)
-    for(r = 0; r < size.height(); r++)
-    {
-        for(int c = 0; c < size.width(); c++)
-        {
-            float value = 0;
-
-            // Convolve
-            for(int i = -2; i <= 2; i++)
-            {
-                for(int j = -2; j <= 2; j++)
-                {
-                    QColor color = QColor(image.pixel((c + j + size.width()) % size.width(), (r + i + size.height()) % size.height()));
-                    value += mask[i+2][j+2] * color.value();
-                }
-            }
-
-            if(value < 0)
-                value = 0;
-            else if(value > 255)
-                value = 255;
-
-            QColor color = QColor(image.pixel(c, r));
-
-            color.setHsv(color.hue(), color.saturation(), (int)value);
+    ScheduleScope schedule("gaussian");
 
-            newImage->setPixel(c, r, color.rgb());
-        }
-    }
+    return convolve<2>(image, gaussian_kernel(), params.edge, thread_count);
+}
 
-    return newImage;
+QImage* gaussian(const QImage& image, int thread_count)
+{
+    return gaussian(image, thread_count, KernelParams());
 }
@@ -3,14 +3,60 @@
 
 #include <QImage>
 
+#include "convolution.h"
+#include "image_gradient.h"
+
+/******************************************************************************
+ * Struct: GrayscaleParams
+ * Description: How grayscale() weighs the channels. GRAY_AVERAGE, the mean
+ *  of the three, runs on the vector kernels; GRAY_LUMA uses the perceptual
+ *  weights of qGray().
+ *****************************************************************************/
+struct GrayscaleParams
+{
+    enum Method { GRAY_AVERAGE, GRAY_LUMA };
+
+    explicit GrayscaleParams(Method method = GRAY_AVERAGE) :
+        method(method)
+    {
+    }
+
+    Method method;
+};
+
+/******************************************************************************
+ * Struct: KernelParams
+ * Description: How the kernel filters sample past the edge of the image.
+ *  The defaults are the ones each filter has always used.
+ *****************************************************************************/
+struct KernelParams
+{
+    explicit KernelParams(EdgeMode edge = EDGE_WRAP) :
+        edge(edge)
+    {
+    }
+
+    EdgeMode edge;
+};
+
+ValueKernel<1> smooth_kernel();
+
+ValueKernel<2> gaussian_kernel();
+
 QImage* grayscale(const QImage& image, int thread_count);
+QImage* grayscale(const QImage& image, int thread_count, const GrayscaleParams& params);
 
 QImage* smooth(const QImage& image, int thread_count);
+QImage* smooth(const QImage& image, int thread_count, const KernelParams& params);
 
 QImage* gradient(const QImage& image, int thread_count);
+QImage* gradient(const QImage& image, int thread_count, const KernelParams& params);
+QImage* gradient(const QImage& image, int thread_count, const GradientParams& params);
 
 QImage* laplacian(const QImage& image, int thread_count);
+QImage* laplacian(const QImage& image, int thread_count, const KernelParams& params);
 
 QImage* gaussian(const QImage& image, int thread_count);
+QImage* gaussian(const QImage& image, int thread_count, const KernelParams& params);
 
 #endif // IP_ALGORITHMS_H
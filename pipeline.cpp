@@ -0,0 +1,508 @@
+#include "pipeline.h"
+#include "pixel_access.h"
+#include "filter_progress.h"
+
+#include "streaming.h"
+
+#include <algorithm>
+
+// Strips are sized so the rows of one strip stay in a core's cache
+#define PIPELINE_STRIP_BYTES (256 * 1024)
+
+Pipeline::Pipeline()
+{
+}
+
+Pipeline::~Pipeline()
+{
+    for(int i = 0; i < steps.size(); i++)
+        delete steps[i].stage;
+}
+
+/******************************************************************************
+ * Function: Pipeline::add_point
+ * Description: Appends a point operation.
+ *****************************************************************************/
+void Pipeline::add_point(const PointLut& lut)
+{
+    Step step;
+    step.kind = Step::POINT;
+    step.lut = lut;
+    step.stage = NULL;
+    step.function = NULL;
+
+    steps << step;
+}
+
+/******************************************************************************
+ * Function: Pipeline::add_row_stage
+ * Description: Appends a row step. The pipeline takes ownership of it.
+ *****************************************************************************/
+void Pipeline::add_row_stage(RowStage* stage)
+{
+    Step step;
+    step.kind = Step::ROW;
+    step.stage = stage;
+    step.function = NULL;
+
+    steps << step;
+}
+
+/******************************************************************************
+ * Function: Pipeline::add_filter
+ * Description: Appends a filter that can only run on a whole image. It ends
+ *  the fused run before it.
+ *****************************************************************************/
+void Pipeline::add_filter(FilterFunction function)
+{
+    Step step;
+    step.kind = Step::IMAGE;
+    step.stage = NULL;
+    step.function = function;
+
+    steps << step;
+}
+
+/******************************************************************************
+ * Function: Pipeline::is_streamable
+ * Description: Whether every step is a point or row step, so the chain can
+ *  run over an image a strip at a time with run_stream().
+ *****************************************************************************/
+bool Pipeline::is_streamable() const
+{
+    for(int i = 0; i < steps.size(); i++)
+        if(steps[i].kind == Step::IMAGE)
+            return false;
+
+    return true;
+}
+
+/******************************************************************************
+ * Function: Pipeline::run
+ * Description: Runs the chain over an image. Runs of point and row steps are
+ *  fused into strip passes; whole image filters run between them.
+ * Parameters:
+ *   image - the image to process on
+ *   thread_count - the number of threads to use
+ * Returns: The new image.
+ *****************************************************************************/
+QImage* Pipeline::run(const QImage& image, int thread_count) const
+{
+    QImage current = to_argb32(image);
+    QVector<const Step*> fused;
+    FilterProgress* progress = FilterProgress::current();
+
+    for(int i = 0; i < steps.size() && !progress_cancelled(progress); i++)
+    {
+        if(steps[i].kind != Step::IMAGE)
+        {
+            fused << &steps[i];
+            continue;
+        }
+
+        if(!fused.isEmpty())
+        {
+            current = run_fused(current, fused, thread_count);
+            fused.clear();
+        }
+
+        QImage* newImage = steps[i].function(current, thread_count);
+        current = *newImage;
+        delete newImage;
+    }
+
+    if(!fused.isEmpty())
+        current = run_fused(current, fused, thread_count);
+
+    return new QImage(current);
+}
+
+/******************************************************************************
+ * Function: Pipeline::fuse
+ * Description: Splits a run of point and row steps into the table applied to
+ *  the source rows, the row steps, and the table applied after each of them.
+ *****************************************************************************/
+Pipeline::FusedChain Pipeline::fuse(const QVector<const Step*>& fused)
+{
+    FusedChain chain;
+    chain.hasLead = false;
+
+    for(int i = 0; i < fused.size(); i++)
+    {
+        if(fused[i]->kind == Step::ROW)
+        {
+            chain.stages << fused[i]->stage;
+            chain.after << PointLut();
+            chain.hasAfter << false;
+        }
+        else if(chain.stages.isEmpty())
+        {
+            chain.lead = chain.hasLead ? chain.lead.then(fused[i]->lut) : fused[i]->lut;
+            chain.hasLead = true;
+        }
+        else
+        {
+            int k = chain.stages.size() - 1;
+
+            chain.after[k] = chain.hasAfter[k] ? chain.after[k].then(fused[i]->lut) : fused[i]->lut;
+            chain.hasAfter[k] = true;
+        }
+    }
+
+    return chain;
+}
+
+int Pipeline::FusedChain::halo() const
+{
+    int halo = 0;
+    for(int k = 0; k < stages.size(); k++)
+        halo += stages[k]->radius();
+
+    return halo;
+}
+
+/******************************************************************************
+ * Function: Pipeline::collect_rows
+ * Description: Works backwards through the row steps to find which rows each
+ *  one has to produce for output rows first to last - 1: the rows the next
+ *  step reads, through its edge mode, around the rows it produces.
+ * Parameters:
+ *   stages - the row steps
+ *   first, last - the output rows
+ *   height - the image height
+ *   mark, stamp - scratch for removing duplicates, height entries
+ *   needed - receives the rows of each step, sorted; needed[k] are the rows
+ *    step k produces and needed[0] the source rows
+ *****************************************************************************/
+void Pipeline::collect_rows(const QVector<const RowStage*>& stages, int first, int last, int height,
+                            int* mark, int& stamp, QVector<QVector<int> >& needed)
+{
+    int count = stages.size();
+
+    needed[count].clear();
+    for(int r = first; r < last; r++)
+        needed[count] << r;
+
+    for(int k = count; k > 0; k--)
+    {
+        const RowStage* stage = stages[k - 1];
+        int radius = stage->radius();
+        EdgeMode edge = stage->edge();
+
+        needed[k - 1].clear();
+        stamp++;
+
+        for(int i = 0; i < needed[k].size(); i++)
+        {
+            for(int d = -radius; d <= radius; d++)
+            {
+                int row = edge_index(needed[k][i] + d, height, edge);
+
+                if(mark[row] != stamp)
+                {
+                    mark[row] = stamp;
+                    needed[k - 1] << row;
+                }
+            }
+        }
+
+        std::sort(needed[k - 1].begin(), needed[k - 1].end());
+    }
+}
+
+/******************************************************************************
+ * Function: Pipeline::run_fused
+ * Description: Runs a run of point and row steps as one pass. Point steps
+ *  before the first row step become one table applied as the source rows are
+ *  read; point steps after a row step become one table applied to each row
+ *  that step produces.
+ *
+ *  Each thread takes a strip of output rows at a time, finds the rows every
+ *  step has to produce with collect_rows(), and runs the steps forwards,
+ *  each writing only those rows into the buffer the step before last used,
+ *  and the last step writing straight into the output image.
+ * Parameters:
+ *   image - the image to process on, in Format_ARGB32
+ *   fused - the steps, in order
+ *   thread_count - the number of threads to use
+ * Returns: The new image.
+ *****************************************************************************/
+QImage Pipeline::run_fused(const QImage& image, const QVector<const Step*>& fused, int thread_count) const
+{
+    FusedChain chain = fuse(fused);
+    const QVector<const RowStage*>& stages = chain.stages;
+    const QVector<bool>& hasAfter = chain.hasAfter;
+    bool hasLead = chain.hasLead;
+
+    if(stages.isEmpty())
+    {
+        QImage* newImage = apply_lut(image, chain.lead, thread_count);
+        QImage result = *newImage;
+        delete newImage;
+        return result;
+    }
+
+    QImage result(image.size(), QImage::Format_ARGB32);
+    QSize size = result.size();
+    int width = size.width();
+    int height = size.height();
+    int count = stages.size();
+
+    int stripRows = qMax(1, PIPELINE_STRIP_BYTES / qMax(1, width * 4));
+    int strips = (height + stripRows - 1) / stripRows;
+    int bufferRows = qMin(height, stripRows + 2 * chain.halo());
+
+    PackedLut leadTable(chain.lead);
+    QVector<PackedLut> afterTables;
+    for(int k = 0; k < count; k++)
+        afterTables << PackedLut(chain.after[k]);
+
+    PipelineRows source(reinterpret_cast<const QRgb*>(image.constBits()), image.bytesPerLine() / 4, NULL);
+    Scanlines out(result);
+
+    FilterProgress* progress = FilterProgress::current();
+    progress_add_work(progress, strips);
+
+#   pragma omp parallel num_threads(thread_count) default(none) \
+        shared(progress, stages, hasLead, hasAfter, leadTable, afterTables, source, out, \
+               size, width, height, count, stripRows, strips, bufferRows) copyin(traceOperation)
+    {
+        //the ping-pong strip buffers and where each image row sits in them
+        QRgb* buffer[2];
+        int* rowIndex[2];
+        for(int b = 0; b < 2; b++)
+        {
+            buffer[b] = new QRgb[(size_t)bufferRows * width];
+            rowIndex[b] = new int[height];
+        }
+
+        //marks the rows already collected for a step
+        int* mark = new int[height];
+        int stamp = 0;
+        for(int r = 0; r < height; r++)
+            mark[r] = -1;
+
+        //needed[k] - the rows step k has to produce, needed[0] the source rows
+        QVector<QVector<int> > needed(count + 1);
+
+        TraceScope trace("fused strips", "strips");
+
+#       pragma omp for schedule(dynamic) nowait
+        for(int s = 0; s < strips; s++)
+        {
+            if(progress_cancelled(progress))
+                continue;
+
+            int first = s * stripRows;
+            int last = qMin(first + stripRows, height);
+
+            collect_rows(stages, first, last, height, mark, stamp, needed);
+
+            PipelineRows rows = source;
+            int current = 0;
+
+            if(hasLead)
+            {
+                for(int i = 0; i < needed[0].size(); i++)
+                {
+                    int row = needed[0][i];
+                    rowIndex[0][row] = i;
+                    leadTable.apply(source[row], buffer[0] + (size_t)i * width, width);
+                }
+
+                rows = PipelineRows(buffer[0], width, rowIndex[0]);
+                current = 1;
+            }
+
+            for(int k = 1; k <= count; k++)
+            {
+                const RowStage* stage = stages[k - 1];
+                bool output = (k == count);
+
+                for(int i = 0; i < needed[k].size(); i++)
+                {
+                    int row = needed[k][i];
+                    QRgb* dst = output ? out[row] : buffer[current] + (size_t)i * width;
+
+                    stage->process_row(rows, dst, row, size);
+
+                    if(hasAfter[k - 1])
+                        afterTables[k - 1].apply(dst, dst, width);
+
+                    if(!output)
+                        rowIndex[current][row] = i;
+                }
+
+                rows = PipelineRows(buffer[current], width, rowIndex[current]);
+                current ^= 1;
+            }
+
+            trace.add_count(1);
+            progress_advance(progress);
+        }
+
+        for(int b = 0; b < 2; b++)
+        {
+            delete[] buffer[b];
+            delete[] rowIndex[b];
+        }
+        delete[] mark;
+    }
+
+    return result;
+}
+
+/******************************************************************************
+ * Function: Pipeline::run_stream
+ * Description: Runs the chain from a row reader to a row writer one strip of
+ *  output rows at a time, so only a strip and its halo is ever in memory.
+ *  Strips are read and written in order; the rows of each step within a
+ *  strip are processed in parallel. The chain must be streamable.
+ * Parameters:
+ *   reader - the source image
+ *   writer - receives the result rows, top to bottom
+ *   strip_rows - output rows per strip, 0 to size strips by STREAM_STRIP_BYTES
+ *   thread_count - the number of threads to use
+ * Returns: false if reading or writing failed.
+ *****************************************************************************/
+bool Pipeline::run_stream(ImageRowReader& reader, ImageRowWriter& writer, int strip_rows, int thread_count) const
+{
+    QVector<const Step*> fused;
+    for(int i = 0; i < steps.size(); i++)
+        fused << &steps[i];
+
+    FusedChain chain = fuse(fused);
+    const QVector<const RowStage*>& stages = chain.stages;
+    const QVector<bool>& hasAfter = chain.hasAfter;
+    bool hasLead = chain.hasLead;
+
+    QSize size = reader.size();
+    int width = size.width();
+    int height = size.height();
+    int count = stages.size();
+
+    //no rows, no strips to divide them into
+    if(height <= 0)
+        return true;
+
+    int stripRows = strip_rows > 0 ? strip_rows : qMax(1, STREAM_STRIP_BYTES / qMax(1, width * 4));
+    stripRows = qMin(stripRows, height);
+    int strips = (height + stripRows - 1) / stripRows;
+    int bufferRows = qMin(height, stripRows + 2 * chain.halo());
+
+    PackedLut leadTable(chain.lead);
+    QVector<PackedLut> afterTables;
+    for(int k = 0; k < count; k++)
+        afterTables << PackedLut(chain.after[k]);
+
+    //buffer[0] starts with the source rows, then the steps ping-pong
+    QRgb* buffer[2];
+    int* rowIndex[2];
+    for(int b = 0; b < 2; b++)
+    {
+        buffer[b] = new QRgb[(size_t)bufferRows * width];
+        rowIndex[b] = new int[height];
+    }
+    QRgb* output = count > 0 ? new QRgb[(size_t)stripRows * width] : buffer[0];
+
+    int* mark = new int[height];
+    int stamp = 0;
+    for(int r = 0; r < height; r++)
+        mark[r] = -1;
+
+    QVector<QVector<int> > needed(count + 1);
+
+    FilterProgress* progress = FilterProgress::current();
+    progress_add_work(progress, strips);
+
+    bool ok = true;
+
+    for(int s = 0; s < strips && ok && !progress_cancelled(progress); s++)
+    {
+        int first = s * stripRows;
+        int last = qMin(first + stripRows, height);
+
+        collect_rows(stages, first, last, height, mark, stamp, needed);
+
+        //the source rows are sorted, so each run of consecutive rows is one read
+        const QVector<int>& sourceRows = needed[0];
+        int rowCount = sourceRows.size();
+
+        for(int i = 0; i < rowCount && ok; )
+        {
+            int run = 1;
+            while(i + run < rowCount && sourceRows[i + run] == sourceRows[i] + run)
+                run++;
+
+            ok = reader.read_rows(sourceRows[i], run, buffer[0] + (size_t)i * width);
+
+            for(int j = i; j < i + run; j++)
+                rowIndex[0][sourceRows[j]] = j;
+
+            i += run;
+        }
+
+        if(!ok)
+            break;
+
+        QRgb* source = buffer[0];
+
+        if(hasLead)
+        {
+#           pragma omp parallel for num_threads(thread_count) default(none) \
+                shared(leadTable, source, width, rowCount)
+            for(int i = 0; i < rowCount; i++)
+                leadTable.apply(source + (size_t)i * width, source + (size_t)i * width, width);
+        }
+
+        PipelineRows rows(buffer[0], width, rowIndex[0]);
+        int current = 1;
+
+        for(int k = 1; k <= count; k++)
+        {
+            const RowStage* stage = stages[k - 1];
+            const QVector<int>& produced = needed[k];
+            bool lastStep = (k == count);
+            bool after = hasAfter[k - 1];
+            const PackedLut& afterTable = afterTables[k - 1];
+            QRgb* target = lastStep ? output : buffer[current];
+            int* targetIndex = rowIndex[current];
+            int producedCount = produced.size();
+
+#           pragma omp parallel for num_threads(thread_count) default(none) \
+                shared(stage, produced, lastStep, after, afterTable, target, targetIndex, \
+                       producedCount, rows, size, width, first)
+            for(int i = 0; i < producedCount; i++)
+            {
+                int row = produced[i];
+                QRgb* dst = target + (size_t)(lastStep ? row - first : i) * width;
+
+                stage->process_row(rows, dst, row, size);
+
+                if(after)
+                    afterTable.apply(dst, dst, width);
+
+                if(!lastStep)
+                    targetIndex[row] = i;
+            }
+
+            rows = PipelineRows(buffer[current], width, rowIndex[current]);
+            current ^= 1;
+        }
+
+        ok = writer.write_rows(output, last - first);
+
+        progress_advance(progress);
+    }
+
+    if(output != buffer[0])
+        delete[] output;
+    for(int b = 0; b < 2; b++)
+    {
+        delete[] buffer[b];
+        delete[] rowIndex[b];
+    }
+    delete[] mark;
+
+    return ok;
+}
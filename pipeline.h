@@ -0,0 +1,192 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <QImage>
+#include <QVector>
+
+#include "convolution.h"
+#include "point_ops.h"
+
+class ImageRowReader;
+class ImageRowWriter;
+
+typedef QImage* (*FilterFunction)(const QImage& image, int thread_count);
+
+/******************************************************************************
+ * Fused filter chains.
+ *
+ * A Pipeline is an ordered list of steps run over an image without building
+ * a full size image per step. There are three kinds of step:
+ *
+ *   point steps   - a PointLut; adjacent point steps compose into one table,
+ *                   which is applied to each row as it is produced
+ *   row steps     - a RowStage, which computes one output row from the rows
+ *                   within its radius (per pixel operations have radius 0,
+ *                   the 3x3 and 5x5 kernels radius 1 and 2)
+ *   image steps   - any other filter, called on the whole image
+ *
+ * Consecutive point and row steps are fused: the output is cut into strips
+ * of rows sized to stay in cache, and each thread runs the whole chain over
+ * one strip at a time, computing for every stage only the rows the next stage
+ * needs (the strip plus the stage radii as a halo). The stages ping-pong
+ * between two per-thread strip buffers, so a chain of N steps touches the
+ * full image once instead of N times, and allocates one output image. The
+ * result is identical to running the filters one after the other.
+ *
+ * A chain of only point and row steps can also be streamed: run_stream()
+ * reads the source and writes the result a strip at a time, for images that
+ * do not fit in memory.
+ *****************************************************************************/
+
+/******************************************************************************
+ * Class: PipelineRows
+ * Description: Row access to either an image or a strip buffer holding only
+ *  some of the rows of an image, indexed by the row number in the image.
+ *****************************************************************************/
+class PipelineRows
+{
+public:
+    PipelineRows(const QRgb* base, int stride, const int* rowIndex) :
+        base(base),
+        stride(stride),
+        rowIndex(rowIndex)
+    {
+    }
+
+    const QRgb* operator[](int r) const
+    {
+        return base + (qptrdiff)(rowIndex != NULL ? rowIndex[r] : r) * stride;
+    }
+
+private:
+    const QRgb* base;
+    int stride;             // in pixels
+    const int* rowIndex;    // image row -> buffer row, NULL for a whole image
+};
+
+/******************************************************************************
+ * Class: RowStage
+ * Description: A step that computes each output row from the input rows
+ *  within radius() of it, mapping rows outside the image with edge().
+ *****************************************************************************/
+class RowStage
+{
+public:
+    virtual ~RowStage() {}
+
+    virtual int radius() const = 0;
+    virtual EdgeMode edge() const = 0;
+    virtual void process_row(const PipelineRows& in, QRgb* dst, int r, const QSize& size) const = 0;
+};
+
+/******************************************************************************
+ * Class: StencilStage
+ * Description: A convolution engine kernel as a row step.
+ *****************************************************************************/
+template<int Radius, class Layout>
+class StencilStage : public RowStage
+{
+public:
+    StencilStage(const Layout& layout, EdgeMode edge) :
+        layout(layout),
+        edgeMode(edge)
+    {
+    }
+
+    int radius() const { return Radius; }
+    EdgeMode edge() const { return edgeMode; }
+
+    void process_row(const PipelineRows& in, QRgb* dst, int r, const QSize& size) const
+    {
+        convolve_row<Radius>(layout, edgeMode, in, dst, r, size);
+    }
+
+private:
+    Layout layout;
+    EdgeMode edgeMode;
+};
+
+typedef void (*RowKernel)(const QRgb* src, QRgb* dst, int width);
+
+/******************************************************************************
+ * Class: RowKernelStage
+ * Description: A per pixel operation that is not a per channel table (it
+ *  mixes the channels), given as a row kernel, as a row step of radius 0.
+ *****************************************************************************/
+class RowKernelStage : public RowStage
+{
+public:
+    explicit RowKernelStage(RowKernel kernel) :
+        kernel(kernel)
+    {
+    }
+
+    int radius() const { return 0; }
+    EdgeMode edge() const { return EDGE_CLAMP; }
+
+    void process_row(const PipelineRows& in, QRgb* dst, int r, const QSize& size) const
+    {
+        kernel(in[r], dst, size.width());
+    }
+
+private:
+    RowKernel kernel;
+};
+
+/******************************************************************************
+ * Class: Pipeline
+ * Description: An ordered chain of filter steps, run with fusion by run().
+ *  The pipeline owns its row stages. run() does not modify the pipeline, so
+ *  one pipeline can be run on several images at once.
+ *****************************************************************************/
+class Pipeline
+{
+public:
+    Pipeline();
+    ~Pipeline();
+
+    void add_point(const PointLut& lut);
+    void add_row_stage(RowStage* stage);
+    void add_filter(FilterFunction function);
+
+    bool is_empty() const { return steps.isEmpty(); }
+    bool is_streamable() const;
+
+    QImage* run(const QImage& image, int thread_count) const;
+    bool run_stream(ImageRowReader& reader, ImageRowWriter& writer, int strip_rows, int thread_count) const;
+
+private:
+    struct Step
+    {
+        enum Kind { POINT, ROW, IMAGE };
+
+        Kind kind;
+        PointLut lut;
+        RowStage* stage;
+        FilterFunction function;
+    };
+
+    struct FusedChain
+    {
+        PointLut lead;                      // applied to the source rows
+        bool hasLead;
+        QVector<const RowStage*> stages;
+        QVector<PointLut> after;            // applied to each stage's rows
+        QVector<bool> hasAfter;
+
+        int halo() const;
+    };
+
+    static FusedChain fuse(const QVector<const Step*>& fused);
+    static void collect_rows(const QVector<const RowStage*>& stages, int first, int last, int height,
+                             int* mark, int& stamp, QVector<QVector<int> >& needed);
+
+    QImage run_fused(const QImage& image, const QVector<const Step*>& fused, int thread_count) const;
+
+    QVector<Step> steps;
+
+    Pipeline(const Pipeline&);
+    Pipeline& operator=(const Pipeline&);
+};
+
+#endif // PIPELINE_H
@@ -0,0 +1,184 @@
+#ifndef PIXEL_ACCESS_H
+#define PIXEL_ACCESS_H
+
+#include <QImage>
+
+#include "buffer_pool.h"
+#include "thread_policy.h"
+#include "trace.h"
+
+/******************************************************************************
+ * Raw buffer access shared by the filters. Every filter converts its input to
+ * Format_ARGB32 once with to_argb32(), allocates its output with
+ * new_output_image(), and then walks both with ConstScanlines/Scanlines
+ * instead of QImage::pixel()/setPixel(). Rows are arrays of packed QRgb
+ * values, so the usual qRed()/qGreen()/qBlue()/qRgb() helpers apply.
+ *
+ * The row pointers are resolved from bits()/constBits() when the accessor is
+ * constructed, so build the accessors before entering a parallel region;
+ * calling QImage::scanLine() from inside the threads would detach the image
+ * from each of them.
+ *****************************************************************************/
+
+/******************************************************************************
+ * Function: to_argb32
+ * Description: Returns the image in Format_ARGB32. Images that are already in
+ *  that format are returned as a shallow copy, so no pixels are touched.
+ * Parameters:
+ *   image - the image to normalize
+ * Returns: The image in Format_ARGB32.
+ *****************************************************************************/
+inline QImage to_argb32(const QImage& image)
+{
+    if(image.format() == QImage::Format_ARGB32)
+        return image;
+
+    TraceScope trace("convert to ARGB32");
+    return image.convertToFormat(QImage::Format_ARGB32);
+}
+
+/******************************************************************************
+ * Function: new_output_image
+ * Description: Allocates the Format_ARGB32 result image for a filter from the
+ *  buffer pool, with its pages first touched by the threads that will write
+ *  them.
+ * Parameters:
+ *   size - the size of the result
+ *   thread_count - the number of threads the filter will use
+ * Returns: The new, uninitialized image.
+ *****************************************************************************/
+inline QImage* new_output_image(const QSize& size, int thread_count)
+{
+    TraceScope trace("allocate");
+
+    QImage* image = new QImage(pool_image(size));
+    first_touch(*image, thread_count);
+
+    return image;
+}
+
+/******************************************************************************
+ * Class: ConstScanlines
+ * Description: Read only row access to a Format_ARGB32 image, used as
+ *  pixels[r][c].
+ *****************************************************************************/
+class ConstScanlines
+{
+public:
+    explicit ConstScanlines(const QImage& image) :
+        bits(image.constBits()),
+        stride(image.bytesPerLine())
+    {
+    }
+
+    const QRgb* operator[](int r) const
+    {
+        return reinterpret_cast<const QRgb*>(bits + (qptrdiff)r * stride);
+    }
+
+private:
+    const uchar* bits;
+    int stride;
+};
+
+/******************************************************************************
+ * Class: Scanlines
+ * Description: Writable row access to a Format_ARGB32 image, used as
+ *  pixels[r][c]. Constructing it detaches the image once, up front.
+ *****************************************************************************/
+class Scanlines
+{
+public:
+    explicit Scanlines(QImage& image) :
+        bits(image.bits()),
+        stride(image.bytesPerLine())
+    {
+    }
+
+    QRgb* operator[](int r) const
+    {
+        return reinterpret_cast<QRgb*>(bits + (qptrdiff)r * stride);
+    }
+
+private:
+    uchar* bits;
+    int stride;
+};
+
+enum EdgeMode
+{
+    EDGE_WRAP,      // coordinates wrap around to the other side
+    EDGE_CLAMP,     // coordinates stick to the nearest edge pixel
+    EDGE_MIRROR     // coordinates reflect about the edge pixel
+};
+
+/******************************************************************************
+ * Function: edge_index
+ * Description: Maps a coordinate that may fall outside [0, n) back into the
+ *  image according to the edge mode.
+ * Parameters:
+ *   x - the coordinate
+ *   n - the number of pixels along that axis
+ *   edge - the edge mode
+ * Returns: The coordinate to sample.
+ *****************************************************************************/
+inline int edge_index(int x, int n, EdgeMode edge)
+{
+    if(x >= 0 && x < n)
+        return x;
+
+    switch(edge)
+    {
+    case EDGE_WRAP:
+        x %= n;
+        return x < 0 ? x + n : x;
+
+    case EDGE_CLAMP:
+        return x < 0 ? 0 : n - 1;
+
+    case EDGE_MIRROR:
+    default:
+        if(n == 1)
+            return 0;
+
+        x %= 2 * n - 2;
+        if(x < 0)
+            x += 2 * n - 2;
+        return x < n ? x : 2 * n - 2 - x;
+    }
+}
+
+/******************************************************************************
+ * Function: pixel_value
+ * Description: The HSV value of a pixel, the same number QColor::value()
+ *  returns, without the HSV conversion.
+ *****************************************************************************/
+inline int pixel_value(QRgb pixel)
+{
+    return qMax(qMax(qRed(pixel), qGreen(pixel)), qBlue(pixel));
+}
+
+/******************************************************************************
+ * Function: with_value
+ * Description: Replaces the HSV value of a pixel while keeping its hue and
+ *  saturation, like QColor::setHsv(hue(), saturation(), value) does, by
+ *  scaling the channels so the largest becomes value. Achromatic black has
+ *  no hue, so it becomes the gray of that value. The result is opaque.
+ * Parameters:
+ *   pixel - the pixel to take the hue and saturation from
+ *   value - the new value, 0 - 255
+ * Returns: The new pixel.
+ *****************************************************************************/
+inline QRgb with_value(QRgb pixel, int value)
+{
+    int old = pixel_value(pixel);
+
+    if(old == 0)
+        return qRgb(value, value, value);
+
+    return qRgb((qRed(pixel) * value + old / 2) / old,
+                (qGreen(pixel) * value + old / 2) / old,
+                (qBlue(pixel) * value + old / 2) / old);
+}
+
+#endif // PIXEL_ACCESS_H
@@ -0,0 +1,311 @@
+#ifndef PLANAR_IMAGE_H
+#define PLANAR_IMAGE_H
+
+#include <QImage>
+
+#include "buffer_pool.h"
+#include "pixel_access.h"
+#include "trace.h"
+
+// Alignment of every plane row in bytes: a cache line, and a whole vector
+// register up to AVX-512
+#define PLANAR_ALIGNMENT 64
+
+/******************************************************************************
+ * Planar images for the compute heavy filters.
+ *
+ * A QImage stores each pixel as one packed QRgb, so a filter that works on
+ * one channel, or on the HSV value, unpacks every pixel again at every tap.
+ * A PlanarImage holds the channels apart instead, one contiguous float or
+ * uchar plane each, with every row starting on a PLANAR_ALIGNMENT boundary,
+ * so a loop along a row reads consecutive values the compiler can vectorize.
+ *
+ * A plane can be given a border of extra rows and columns on every side,
+ * filled from the image with an edge mode by fill_border(). A stencil of that
+ * radius then reads outside the image without any edge handling.
+ *
+ * Images are converted into planes with to_planar() and back with
+ * from_planar() once, at the start and end of a filter or of a chain of
+ * filters working on the planes, so the values in between keep their float
+ * precision instead of being rounded to 8 bits at every step.
+ *****************************************************************************/
+
+enum PlanarChannels
+{
+    PLANAR_VALUE,       // one plane, the HSV value
+    PLANAR_LUMA,        // one plane, the luma of qGray()
+    PLANAR_RGB          // three planes, red, green and blue
+};
+
+inline int planar_plane_count(PlanarChannels channels)
+{
+    return channels == PLANAR_RGB ? 3 : 1;
+}
+
+/******************************************************************************
+ * Class: PlanarImage
+ * Description: One or more aligned, padded planes of T (float or uchar) of
+ *  the same size. row(p, r)[c] is the value at column c of row r of plane p,
+ *  with r and c from -border() up to the height or width plus border().
+ *****************************************************************************/
+template<class T>
+class PlanarImage
+{
+public:
+    PlanarImage(int width, int height, int planes, int border = 0);
+    ~PlanarImage() { pool_free(data); }
+
+    int width() const { return imageWidth; }
+    int height() const { return imageHeight; }
+    int planes() const { return planeCount; }
+    int border() const { return borderSize; }
+    int stride() const { return rowStride; }
+
+    T* row(int plane, int r)
+    {
+        return origin + plane * planeSize + (qptrdiff)r * rowStride;
+    }
+
+    const T* row(int plane, int r) const
+    {
+        return origin + plane * planeSize + (qptrdiff)r * rowStride;
+    }
+
+    void fill_border(EdgeMode edge, int thread_count);
+
+private:
+    T* data;
+    T* origin;              // column 0 of row 0 of the first plane, aligned
+    qptrdiff planeSize;     // in elements, a whole number of rows
+    int rowStride;          // in elements, a multiple of the alignment
+    int imageWidth;
+    int imageHeight;
+    int planeCount;
+    int borderSize;
+
+    PlanarImage(const PlanarImage&);
+    PlanarImage& operator=(const PlanarImage&);
+};
+
+template<class T>
+PlanarImage<T>::PlanarImage(int width, int height, int planes, int border) :
+    imageWidth(width),
+    imageHeight(height),
+    planeCount(planes),
+    borderSize(border)
+{
+    //the left border is rounded up so column 0 of every row is aligned
+    const int align = PLANAR_ALIGNMENT / sizeof(T);
+    int left = (border + align - 1) / align * align;
+
+    rowStride = (left + width + border + align - 1) / align * align;
+    planeSize = (qptrdiff)rowStride * (height + 2 * border);
+
+    data = pool_array<T>(planeSize * planes);
+
+    origin = data + (qptrdiff)border * rowStride + left;
+}
+
+/******************************************************************************
+ * Function: PlanarImage::fill_border
+ * Description: Fills the border of every plane from the image, mapping the
+ *  coordinates with the edge mode.
+ * Parameters:
+ *   edge - the edge mode
+ *   thread_count - the number of threads to use
+ *****************************************************************************/
+template<class T>
+void PlanarImage<T>::fill_border(EdgeMode edge, int thread_count)
+{
+    if(borderSize == 0 || imageWidth == 0 || imageHeight == 0)
+        return;
+
+    int width = imageWidth;
+    int height = imageHeight;
+    int border = borderSize;
+    int rows = planeCount * height;
+
+    //the left and right ends of the image rows
+#   pragma omp parallel for num_threads(thread_count) schedule(static) default(none) \
+        shared(edge, width, height, border, rows)
+    for(int i = 0; i < rows; i++)
+    {
+        T* line = row(i / height, i % height);
+
+        for(int c = -border; c < 0; c++)
+            line[c] = line[edge_index(c, width, edge)];
+
+        for(int c = width; c < width + border; c++)
+            line[c] = line[edge_index(c, width, edge)];
+    }
+
+    //then the rows above and below, whole, corners included
+    int borderRows = planeCount * 2 * border;
+
+#   pragma omp parallel for num_threads(thread_count) schedule(static) default(none) \
+        shared(edge, width, height, border, borderRows)
+    for(int i = 0; i < borderRows; i++)
+    {
+        int plane = i / (2 * border);
+        int k = i % (2 * border);
+        int r = k < border ? k - border : height + k - border;
+
+        const T* source = row(plane, edge_index(r, height, edge)) - border;
+        T* line = row(plane, r) - border;
+
+        for(int c = 0; c < width + 2 * border; c++)
+            line[c] = source[c];
+    }
+}
+
+/******************************************************************************
+ * Function: planar_byte
+ * Description: A plane value as an 8 bit channel, clamped to 0 - 255 and
+ *  truncated like the kernel filters do.
+ *****************************************************************************/
+inline int planar_byte(float value)
+{
+    if(value < 0)
+        return 0;
+    if(value > 255)
+        return 255;
+
+    return (int)value;
+}
+
+inline int planar_byte(uchar value)
+{
+    return value;
+}
+
+/******************************************************************************
+ * Function: to_planar
+ * Description: Converts an image into planes, as to_planar<float>(...) or
+ *  to_planar<uchar>(...).
+ * Parameters:
+ *   image - the image to convert
+ *   channels - which planes to make
+ *   border - the border to give the planes
+ *   edge - how to fill the border
+ *   thread_count - the number of threads to use
+ * Returns: The new planes.
+ *****************************************************************************/
+template<class T>
+PlanarImage<T>* to_planar(const QImage& image, PlanarChannels channels, int border, EdgeMode edge, int thread_count)
+{
+    TraceScope trace("to planar");
+
+    QImage source = to_argb32(image);
+    PlanarImage<T>* planar = new PlanarImage<T>(source.width(), source.height(),
+                                                planar_plane_count(channels), border);
+    int width = source.width();
+    int height = source.height();
+
+    ConstScanlines in(source);
+
+#   pragma omp parallel for num_threads(thread_count) schedule(runtime) default(none) \
+        shared(planar, in, channels, width, height)
+    for(int r = 0; r < height; r++)
+    {
+        const QRgb* src = in[r];
+
+        if(channels == PLANAR_RGB)
+        {
+            T* red = planar->row(0, r);
+            T* green = planar->row(1, r);
+            T* blue = planar->row(2, r);
+
+            for(int c = 0; c < width; c++)
+            {
+                red[c] = qRed(src[c]);
+                green[c] = qGreen(src[c]);
+                blue[c] = qBlue(src[c]);
+            }
+        }
+        else if(channels == PLANAR_LUMA)
+        {
+            T* luma = planar->row(0, r);
+
+            for(int c = 0; c < width; c++)
+                luma[c] = qGray(src[c]);
+        }
+        else
+        {
+            T* value = planar->row(0, r);
+
+            for(int c = 0; c < width; c++)
+                value[c] = pixel_value(src[c]);
+        }
+    }
+
+    planar->fill_border(edge, thread_count);
+
+    return planar;
+}
+
+/******************************************************************************
+ * Function: from_planar
+ * Description: Converts planes back into an image, clamping the values with
+ *  planar_byte(). A PLANAR_LUMA plane comes back as a gray image.
+ * Parameters:
+ *   planar - the planes
+ *   channels - what the planes hold
+ *   colors - for PLANAR_VALUE, the image whose hue and saturation each pixel
+ *            keeps, see with_value(); unused otherwise
+ *   thread_count - the number of threads to use
+ * Returns: The new image.
+ *****************************************************************************/
+template<class T>
+QImage* from_planar(const PlanarImage<T>& planar, PlanarChannels channels, const QImage& colors, int thread_count)
+{
+    TraceScope trace("from planar");
+
+    QImage source = channels == PLANAR_VALUE ? to_argb32(colors) : QImage();
+    QImage* newImage = new_output_image(QSize(planar.width(), planar.height()), thread_count);
+    int width = planar.width();
+    int height = planar.height();
+
+    Scanlines out(*newImage);
+    ConstScanlines in(source);
+
+    PlacementScope placement(*newImage, thread_count);
+
+#   pragma omp parallel for num_threads(thread_count) schedule(runtime) default(none) \
+        shared(planar, in, out, channels, width, height)
+    for(int r = 0; r < height; r++)
+    {
+        QRgb* dst = out[r];
+
+        if(channels == PLANAR_RGB)
+        {
+            const T* red = planar.row(0, r);
+            const T* green = planar.row(1, r);
+            const T* blue = planar.row(2, r);
+
+            for(int c = 0; c < width; c++)
+                dst[c] = qRgb(planar_byte(red[c]), planar_byte(green[c]), planar_byte(blue[c]));
+        }
+        else if(channels == PLANAR_LUMA)
+        {
+            const T* luma = planar.row(0, r);
+
+            for(int c = 0; c < width; c++)
+            {
+                int gray = planar_byte(luma[c]);
+                dst[c] = qRgb(gray, gray, gray);
+            }
+        }
+        else
+        {
+            const T* value = planar.row(0, r);
+            const QRgb* src = in[r];
+
+            for(int c = 0; c < width; c++)
+                dst[c] = with_value(src[c], planar_byte(value[c]));
+        }
+    }
+
+    return newImage;
+}
+
+#endif // PLANAR_IMAGE_H
@@ -0,0 +1,283 @@
+#include "point_ops.h"
+#include "pixel_access.h"
+#include "filter_progress.h"
+#include "simd_kernels.h"
+
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+
+/******************************************************************************
+ * Function: PointLut::PointLut
+ * Description: Builds the identity table.
+ *****************************************************************************/
+PointLut::PointLut()
+{
+    for(int i = 0; i < 256; i++)
+        red[i] = green[i] = blue[i] = (uchar)i;
+}
+
+/******************************************************************************
+ * Function: PointLut::from_tables
+ * Description: Builds a table with a separate 256 entry map per channel.
+ * Parameters:
+ *   red, green, blue - the maps for each channel
+ * Returns: The table.
+ *****************************************************************************/
+PointLut PointLut::from_tables(const uchar* red, const uchar* green, const uchar* blue)
+{
+    PointLut lut;
+
+    memcpy(lut.red, red, 256);
+    memcpy(lut.green, green, 256);
+    memcpy(lut.blue, blue, 256);
+
+    return lut;
+}
+
+/******************************************************************************
+ * Function: PointLut::then
+ * Description: Composes two point operations into one.
+ * Parameters:
+ *   next - the operation to apply after this one
+ * Returns: A table equivalent to applying this table, then next.
+ *****************************************************************************/
+PointLut PointLut::then(const PointLut& next) const
+{
+    PointLut lut;
+
+    for(int i = 0; i < 256; i++)
+    {
+        lut.red[i] = next.red[red[i]];
+        lut.green[i] = next.green[green[i]];
+        lut.blue[i] = next.blue[blue[i]];
+    }
+
+    return lut;
+}
+
+/******************************************************************************
+ * Function: PointLut::is_identity
+ * Description: Whether the table leaves every channel value as it is.
+ *****************************************************************************/
+bool PointLut::is_identity() const
+{
+    for(int i = 0; i < 256; i++)
+        if(red[i] != i || green[i] != i || blue[i] != i)
+            return false;
+
+    return true;
+}
+
+/******************************************************************************
+ * Function: gamma_lut
+ * Description: Raises each normalized channel to the given power, at least
+ *  GAMMA_MIN.
+ *****************************************************************************/
+PointLut gamma_lut(double gamma)
+{
+    PointLut lut;
+
+    //written so NaN is clamped too
+    if(!(gamma >= GAMMA_MIN))
+        gamma = GAMMA_MIN;
+
+    for(int i = 0; i < 256; i++)
+    {
+        int value = pow(i/255.0, gamma)*255+0.5;
+        lut.red[i] = lut.green[i] = lut.blue[i] = (uchar)qBound(0, value, 255);
+    }
+
+    return lut;
+}
+
+/******************************************************************************
+ * Function: enhance_contrast_lut
+ * Description: Stretches low - high out to 0 - 255.
+ *****************************************************************************/
+PointLut enhance_contrast_lut(int low, int high)
+{
+    PointLut lut;
+
+    if(high <= low)
+        high = low + 1;
+
+    for(int i = 0; i < 256; i++)
+    {
+        float value = (i-(double)low)*(255.0/(high-low));
+
+        if(value > 255) value = 255;
+        if(value < 0) value = 0;
+
+        lut.red[i] = lut.green[i] = lut.blue[i] = (uchar)(int)value;
+    }
+
+    return lut;
+}
+
+/******************************************************************************
+ * Function: reduce_contrast_lut
+ * Description: Squeezes 0 - 255 into low - high.
+ *****************************************************************************/
+PointLut reduce_contrast_lut(int low, int high)
+{
+    PointLut lut;
+
+    for(int i = 0; i < 256; i++)
+    {
+        float value = i*((high-low)/(255.0)) + low;
+
+        if(value > 255) value = 255;
+        if(value < 0) value = 0;
+
+        lut.red[i] = lut.green[i] = lut.blue[i] = (uchar)(int)value;
+    }
+
+    return lut;
+}
+
+/******************************************************************************
+ * Function: posterize_lut
+ * Description: Quantizes each channel to the given number of levels.
+ *****************************************************************************/
+PointLut posterize_lut(int levels)
+{
+    PointLut lut;
+
+    levels = qBound(2, levels, 256);
+
+    int interval = 256/levels;
+    int quanta = 255/(levels-1);
+
+    for(int i = 0; i < 256; i++)
+        lut.red[i] = lut.green[i] = lut.blue[i] = (uchar)qMin(255, (i/interval)*quanta);
+
+    return lut;
+}
+
+/******************************************************************************
+ * Function: negate_lut
+ * Description: 255 - value.
+ *****************************************************************************/
+PointLut negate_lut()
+{
+    PointLut lut;
+
+    for(int i = 0; i < 256; i++)
+        lut.red[i] = lut.green[i] = lut.blue[i] = (uchar)(255 - i);
+
+    return lut;
+}
+
+/******************************************************************************
+ * Function: threshold_lut
+ * Description: 255 above the threshold, 0 otherwise.
+ *****************************************************************************/
+PointLut threshold_lut(int threshold)
+{
+    PointLut lut;
+
+    for(int i = 0; i < 256; i++)
+        lut.red[i] = lut.green[i] = lut.blue[i] = (i > threshold) ? 255 : 0;
+
+    return lut;
+}
+
+/******************************************************************************
+ * Function: brighten_darken_lut
+ * Description: Adds value to each channel. Results that reach 0 or 255 are
+ *  replaced by limit, as brighten_darken() has always done.
+ *****************************************************************************/
+PointLut brighten_darken_lut(int value, int limit)
+{
+    PointLut lut;
+
+    for(int i = 0; i < 256; i++)
+    {
+        int result = i + value;
+        lut.red[i] = lut.green[i] = lut.blue[i] =
+            (uchar)qBound(0, (result < 255 && result > 0) ? result : limit, 255);
+    }
+
+    return lut;
+}
+
+/******************************************************************************
+ * Function: PackedLut::PackedLut
+ * Description: Widens and shifts the tables of a point operation.
+ *****************************************************************************/
+PackedLut::PackedLut(const PointLut& lut)
+{
+    for(int i = 0; i < 256; i++)
+    {
+        red[i] = 0xff000000u | ((quint32)lut.red[i] << 16);
+        green[i] = (quint32)lut.green[i] << 8;
+        blue[i] = lut.blue[i];
+    }
+}
+
+/******************************************************************************
+ * Function: PackedLut::apply
+ * Description: Looks a row up in the tables; src and dst may be the same.
+ *****************************************************************************/
+void PackedLut::apply(const QRgb* src, QRgb* dst, int width) const
+{
+    lut_row(src, dst, width, red, green, blue);
+}
+
+/******************************************************************************
+ * Function: apply_lut
+ * Description: Applies a point operation to every pixel in parallel. Tables
+ *  that change nothing (gamma 1, posterize to 256 levels...) skip the lookups
+ *  and only copy the pixels.
+ * Parameters:
+ *   image - the image to process on
+ *   lut - the point operation
+ *   thread_count - the number of threads to use
+ * Returns: The new image.
+ *****************************************************************************/
+QImage* apply_lut(const QImage& image, const PointLut& lut, int thread_count)
+{
+    QImage source = to_argb32(image);
+    QImage* newImage = new_output_image(source.size(), thread_count);
+    QSize size = newImage->size();
+
+    PackedLut packed(lut);
+    bool identity = lut.is_identity();
+
+    ConstScanlines in(source);
+    Scanlines out(*newImage);
+
+    FilterProgress* progress = FilterProgress::current();
+    progress_add_work(progress, size.height());
+
+#   pragma omp parallel num_threads(thread_count) default(none) \
+        shared(progress, size, in, out, packed, identity) copyin(traceOperation)
+    {
+        TraceScope trace("apply lut", "rows");
+
+#       pragma omp for schedule(runtime) nowait
+        for(int r = 0; r < size.height(); r++)
+        {
+            if(progress_cancelled(progress))
+                continue;
+
+            if(identity)
+            {
+                const QRgb* src = in[r];
+                QRgb* dst = out[r];
+
+                for(int c = 0; c < size.width(); c++)
+                    dst[c] = src[c] | 0xff000000u;
+            }
+            else
+                packed.apply(in[r], out[r], size.width());
+
+            trace.add_count(1);
+            progress_advance(progress);
+        }
+    }
+
+    return newImage;
+}
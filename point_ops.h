@@ -0,0 +1,90 @@
+#ifndef POINT_OPS_H
+#define POINT_OPS_H
+
+#include <QImage>
+
+// Smaller powers are raised to this by gamma_lut(); at 0 or below, pow() of
+// a black channel is infinite
+#define GAMMA_MIN 0.01
+
+/******************************************************************************
+ * Point operations: filters where each output channel is a pure function of
+ * the same input channel. Such a filter is built once into a PointLut, a
+ * 256 entry table per channel, and applied with apply_lut(), which costs
+ * three table loads per pixel whatever the function is. Two point operations
+ * in a row compose into one table with then(), so a chain of them is still a
+ * single pass over the image.
+ *****************************************************************************/
+
+/******************************************************************************
+ * Class: PointLut
+ * Description: Per channel lookup tables for a point operation.
+ *****************************************************************************/
+class PointLut
+{
+public:
+    PointLut();
+
+    static PointLut from_tables(const uchar* red, const uchar* green, const uchar* blue);
+
+    template<class Function>
+    static PointLut from_function(Function f);
+
+    PointLut then(const PointLut& next) const;
+    bool is_identity() const;
+
+    uchar red[256];
+    uchar green[256];
+    uchar blue[256];
+};
+
+/******************************************************************************
+ * Function: PointLut::from_function
+ * Description: Builds a table that applies the same function to every
+ *  channel.
+ * Parameters:
+ *   f - callable taking a channel value 0 - 255 and returning the new value,
+ *       which must already be within 0 - 255
+ * Returns: The table.
+ *****************************************************************************/
+template<class Function>
+PointLut PointLut::from_function(Function f)
+{
+    PointLut lut;
+
+    for(int i = 0; i < 256; i++)
+        lut.red[i] = lut.green[i] = lut.blue[i] = (uchar)f(i);
+
+    return lut;
+}
+
+/******************************************************************************
+ * Class: PackedLut
+ * Description: A PointLut ready to apply. The tables are widened to 32 bits
+ *  and pre-shifted into their channel position, so each pixel is three
+ *  independent loads OR'ed together with no per channel packing. apply()
+ *  runs on lut_row(), which does 8 pixels per three gathers on processors
+ *  with AVX2 and scalar loads elsewhere. The result is opaque.
+ *****************************************************************************/
+struct PackedLut
+{
+    explicit PackedLut(const PointLut& lut);
+
+    void apply(const QRgb* src, QRgb* dst, int width) const;
+
+    quint32 red[256];
+    quint32 green[256];
+    quint32 blue[256];
+};
+
+PointLut gamma_lut(double gamma);
+PointLut enhance_contrast_lut(int low = 64, int high = 192);
+PointLut reduce_contrast_lut(int low = 64, int high = 192);
+PointLut posterize_lut(int levels);
+PointLut negate_lut();
+PointLut threshold_lut(int threshold);
+PointLut brighten_darken_lut(int value, int limit);
+
+QImage* apply_lut(const QImage& image, const PointLut& lut, int thread_count);
+
+#endif // POINT_OPS_H
@@ -6,7 +6,9 @@
 
 QT       += core gui
 
-greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets concurrent
+
+CONFIG += c++11
 
 TARGET = prog4
 TEMPLATE = app
@@ -16,12 +18,55 @@ SOURCES += main.cpp\
         mainwindow.cpp \
     chris_algorithms.cpp \
     ian_algorithms.cpp \
-    matt_algorithms.cpp
+    matt_algorithms.cpp \
+    fft_engine.cpp \
+    blur.cpp \
+    integral_image.cpp \
+    adaptive_filters.cpp \
+    histogram.cpp \
+    pyramid.cpp \
+    image_gradient.cpp \
+    point_ops.cpp \
+    pipeline.cpp \
+    simd_kernels.cpp \
+    streaming.cpp \
+    filter_registry.cpp \
+    batch.cpp \
+    filter_progress.cpp \
+    trace.cpp \
+    buffer_pool.cpp \
+    thread_policy.cpp \
+    thread_tuner.cpp \
+    history.cpp
 
 HEADERS  += mainwindow.h \
     chris_algorithms.h \
     ian_algorithms.h \
-    matt_algorithms.h
+    matt_algorithms.h \
+    fft_engine.h \
+    pixel_access.h \
+    counter_rng.h \
+    convolution.h \
+    planar_image.h \
+    blur.h \
+    integral_image.h \
+    adaptive_filters.h \
+    histogram.h \
+    pyramid.h \
+    image_gradient.h \
+    point_ops.h \
+    pipeline.h \
+    simd_kernels.h \
+    streaming.h \
+    filter_registry.h \
+    batch.h \
+    filter_progress.h \
+    trace.h \
+    buffer_pool.h \
+    thread_policy.h \
+    thread_tuner.h \
+    history.h \
+    qt_compat.h
 
 FORMS    += mainwindow.ui
 
@@ -0,0 +1,597 @@
+#include "pyramid.h"
+#include "pixel_access.h"
+#include "filter_progress.h"
+
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include <cmath>
+#include <cstring>
+
+/******************************************************************************
+ * Function: pyramid_reduce
+ * Description: Blurs a level with [1 4 6 4 1] / 16 in both directions and
+ *  keeps every other row and column. Each output row first sums its five
+ *  input rows down the columns, contiguous loops that vectorize, and then
+ *  applies the horizontal taps at the even columns only, so the blur is never
+ *  computed for the pixels that are dropped.
+ * Parameters:
+ *   fine - the level to reduce, with a border of PYRAMID_BORDER
+ *   thread_count - the number of threads to use
+ * Returns: The next level, ((width + 1) / 2) x ((height + 1) / 2).
+ *****************************************************************************/
+PlanarImage<float>* pyramid_reduce(const PlanarImage<float>& fine, int thread_count)
+{
+    int fineWidth = fine.width();
+    int width = (fine.width() + 1) / 2;
+    int height = (fine.height() + 1) / 2;
+    int rows = fine.planes() * height;
+
+    PlanarImage<float>* coarse = new PlanarImage<float>(width, height, fine.planes(), PYRAMID_BORDER);
+
+    FilterProgress* progress = FilterProgress::current();
+    progress_add_work(progress, rows);
+
+#   pragma omp parallel num_threads(thread_count) default(none) \
+        shared(progress, fine, coarse, fineWidth, width, height, rows) copyin(traceOperation)
+    {
+        TraceScope trace("pyramid reduce", "rows");
+
+        //the vertical sums, border columns included
+        float* column = new float[fineWidth + 2 * PYRAMID_BORDER];
+
+#       pragma omp for schedule(runtime) nowait
+        for(int i = 0; i < rows; i++)
+        {
+            if(progress_cancelled(progress))
+                continue;
+
+            int plane = i / height;
+            int r = i % height;
+
+            const float* a = fine.row(plane, 2 * r - 2) - PYRAMID_BORDER;
+            const float* b = fine.row(plane, 2 * r - 1) - PYRAMID_BORDER;
+            const float* c = fine.row(plane, 2 * r) - PYRAMID_BORDER;
+            const float* d = fine.row(plane, 2 * r + 1) - PYRAMID_BORDER;
+            const float* e = fine.row(plane, 2 * r + 2) - PYRAMID_BORDER;
+
+            for(int x = 0; x < fineWidth + 2 * PYRAMID_BORDER; x++)
+                column[x] = (a[x] + e[x]) * (1 / 16.0f) + (b[x] + d[x]) * (4 / 16.0f) + c[x] * (6 / 16.0f);
+
+            const float* v = column + PYRAMID_BORDER;
+            float* dst = coarse->row(plane, r);
+
+            for(int k = 0; k < width; k++)
+            {
+                const float* p = v + 2 * k;
+                dst[k] = (p[-2] + p[2]) * (1 / 16.0f) + (p[-1] + p[1]) * (4 / 16.0f) + p[0] * (6 / 16.0f);
+            }
+
+            trace.add_count(1);
+            progress_advance(progress);
+        }
+
+        delete[] column;
+    }
+
+    coarse->fill_border(EDGE_CLAMP, thread_count);
+
+    return coarse;
+}
+
+/******************************************************************************
+ * Function: pyramid_expand
+ * Description: Doubles a level back up with the interpolation that undoes
+ *  pyramid_reduce()'s decimation: even rows and columns take
+ *  (1, 6, 1) / 8 of the three nearest coarse ones, odd ones the mean of the
+ *  two around them. The result can be added to a base level, which is how
+ *  Laplacian bands are made and undone.
+ * Parameters:
+ *   coarse - the level to expand, with a border of PYRAMID_BORDER
+ *   size - the size to expand to, the size of the level coarse was reduced
+ *          from
+ *   base - NULL, or a level of that size to add the expansion to
+ *   sign - 1 to add the expansion to base, -1 to subtract it
+ *   thread_count - the number of threads to use
+ * Returns: The expansion, or base + sign * expansion.
+ *****************************************************************************/
+PlanarImage<float>* pyramid_expand(const PlanarImage<float>& coarse, const QSize& size,
+                                   const PlanarImage<float>* base, float sign, int thread_count)
+{
+    int coarseWidth = coarse.width();
+    int width = size.width();
+    int height = size.height();
+    int rows = coarse.planes() * height;
+
+    PlanarImage<float>* fine = new PlanarImage<float>(width, height, coarse.planes(), PYRAMID_BORDER);
+
+    FilterProgress* progress = FilterProgress::current();
+    progress_add_work(progress, rows);
+
+#   pragma omp parallel num_threads(thread_count) default(none) \
+        shared(progress, coarse, fine, base, sign, coarseWidth, width, height, rows) copyin(traceOperation)
+    {
+        TraceScope trace("pyramid expand", "rows");
+
+        //the vertical interpolation, one border column either side
+        float* column = new float[coarseWidth + 2];
+
+#       pragma omp for schedule(runtime) nowait
+        for(int i = 0; i < rows; i++)
+        {
+            if(progress_cancelled(progress))
+                continue;
+
+            int plane = i / height;
+            int r = i % height;
+            int m = r / 2;
+
+            const float* above = coarse.row(plane, m - 1) - 1;
+            const float* middle = coarse.row(plane, m) - 1;
+            const float* below = coarse.row(plane, m + 1) - 1;
+
+            if(r % 2 == 0)
+            {
+                for(int x = 0; x < coarseWidth + 2; x++)
+                    column[x] = (above[x] + below[x]) * (1 / 8.0f) + middle[x] * (6 / 8.0f);
+            }
+            else
+            {
+                for(int x = 0; x < coarseWidth + 2; x++)
+                    column[x] = (middle[x] + below[x]) * 0.5f;
+            }
+
+            const float* v = column + 1;
+            float* dst = fine->row(plane, r);
+
+            for(int k = 0; 2 * k < width; k++)
+                dst[2 * k] = (v[k - 1] + v[k + 1]) * (1 / 8.0f) + v[k] * (6 / 8.0f);
+
+            for(int k = 0; 2 * k + 1 < width; k++)
+                dst[2 * k + 1] = (v[k] + v[k + 1]) * 0.5f;
+
+            if(base != NULL)
+            {
+                const float* add = base->row(plane, r);
+
+                for(int c = 0; c < width; c++)
+                    dst[c] = add[c] + sign * dst[c];
+            }
+
+            trace.add_count(1);
+            progress_advance(progress);
+        }
+
+        delete[] column;
+    }
+
+    fine->fill_border(EDGE_CLAMP, thread_count);
+
+    return fine;
+}
+
+/******************************************************************************
+ * Function: copy_planes
+ * Description: A copy of planes with a border of PYRAMID_BORDER, the border
+ *  included.
+ *****************************************************************************/
+static PlanarImage<float>* copy_planes(const PlanarImage<float>& planes)
+{
+    PlanarImage<float>* copy = new PlanarImage<float>(planes.width(), planes.height(),
+                                                      planes.planes(), PYRAMID_BORDER);
+    int length = planes.width() + 2 * PYRAMID_BORDER;
+
+    for(int p = 0; p < planes.planes(); p++)
+        for(int r = -PYRAMID_BORDER; r < planes.height() + PYRAMID_BORDER; r++)
+            memcpy(copy->row(p, r) - PYRAMID_BORDER, planes.row(p, r) - PYRAMID_BORDER, length * sizeof(float));
+
+    return copy;
+}
+
+GaussianPyramid::GaussianPyramid(const QImage& image, int thread_count)
+{
+    TraceScope trace("pyramid build");
+
+    levelPlanes << to_planar<float>(image, PLANAR_RGB, PYRAMID_BORDER, EDGE_CLAMP, thread_count);
+
+    for(;;)
+    {
+        const PlanarImage<float>& last = *levelPlanes.last();
+
+        if((last.width() + 1) / 2 < PYRAMID_MIN_SIDE || (last.height() + 1) / 2 < PYRAMID_MIN_SIDE)
+            break;
+
+        levelPlanes << pyramid_reduce(last, thread_count);
+    }
+}
+
+GaussianPyramid::~GaussianPyramid()
+{
+    for(int k = 0; k < levelPlanes.size(); k++)
+        delete levelPlanes[k];
+}
+
+/******************************************************************************
+ * Function: GaussianPyramid::bytes
+ * Description: The memory the levels take.
+ *****************************************************************************/
+qint64 GaussianPyramid::bytes() const
+{
+    qint64 total = 0;
+
+    for(int k = 0; k < levelPlanes.size(); k++)
+    {
+        const PlanarImage<float>& level = *levelPlanes[k];
+        total += (qint64)level.stride() * (level.height() + 2 * level.border()) * level.planes() * sizeof(float);
+    }
+
+    return total;
+}
+
+/******************************************************************************
+ * Function: LaplacianPyramid::LaplacianPyramid
+ * Description: Builds the bands of the first levels of a Gaussian pyramid.
+ * Parameters:
+ *   gaussian - the Gaussian pyramid
+ *   levels - the number of bands, at most gaussian.levels(); the last is
+ *            Gaussian level levels - 1
+ *   thread_count - the number of threads to use
+ *****************************************************************************/
+LaplacianPyramid::LaplacianPyramid(const GaussianPyramid& gaussian, int levels, int thread_count)
+{
+    TraceScope trace("laplacian build");
+
+    levels = qBound(1, levels, gaussian.levels());
+
+    for(int k = 0; k + 1 < levels; k++)
+    {
+        const PlanarImage<float>& level = gaussian.level(k);
+
+        bands << pyramid_expand(gaussian.level(k + 1), QSize(level.width(), level.height()),
+                                &level, -1, thread_count);
+    }
+
+    bands << copy_planes(gaussian.level(levels - 1));
+}
+
+LaplacianPyramid::~LaplacianPyramid()
+{
+    for(int k = 0; k < bands.size(); k++)
+        delete bands[k];
+}
+
+/******************************************************************************
+ * Function: LaplacianPyramid::reconstruct
+ * Description: Expands the coarsest band and adds each finer band to it in
+ *  turn.
+ * Returns: The image at the size of band 0.
+ *****************************************************************************/
+PlanarImage<float>* LaplacianPyramid::reconstruct(int thread_count) const
+{
+    TraceScope trace("laplacian reconstruct");
+
+    PlanarImage<float>* current = copy_planes(*bands.last());
+
+    for(int k = bands.size() - 2; k >= 0; k--)
+    {
+        const PlanarImage<float>& band = *bands[k];
+        PlanarImage<float>* next = pyramid_expand(*current, QSize(band.width(), band.height()),
+                                                  &band, 1, thread_count);
+        delete current;
+        current = next;
+    }
+
+    return current;
+}
+
+/******************************************************************************
+ * Struct: CachedPyramid
+ * Description: A pyramid kept for the image it was built from.
+ *****************************************************************************/
+struct CachedPyramid
+{
+    qint64 key;             // QImage::cacheKey() of the image
+    QSharedPointer<const GaussianPyramid> pyramid;
+};
+
+static QMutex pyramidMutex;
+static QList<CachedPyramid> pyramidCache;      // least recently used first
+
+// Whether pyramids built on this thread are kept; see set_pyramid_caching()
+static thread_local bool cachingPyramids = true;
+
+/******************************************************************************
+ * Function: set_pyramid_caching
+ * Description: Whether gaussian_pyramid() keeps the pyramids it builds on
+ *  the calling thread, for images such as preview crops that are filtered
+ *  once and thrown away. Cached pyramids are still looked up.
+ *****************************************************************************/
+void set_pyramid_caching(bool enabled)
+{
+    cachingPyramids = enabled;
+}
+
+/******************************************************************************
+ * Function: gaussian_pyramid
+ * Description: The Gaussian pyramid of an image. The pyramids of the images
+ *  filtered last are kept, up to PYRAMID_CACHE_BYTES, so filtering the same
+ *  image again, with another sigma say, reuses the levels. QImage gives an
+ *  image a new cacheKey() whenever its pixels change.
+ * Parameters:
+ *   image - the image
+ *   thread_count - the number of threads to build it with
+ * Returns: The pyramid, shared with the cache.
+ *****************************************************************************/
+QSharedPointer<const GaussianPyramid> gaussian_pyramid(const QImage& image, int thread_count)
+{
+    qint64 key = image.cacheKey();
+
+    {
+        QMutexLocker lock(&pyramidMutex);
+
+        for(int i = 0; i < pyramidCache.size(); i++)
+        {
+            if(pyramidCache[i].key == key)
+            {
+                CachedPyramid hit = pyramidCache.takeAt(i);
+                pyramidCache << hit;
+                return hit.pyramid;
+            }
+        }
+    }
+
+    QSharedPointer<const GaussianPyramid> pyramid(new GaussianPyramid(image, thread_count));
+    qint64 bytes = pyramid->bytes();
+
+    //a cancelled build is incomplete
+    if(!cachingPyramids || progress_cancelled(FilterProgress::current()) || bytes > PYRAMID_CACHE_BYTES)
+        return pyramid;
+
+    QMutexLocker lock(&pyramidMutex);
+
+    qint64 cached = bytes;
+    for(int i = 0; i < pyramidCache.size(); i++)
+        cached += pyramidCache[i].pyramid->bytes();
+
+    while(!pyramidCache.isEmpty() && cached > PYRAMID_CACHE_BYTES)
+        cached -= pyramidCache.takeFirst().pyramid->bytes();
+
+    CachedPyramid entry = {key, pyramid};
+    pyramidCache << entry;
+
+    return pyramid;
+}
+
+/******************************************************************************
+ * Function: blur_planes
+ * Description: A separable Gaussian blur of planes with clamped edges, each
+ *  output row summing its input rows and then the taps along the row.
+ * Parameters:
+ *   planes - the planes to blur
+ *   sigma - the blur sigma in pixels, a copy for 0
+ *   thread_count - the number of threads to use
+ * Returns: The blurred planes, with a border of PYRAMID_BORDER.
+ *****************************************************************************/
+static PlanarImage<float>* blur_planes(const PlanarImage<float>& planes, double sigma, int thread_count)
+{
+    int radius = (int)ceil(3 * sigma);
+    if(radius == 0)
+        return copy_planes(planes);
+
+    int width = planes.width();
+    int height = planes.height();
+    int rows = planes.planes() * height;
+
+    float* weights = new float[2 * radius + 1];
+    float total = 0;
+
+    for(int k = -radius; k <= radius; k++)
+    {
+        weights[k + radius] = exp(-(k * k) / (2 * sigma * sigma));
+        total += weights[k + radius];
+    }
+    for(int k = 0; k <= 2 * radius; k++)
+        weights[k] /= total;
+
+    PlanarImage<float>* blurred = new PlanarImage<float>(width, height, planes.planes(), PYRAMID_BORDER);
+
+    FilterProgress* progress = FilterProgress::current();
+    progress_add_work(progress, rows);
+
+#   pragma omp parallel num_threads(thread_count) default(none) \
+        shared(progress, planes, blurred, weights, radius, width, height, rows) copyin(traceOperation)
+    {
+        TraceScope trace("pyramid blur", "rows");
+
+        //the vertical sums with the edge columns repeated radius times
+        float* padded = new float[width + 2 * radius];
+        float* sum = padded + radius;
+
+#       pragma omp for schedule(runtime) nowait
+        for(int i = 0; i < rows; i++)
+        {
+            if(progress_cancelled(progress))
+                continue;
+
+            int plane = i / height;
+            int r = i % height;
+
+            for(int c = 0; c < width; c++)
+                sum[c] = 0;
+
+            for(int k = -radius; k <= radius; k++)
+            {
+                const float weight = weights[k + radius];
+                const float* src = planes.row(plane, qBound(0, r + k, height - 1));
+
+                for(int c = 0; c < width; c++)
+                    sum[c] += weight * src[c];
+            }
+
+            for(int c = 1; c <= radius; c++)
+            {
+                sum[-c] = sum[0];
+                sum[width - 1 + c] = sum[width - 1];
+            }
+
+            float* dst = blurred->row(plane, r);
+
+            for(int c = 0; c < width; c++)
+                dst[c] = 0;
+
+            for(int k = 0; k <= 2 * radius; k++)
+            {
+                const float weight = weights[k];
+                const float* tap = padded + k;
+
+                for(int c = 0; c < width; c++)
+                    dst[c] += weight * tap[c];
+            }
+
+            trace.add_count(1);
+            progress_advance(progress);
+        }
+
+        delete[] padded;
+    }
+
+    delete[] weights;
+
+    blurred->fill_border(EDGE_CLAMP, thread_count);
+
+    return blurred;
+}
+
+/******************************************************************************
+ * Function: planes_to_image
+ * Description: Red, green and blue planes as an image, rounded to the
+ *  nearest value like gaussian_blur().
+ *****************************************************************************/
+static QImage* planes_to_image(const PlanarImage<float>& planes, int thread_count)
+{
+    int width = planes.width();
+    int height = planes.height();
+
+    QImage* newImage = new_output_image(QSize(width, height), thread_count);
+    Scanlines out(*newImage);
+
+    PlacementScope placement(*newImage, thread_count);
+
+#   pragma omp parallel for num_threads(thread_count) schedule(runtime) default(none) \
+        shared(planes, out, width, height)
+    for(int r = 0; r < height; r++)
+    {
+        const float* red = planes.row(0, r);
+        const float* green = planes.row(1, r);
+        const float* blue = planes.row(2, r);
+        QRgb* dst = out[r];
+
+        for(int c = 0; c < width; c++)
+            dst[c] = qRgb(qBound(0, (int)(red[c] + 0.5f), 255),
+                          qBound(0, (int)(green[c] + 0.5f), 255),
+                          qBound(0, (int)(blue[c] + 0.5f), 255));
+    }
+
+    return newImage;
+}
+
+/******************************************************************************
+ * Function: pyramid_blur
+ * Description: A Gaussian blur of any sigma at about the cost of a few
+ *  passes over the image. Reducing to level k and expanding back each blur
+ *  with a variance of (4^k - 1) / 3, so the coarsest level where the two
+ *  together stay within sigma^2 is blurred by what remains, a sigma of at
+ *  most about 1.4 of its pixels, and expanded back up. The result is close
+ *  to gaussian_blur() away from the image edges, not identical to it.
+ * Parameters:
+ *   image - the image to process on
+ *   thread_count - the number of threads to use
+ *   params - the blur sigma
+ * Returns: The new image
+ *****************************************************************************/
+QImage* pyramid_blur(const QImage& image, int thread_count, const PyramidBlurParams& params)
+{
+    ScheduleScope schedule("pyramid_blur");
+
+    QSharedPointer<const GaussianPyramid> pyramid = gaussian_pyramid(image, thread_count);
+    double variance = params.sigma > 0 ? params.sigma * params.sigma : 0;
+
+    int level = 0;
+    while(level + 1 < pyramid->levels() && 2 * (pow(4.0, level + 1) - 1) / 3 <= variance)
+        level++;
+
+    double scale = pow(2.0, level);
+    double residual = sqrt(qMax(0.0, variance - 2 * (scale * scale - 1) / 3)) / scale;
+
+    PlanarImage<float>* current = blur_planes(pyramid->level(level), residual, thread_count);
+
+    for(int k = level; k > 0; k--)
+    {
+        const PlanarImage<float>& finer = pyramid->level(k - 1);
+        PlanarImage<float>* next = pyramid_expand(*current, QSize(finer.width(), finer.height()),
+                                                  NULL, 1, thread_count);
+        delete current;
+        current = next;
+    }
+
+    QImage* newImage = planes_to_image(*current, thread_count);
+    delete current;
+
+    return newImage;
+}
+
+QImage* pyramid_blur(const QImage& image, int thread_count)
+{
+    return pyramid_blur(image, thread_count, PyramidBlurParams());
+}
+
+/******************************************************************************
+ * Function: enhance_detail
+ * Description: Scales the Laplacian bands of the finest levels and
+ *  reconstructs the image, boosting (or softening) detail up to a scale of
+ *  2^levels pixels while leaving larger shapes and the overall tone alone.
+ * Parameters:
+ *   image - the image to process on
+ *   thread_count - the number of threads to use
+ *   params - the gain and the number of bands it applies to
+ * Returns: The new image
+ *****************************************************************************/
+QImage* enhance_detail(const QImage& image, int thread_count, const DetailParams& params)
+{
+    ScheduleScope schedule("enhance_detail");
+
+    QSharedPointer<const GaussianPyramid> pyramid = gaussian_pyramid(image, thread_count);
+    LaplacianPyramid laplacian(*pyramid, params.levels + 1, thread_count);
+
+    float gain = params.gain;
+
+    for(int k = 0; k + 1 < laplacian.levels(); k++)
+    {
+        PlanarImage<float>& band = laplacian.band(k);
+        int width = band.width();
+        int height = band.height();
+        int rows = band.planes() * height;
+
+#       pragma omp parallel for num_threads(thread_count) schedule(runtime) default(none) \
+            shared(band, gain, width, height, rows)
+        for(int i = 0; i < rows; i++)
+        {
+            float* row = band.row(i / height, i % height);
+
+            for(int c = 0; c < width; c++)
+                row[c] *= gain;
+        }
+    }
+
+    PlanarImage<float>* result = laplacian.reconstruct(thread_count);
+    QImage* newImage = planes_to_image(*result, thread_count);
+    delete result;
+
+    return newImage;
+}
+
+QImage* enhance_detail(const QImage& image, int thread_count)
+{
+    return enhance_detail(image, thread_count, DetailParams());
+}
@@ -0,0 +1,136 @@
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include <QImage>
+#include <QSharedPointer>
+#include <QVector>
+
+#include "planar_image.h"
+
+// Levels stop before either side would drop below this
+#define PYRAMID_MIN_SIDE 8
+
+// Border of every level plane, the radius of the reduce kernel
+#define PYRAMID_BORDER 2
+
+// Bytes of Gaussian pyramids kept for images filtered again. A pyramid takes
+// about 16 bytes per image pixel (three float planes, plus a third for the
+// smaller levels), so only images up to about 32 megapixels are kept; larger
+// ones are built again every time. Raise this to reuse them, at that much
+// memory held after the filter is done.
+#define PYRAMID_CACHE_BYTES ((qint64)512 * 1024 * 1024)
+
+/******************************************************************************
+ * Gaussian and Laplacian image pyramids.
+ *
+ * Level 0 of a Gaussian pyramid is the image as red, green and blue float
+ * planes; each level after it is the one before blurred with the 5 tap
+ * binomial kernel [1 4 6 4 1] / 16 and halved in each direction, in one
+ * fused pass that only computes the pixels it keeps (pyramid_reduce()).
+ * Level k is the image blurred with a sigma of sqrt((4^k - 1) / 3) at
+ * 1 / 4^k of the pixels, so work at a large scale is done on few pixels.
+ *
+ * A Laplacian pyramid keeps the detail each level loses: band k is Gaussian
+ * level k minus level k + 1 expanded back to its size (pyramid_expand()),
+ * and the last band is the coarsest Gaussian level itself. Expanding and
+ * adding the bands from the coarsest up gives the image back exactly, up to
+ * float rounding, and changing the bands in between edits the image one
+ * scale at a time.
+ *
+ * Borders are clamped, like gaussian_blur().
+ *****************************************************************************/
+
+/******************************************************************************
+ * Class: GaussianPyramid
+ * Description: The Gaussian levels of an image, down to PYRAMID_MIN_SIDE.
+ *  Immutable once built, so one pyramid can be shared by several filters;
+ *  see gaussian_pyramid().
+ *****************************************************************************/
+class GaussianPyramid
+{
+public:
+    GaussianPyramid(const QImage& image, int thread_count);
+    ~GaussianPyramid();
+
+    int levels() const { return levelPlanes.size(); }
+    const PlanarImage<float>& level(int k) const { return *levelPlanes[k]; }
+
+    qint64 bytes() const;
+
+private:
+    QVector<PlanarImage<float>*> levelPlanes;
+
+    GaussianPyramid(const GaussianPyramid&);
+    GaussianPyramid& operator=(const GaussianPyramid&);
+};
+
+/******************************************************************************
+ * Class: LaplacianPyramid
+ * Description: The first levels() bands of a Gaussian pyramid's Laplacian
+ *  pyramid, the last one the Gaussian level they stop at. The bands can be
+ *  changed before reconstruct().
+ *****************************************************************************/
+class LaplacianPyramid
+{
+public:
+    LaplacianPyramid(const GaussianPyramid& gaussian, int levels, int thread_count);
+    ~LaplacianPyramid();
+
+    int levels() const { return bands.size(); }
+    PlanarImage<float>& band(int k) { return *bands[k]; }
+    const PlanarImage<float>& band(int k) const { return *bands[k]; }
+
+    PlanarImage<float>* reconstruct(int thread_count) const;
+
+private:
+    QVector<PlanarImage<float>*> bands;
+
+    LaplacianPyramid(const LaplacianPyramid&);
+    LaplacianPyramid& operator=(const LaplacianPyramid&);
+};
+
+PlanarImage<float>* pyramid_reduce(const PlanarImage<float>& fine, int thread_count);
+PlanarImage<float>* pyramid_expand(const PlanarImage<float>& coarse, const QSize& size,
+                                   const PlanarImage<float>* base, float sign, int thread_count);
+
+QSharedPointer<const GaussianPyramid> gaussian_pyramid(const QImage& image, int thread_count);
+void set_pyramid_caching(bool enabled);
+
+/******************************************************************************
+ * Struct: PyramidBlurParams
+ * Description: pyramid_blur() approximates a Gaussian blur of this sigma.
+ *****************************************************************************/
+struct PyramidBlurParams
+{
+    explicit PyramidBlurParams(double sigma = 8) :
+        sigma(sigma)
+    {
+    }
+
+    double sigma;
+};
+
+/******************************************************************************
+ * Struct: DetailParams
+ * Description: enhance_detail() multiplies the finest levels Laplacian bands
+ *  by gain; above 1 sharpens, below 1 smooths.
+ *****************************************************************************/
+struct DetailParams
+{
+    explicit DetailParams(double gain = 1.5, int levels = 3) :
+        gain(gain),
+        levels(levels)
+    {
+    }
+
+    double gain;
+    int levels;
+};
+
+QImage* pyramid_blur(const QImage& image, int thread_count);
+QImage* pyramid_blur(const QImage& image, int thread_count, const PyramidBlurParams& params);
+
+QImage* enhance_detail(const QImage& image, int thread_count);
+QImage* enhance_detail(const QImage& image, int thread_count, const DetailParams& params);
+
+#endif // PYRAMID_H
@@ -0,0 +1,15 @@
+#ifndef QT_COMPAT_H
+#define QT_COMPAT_H
+
+#include <QtGlobal>
+#include <QString>
+
+// QString::SplitBehavior moved to the Qt namespace in Qt 5.14, and the old
+// name is deprecated from then on
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+#define SKIP_EMPTY_PARTS Qt::SkipEmptyParts
+#else
+#define SKIP_EMPTY_PARTS QString::SkipEmptyParts
+#endif
+
+#endif // QT_COMPAT_H
@@ -0,0 +1,397 @@
+#include "simd_kernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PROG4_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/******************************************************************************
+ * Function: detect_simd_level
+ * Description: Asks the processor which instruction sets it supports.
+ *****************************************************************************/
+static SimdLevel detect_simd_level()
+{
+#ifdef PROG4_X86_SIMD
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("avx2"))
+        return SIMD_AVX2;
+    if(__builtin_cpu_supports("sse4.1"))
+        return SIMD_SSE41;
+#endif
+
+    return SIMD_SCALAR;
+}
+
+static const SimdLevel supportedLevel = detect_simd_level();
+static SimdLevel currentLevel = supportedLevel;
+
+SimdLevel supported_simd_level()
+{
+    return supportedLevel;
+}
+
+SimdLevel simd_level()
+{
+    return currentLevel;
+}
+
+/******************************************************************************
+ * Function: set_simd_level
+ * Description: Limits the kernels to an instruction set, for comparing them.
+ *  Levels the processor does not support fall back to the best one it does.
+ *  Call it before running filters, not during.
+ *****************************************************************************/
+void set_simd_level(SimdLevel level)
+{
+    currentLevel = level < supportedLevel ? level : supportedLevel;
+}
+
+const char* simd_level_name(SimdLevel level)
+{
+    switch(level)
+    {
+    case SIMD_AVX2:
+        return "avx2";
+    case SIMD_SSE41:
+        return "sse4.1";
+    default:
+        return "scalar";
+    }
+}
+
+/******************************************************************************
+ * Scalar kernels, also used for the pixels left over at the end of a row.
+ *
+ * The vector grayscale divides by 3 as (sum * 43691) >> 17, which is exact
+ * for every sum of three channels (up to 765), so it matches the scalar
+ * integer division.
+ *****************************************************************************/
+static void grayscale_scalar(const QRgb* src, QRgb* dst, int width)
+{
+    for(int c = 0; c < width; c++)
+    {
+        int gray = (qRed(src[c]) + qGreen(src[c]) + qBlue(src[c])) / 3;
+
+        dst[c] = qRgb(gray, gray, gray);
+    }
+}
+
+static void negate_scalar(const QRgb* src, QRgb* dst, int width)
+{
+    for(int c = 0; c < width; c++)
+        dst[c] = 0xff000000u | (~src[c] & 0x00ffffffu);
+}
+
+static void threshold_scalar(const QRgb* src, QRgb* dst, int width, int threshold)
+{
+    for(int c = 0; c < width; c++)
+    {
+        int red   = ( qRed(src[c])   > threshold ) ? 255 : 0;
+        int green = ( qGreen(src[c]) > threshold ) ? 255 : 0;
+        int blue  = ( qBlue(src[c])  > threshold ) ? 255 : 0;
+
+        dst[c] = qRgb(red, green, blue);
+    }
+}
+
+static void add_saturate_scalar(const QRgb* src, QRgb* dst, int width, int value)
+{
+    for(int c = 0; c < width; c++)
+    {
+        dst[c] = qRgb(qBound(0, qRed(src[c]) + value, 255),
+                      qBound(0, qGreen(src[c]) + value, 255),
+                      qBound(0, qBlue(src[c]) + value, 255));
+    }
+}
+
+static void lut_scalar(const QRgb* src, QRgb* dst, int width,
+                       const quint32* red, const quint32* green, const quint32* blue)
+{
+    for(int c = 0; c < width; c++)
+    {
+        QRgb pixel = src[c];
+        dst[c] = red[(pixel >> 16) & 0xff] | green[(pixel >> 8) & 0xff] | blue[pixel & 0xff];
+    }
+}
+
+#ifdef PROG4_X86_SIMD
+
+/******************************************************************************
+ * SSE4.1 kernels, 4 pixels per instruction.
+ *****************************************************************************/
+__attribute__((target("sse4.1")))
+static int grayscale_sse41(const QRgb* src, QRgb* dst, int width)
+{
+    const __m128i mask = _mm_set1_epi32(0xff);
+    const __m128i third = _mm_set1_epi32(43691);
+    const __m128i spread = _mm_set1_epi32(0x010101);
+    const __m128i alpha = _mm_set1_epi32(0xff000000);
+    int c = 0;
+
+    for(; c + 4 <= width; c += 4)
+    {
+        __m128i p = _mm_loadu_si128((const __m128i*)(src + c));
+        __m128i sum = _mm_add_epi32(_mm_and_si128(p, mask),
+                      _mm_add_epi32(_mm_and_si128(_mm_srli_epi32(p, 8), mask),
+                                    _mm_and_si128(_mm_srli_epi32(p, 16), mask)));
+        __m128i gray = _mm_srli_epi32(_mm_mullo_epi32(sum, third), 17);
+
+        _mm_storeu_si128((__m128i*)(dst + c), _mm_or_si128(_mm_mullo_epi32(gray, spread), alpha));
+    }
+
+    return c;
+}
+
+__attribute__((target("sse4.1")))
+static int negate_sse41(const QRgb* src, QRgb* dst, int width)
+{
+    const __m128i rgb = _mm_set1_epi32(0x00ffffff);
+    const __m128i alpha = _mm_set1_epi32(0xff000000);
+    int c = 0;
+
+    for(; c + 4 <= width; c += 4)
+    {
+        __m128i p = _mm_loadu_si128((const __m128i*)(src + c));
+        _mm_storeu_si128((__m128i*)(dst + c), _mm_or_si128(_mm_xor_si128(p, rgb), alpha));
+    }
+
+    return c;
+}
+
+// unsigned x > t is signed (x ^ 0x80) > (t ^ 0x80); the compare mask is
+// already 255 / 0 per channel
+__attribute__((target("sse4.1")))
+static int threshold_sse41(const QRgb* src, QRgb* dst, int width, int threshold)
+{
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+    const __m128i limit = _mm_set1_epi8((char)(threshold ^ 0x80));
+    const __m128i alpha = _mm_set1_epi32(0xff000000);
+    int c = 0;
+
+    for(; c + 4 <= width; c += 4)
+    {
+        __m128i p = _mm_loadu_si128((const __m128i*)(src + c));
+        __m128i above = _mm_cmpgt_epi8(_mm_xor_si128(p, bias), limit);
+
+        _mm_storeu_si128((__m128i*)(dst + c), _mm_or_si128(above, alpha));
+    }
+
+    return c;
+}
+
+__attribute__((target("sse4.1")))
+static int add_saturate_sse41(const QRgb* src, QRgb* dst, int width, int value)
+{
+    const __m128i amount = _mm_set1_epi8((char)qMin(qAbs(value), 255));
+    const __m128i alpha = _mm_set1_epi32(0xff000000);
+    int c = 0;
+
+    for(; c + 4 <= width; c += 4)
+    {
+        __m128i p = _mm_loadu_si128((const __m128i*)(src + c));
+        p = value >= 0 ? _mm_adds_epu8(p, amount) : _mm_subs_epu8(p, amount);
+
+        _mm_storeu_si128((__m128i*)(dst + c), _mm_or_si128(p, alpha));
+    }
+
+    return c;
+}
+
+/******************************************************************************
+ * AVX2 kernels, 8 pixels per instruction.
+ *****************************************************************************/
+__attribute__((target("avx2")))
+static int grayscale_avx2(const QRgb* src, QRgb* dst, int width)
+{
+    const __m256i mask = _mm256_set1_epi32(0xff);
+    const __m256i third = _mm256_set1_epi32(43691);
+    const __m256i spread = _mm256_set1_epi32(0x010101);
+    const __m256i alpha = _mm256_set1_epi32(0xff000000);
+    int c = 0;
+
+    for(; c + 8 <= width; c += 8)
+    {
+        __m256i p = _mm256_loadu_si256((const __m256i*)(src + c));
+        __m256i sum = _mm256_add_epi32(_mm256_and_si256(p, mask),
+                      _mm256_add_epi32(_mm256_and_si256(_mm256_srli_epi32(p, 8), mask),
+                                       _mm256_and_si256(_mm256_srli_epi32(p, 16), mask)));
+        __m256i gray = _mm256_srli_epi32(_mm256_mullo_epi32(sum, third), 17);
+
+        _mm256_storeu_si256((__m256i*)(dst + c), _mm256_or_si256(_mm256_mullo_epi32(gray, spread), alpha));
+    }
+
+    return c;
+}
+
+__attribute__((target("avx2")))
+static int negate_avx2(const QRgb* src, QRgb* dst, int width)
+{
+    const __m256i rgb = _mm256_set1_epi32(0x00ffffff);
+    const __m256i alpha = _mm256_set1_epi32(0xff000000);
+    int c = 0;
+
+    for(; c + 8 <= width; c += 8)
+    {
+        __m256i p = _mm256_loadu_si256((const __m256i*)(src + c));
+        _mm256_storeu_si256((__m256i*)(dst + c), _mm256_or_si256(_mm256_xor_si256(p, rgb), alpha));
+    }
+
+    return c;
+}
+
+__attribute__((target("avx2")))
+static int threshold_avx2(const QRgb* src, QRgb* dst, int width, int threshold)
+{
+    const __m256i bias = _mm256_set1_epi8((char)0x80);
+    const __m256i limit = _mm256_set1_epi8((char)(threshold ^ 0x80));
+    const __m256i alpha = _mm256_set1_epi32(0xff000000);
+    int c = 0;
+
+    for(; c + 8 <= width; c += 8)
+    {
+        __m256i p = _mm256_loadu_si256((const __m256i*)(src + c));
+        __m256i above = _mm256_cmpgt_epi8(_mm256_xor_si256(p, bias), limit);
+
+        _mm256_storeu_si256((__m256i*)(dst + c), _mm256_or_si256(above, alpha));
+    }
+
+    return c;
+}
+
+__attribute__((target("avx2")))
+static int add_saturate_avx2(const QRgb* src, QRgb* dst, int width, int value)
+{
+    const __m256i amount = _mm256_set1_epi8((char)qMin(qAbs(value), 255));
+    const __m256i alpha = _mm256_set1_epi32(0xff000000);
+    int c = 0;
+
+    for(; c + 8 <= width; c += 8)
+    {
+        __m256i p = _mm256_loadu_si256((const __m256i*)(src + c));
+        p = value >= 0 ? _mm256_adds_epu8(p, amount) : _mm256_subs_epu8(p, amount);
+
+        _mm256_storeu_si256((__m256i*)(dst + c), _mm256_or_si256(p, alpha));
+    }
+
+    return c;
+}
+
+// each channel's bytes are the indices of a gather from its table
+__attribute__((target("avx2")))
+static int lut_avx2(const QRgb* src, QRgb* dst, int width,
+                    const quint32* red, const quint32* green, const quint32* blue)
+{
+    const __m256i mask = _mm256_set1_epi32(0xff);
+    int c = 0;
+
+    for(; c + 8 <= width; c += 8)
+    {
+        __m256i p = _mm256_loadu_si256((const __m256i*)(src + c));
+        __m256i r = _mm256_i32gather_epi32((const int*)red, _mm256_and_si256(_mm256_srli_epi32(p, 16), mask), 4);
+        __m256i g = _mm256_i32gather_epi32((const int*)green, _mm256_and_si256(_mm256_srli_epi32(p, 8), mask), 4);
+        __m256i b = _mm256_i32gather_epi32((const int*)blue, _mm256_and_si256(p, mask), 4);
+
+        _mm256_storeu_si256((__m256i*)(dst + c), _mm256_or_si256(r, _mm256_or_si256(g, b)));
+    }
+
+    return c;
+}
+
+#endif // PROG4_X86_SIMD
+
+/******************************************************************************
+ * Function: grayscale_row
+ * Description: The grayscale of a row, the average of the channels.
+ *****************************************************************************/
+void grayscale_row(const QRgb* src, QRgb* dst, int width)
+{
+    int c = 0;
+
+#ifdef PROG4_X86_SIMD
+    if(currentLevel == SIMD_AVX2)
+        c = grayscale_avx2(src, dst, width);
+    else if(currentLevel == SIMD_SSE41)
+        c = grayscale_sse41(src, dst, width);
+#endif
+
+    grayscale_scalar(src + c, dst + c, width - c);
+}
+
+/******************************************************************************
+ * Function: negate_row
+ * Description: 255 - value for each channel of a row.
+ *****************************************************************************/
+void negate_row(const QRgb* src, QRgb* dst, int width)
+{
+    int c = 0;
+
+#ifdef PROG4_X86_SIMD
+    if(currentLevel == SIMD_AVX2)
+        c = negate_avx2(src, dst, width);
+    else if(currentLevel == SIMD_SSE41)
+        c = negate_sse41(src, dst, width);
+#endif
+
+    negate_scalar(src + c, dst + c, width - c);
+}
+
+/******************************************************************************
+ * Function: threshold_row
+ * Description: 255 for each channel above the threshold, 0 otherwise.
+ * Parameters:
+ *   threshold - 0 - 255
+ *****************************************************************************/
+void threshold_row(const QRgb* src, QRgb* dst, int width, int threshold)
+{
+    int c = 0;
+
+#ifdef PROG4_X86_SIMD
+    if(currentLevel == SIMD_AVX2)
+        c = threshold_avx2(src, dst, width, threshold);
+    else if(currentLevel == SIMD_SSE41)
+        c = threshold_sse41(src, dst, width, threshold);
+#endif
+
+    threshold_scalar(src + c, dst + c, width - c, threshold);
+}
+
+/******************************************************************************
+ * Function: add_saturate_row
+ * Description: Adds value to each channel of a row, clamping to 0 - 255.
+ * Parameters:
+ *   value - the amount to add, negative to subtract
+ *****************************************************************************/
+void add_saturate_row(const QRgb* src, QRgb* dst, int width, int value)
+{
+    int c = 0;
+
+#ifdef PROG4_X86_SIMD
+    if(currentLevel == SIMD_AVX2)
+        c = add_saturate_avx2(src, dst, width, value);
+    else if(currentLevel == SIMD_SSE41)
+        c = add_saturate_sse41(src, dst, width, value);
+#endif
+
+    add_saturate_scalar(src + c, dst + c, width - c, value);
+}
+
+/******************************************************************************
+ * Function: lut_row
+ * Description: Looks each channel of a row up in its table and ORs the
+ *  results; see PackedLut. src and dst may be the same row.
+ * Parameters:
+ *   red, green, blue - 256 entry tables, already shifted into place
+ *****************************************************************************/
+void lut_row(const QRgb* src, QRgb* dst, int width,
+             const quint32* red, const quint32* green, const quint32* blue)
+{
+    int c = 0;
+
+#ifdef PROG4_X86_SIMD
+    if(currentLevel == SIMD_AVX2)
+        c = lut_avx2(src, dst, width, red, green, blue);
+#endif
+
+    lut_scalar(src + c, dst + c, width - c, red, green, blue);
+}
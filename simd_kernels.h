@@ -0,0 +1,81 @@
+#ifndef SIMD_KERNELS_H
+#define SIMD_KERNELS_H
+
+#include <QImage>
+
+#include "pixel_access.h"
+#include "filter_progress.h"
+
+/******************************************************************************
+ * Vector row kernels for the cheapest and most used per pixel filters. Each
+ * kernel has an AVX2, an SSE4.1 and a scalar version; the fastest one the
+ * processor supports is picked at run time, so the binary still runs on
+ * machines without AVX2. All three produce the same output bit for bit.
+ * Every kernel writes opaque pixels, like qRgb() does, except lut_row(),
+ * whose tables decide the alpha. lut_row() has no SSE4.1 version, as SSE has
+ * no gather; it runs scalar below AVX2.
+ *****************************************************************************/
+
+enum SimdLevel
+{
+    SIMD_SCALAR,
+    SIMD_SSE41,
+    SIMD_AVX2
+};
+
+SimdLevel supported_simd_level();
+SimdLevel simd_level();
+void set_simd_level(SimdLevel level);
+const char* simd_level_name(SimdLevel level);
+
+void grayscale_row(const QRgb* src, QRgb* dst, int width);
+void negate_row(const QRgb* src, QRgb* dst, int width);
+void threshold_row(const QRgb* src, QRgb* dst, int width, int threshold);
+void add_saturate_row(const QRgb* src, QRgb* dst, int width, int value);
+void lut_row(const QRgb* src, QRgb* dst, int width,
+             const quint32* red, const quint32* green, const quint32* blue);
+
+/******************************************************************************
+ * Function: map_rows
+ * Description: Runs a row kernel over every row of an image in parallel.
+ * Parameters:
+ *   image - the image to process on
+ *   kernel - called as kernel(src, dst, width) for each row
+ *   thread_count - the number of threads to use
+ * Returns: The new image.
+ *****************************************************************************/
+template<class Kernel>
+QImage* map_rows(const QImage& image, Kernel kernel, int thread_count)
+{
+    QImage source = to_argb32(image);
+    QImage* newImage = new_output_image(source.size(), thread_count);
+    QSize size = newImage->size();
+
+    ConstScanlines in(source);
+    Scanlines out(*newImage);
+
+    FilterProgress* progress = FilterProgress::current();
+    progress_add_work(progress, size.height());
+
+#   pragma omp parallel num_threads(thread_count) default(none) \
+        shared(progress, size, in, out, kernel) copyin(traceOperation)
+    {
+        TraceScope trace("map rows", "rows");
+
+#       pragma omp for schedule(runtime) nowait
+        for(int r = 0; r < size.height(); r++)
+        {
+            if(progress_cancelled(progress))
+                continue;
+
+            kernel(in[r], out[r], size.width());
+
+            trace.add_count(1);
+            progress_advance(progress);
+        }
+    }
+
+    return newImage;
+}
+
+#endif // SIMD_KERNELS_H
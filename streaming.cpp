@@ -0,0 +1,291 @@
+#include "streaming.h"
+#include "pixel_access.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+
+/******************************************************************************
+ * Function: read_header_number
+ * Description: Reads the next number of a PPM/PGM header, skipping
+ *  whitespace and # comments.
+ * Returns: The number, or -1 if there is none.
+ *****************************************************************************/
+static int read_header_number(QFile& file)
+{
+    char c;
+
+    do
+    {
+        if(!file.getChar(&c))
+            return -1;
+
+        if(c == '#')
+        {
+            while(c != '\n')
+                if(!file.getChar(&c))
+                    return -1;
+        }
+    } while(c == ' ' || c == '\t' || c == '\r' || c == '\n');
+
+    if(c < '0' || c > '9')
+        return -1;
+
+    qint64 value = 0;
+
+    while(c >= '0' && c <= '9')
+    {
+        value = value * 10 + (c - '0');
+        if(value > 0x7fffffff)
+            return -1;
+
+        if(!file.getChar(&c))
+            return (int)value;
+    }
+
+    //exactly one whitespace character ends the header, so it is consumed here
+    return (int)value;
+}
+
+/******************************************************************************
+ * Class: PnmRowReader
+ * Description: Reads binary PPM (P6) and PGM (P5) files with 8 bit samples
+ *  by seeking straight to the rows. Samples are scaled from 0 - maxval to
+ *  0 - 255.
+ *****************************************************************************/
+class PnmRowReader : public ImageRowReader
+{
+public:
+    explicit PnmRowReader(const QString& fileName) :
+        file(fileName),
+        channels(0),
+        dataOffset(0)
+    {
+    }
+
+    bool open(QString* error)
+    {
+        if(!file.open(QIODevice::ReadOnly))
+        {
+            *error = file.errorString();
+            return false;
+        }
+
+        char magic[2];
+        if(file.read(magic, 2) != 2 || magic[0] != 'P' || (magic[1] != '6' && magic[1] != '5'))
+        {
+            *error = "not a binary PPM or PGM file";
+            return false;
+        }
+        channels = magic[1] == '6' ? 3 : 1;
+
+        int width = read_header_number(file);
+        int height = read_header_number(file);
+        int maxValue = read_header_number(file);
+
+        if(width <= 0 || height <= 0 || maxValue <= 0)
+        {
+            *error = "invalid header";
+            return false;
+        }
+        if(maxValue > 255)
+        {
+            *error = "16 bit samples are not supported";
+            return false;
+        }
+
+        //samples over maxval are out of spec, read them as white
+        for(int v = 0; v < 256; v++)
+            levels[v] = (uchar)(v >= maxValue ? 255 : (v * 255 + maxValue / 2) / maxValue);
+
+        imageSize = QSize(width, height);
+        dataOffset = file.pos();
+
+        return true;
+    }
+
+    QSize size() const { return imageSize; }
+
+    bool read_rows(int first, int count, QRgb* dst)
+    {
+        qint64 rowBytes = (qint64)imageSize.width() * channels;
+        int width = imageSize.width();
+
+        buffer.resize(rowBytes * count);
+
+        if(!file.seek(dataOffset + rowBytes * first) ||
+           file.read(buffer.data(), buffer.size()) != buffer.size())
+            return false;
+
+        const uchar* src = reinterpret_cast<const uchar*>(buffer.constData());
+        size_t pixels = (size_t)width * count;
+
+        if(channels == 3)
+        {
+            for(size_t i = 0; i < pixels; i++)
+                dst[i] = qRgb(levels[src[3 * i]], levels[src[3 * i + 1]], levels[src[3 * i + 2]]);
+        }
+        else
+        {
+            for(size_t i = 0; i < pixels; i++)
+                dst[i] = qRgb(levels[src[i]], levels[src[i]], levels[src[i]]);
+        }
+
+        return true;
+    }
+
+private:
+    QFile file;
+    QSize imageSize;
+    int channels;
+    qint64 dataOffset;
+    uchar levels[256];          // each sample value scaled to 0 - 255
+    QByteArray buffer;
+};
+
+/******************************************************************************
+ * Class: PpmRowWriter
+ * Description: Writes a binary PPM (P6) file a band of rows at a time.
+ *****************************************************************************/
+class PpmRowWriter : public ImageRowWriter
+{
+public:
+    PpmRowWriter(const QString& fileName, const QSize& size) :
+        file(fileName),
+        imageSize(size)
+    {
+    }
+
+    bool open(QString* error)
+    {
+        if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        {
+            *error = file.errorString();
+            return false;
+        }
+
+        QByteArray header = QString("P6\n%1 %2\n255\n").arg(imageSize.width()).arg(imageSize.height()).toLatin1();
+
+        return file.write(header) == header.size();
+    }
+
+    bool write_rows(const QRgb* src, int count)
+    {
+        size_t pixels = (size_t)imageSize.width() * count;
+
+        buffer.resize(pixels * 3);
+        uchar* dst = reinterpret_cast<uchar*>(buffer.data());
+
+        for(size_t i = 0; i < pixels; i++)
+        {
+            dst[3 * i]     = qRed(src[i]);
+            dst[3 * i + 1] = qGreen(src[i]);
+            dst[3 * i + 2] = qBlue(src[i]);
+        }
+
+        return file.write(buffer) == buffer.size();
+    }
+
+private:
+    QFile file;
+    QSize imageSize;
+    QByteArray buffer;
+};
+
+/******************************************************************************
+ * Function: open_row_reader
+ * Description: Opens an image for reading a band of rows at a time. Only
+ *  binary PPM/PGM files can be.
+ * Parameters:
+ *   fileName - the image file
+ *   error - receives the reason when the file cannot be streamed
+ * Returns: The reader, owned by the caller, or NULL.
+ *****************************************************************************/
+ImageRowReader* open_row_reader(const QString& fileName, QString* error)
+{
+    QString suffix = QFileInfo(fileName).suffix().toLower();
+
+    if(suffix == "ppm" || suffix == "pgm" || suffix == "pnm")
+    {
+        PnmRowReader* reader = new PnmRowReader(fileName);
+        if(!reader->open(error))
+        {
+            delete reader;
+            return NULL;
+        }
+        return reader;
+    }
+
+    //compressed formats decode from the top of the file for every band, even
+    //through a clip rectangle, so streaming them would cost height^2 / strip
+    QImageReader reader(fileName);
+
+    if(!reader.canRead())
+        *error = reader.errorString();
+    else
+        *error = QString("%1 files cannot be read a band of rows at a time; convert it to PPM")
+                 .arg(QString(reader.format()));
+
+    return NULL;
+}
+
+/******************************************************************************
+ * Function: open_row_writer
+ * Description: Creates an image to be written a band of rows at a time.
+ *  Only PPM output can be encoded that way.
+ * Returns: The writer, owned by the caller, or NULL.
+ *****************************************************************************/
+ImageRowWriter* open_row_writer(const QString& fileName, const QSize& size, QString* error)
+{
+    if(QFileInfo(fileName).suffix().toLower() != "ppm")
+    {
+        *error = "streamed output must be a .ppm file";
+        return NULL;
+    }
+
+    PpmRowWriter* writer = new PpmRowWriter(fileName, size);
+    if(!writer->open(error))
+    {
+        delete writer;
+        return NULL;
+    }
+
+    return writer;
+}
+
+/******************************************************************************
+ * Function: stream_image
+ * Description: Runs a filter chain over an image file without loading it
+ *  whole, writing the result strip by strip.
+ * Parameters:
+ *   input - the file to read
+ *   output - the .ppm file to write
+ *   pipeline - the filter chain, which must be streamable
+ *   strip_rows - output rows per strip, 0 for the default
+ *   thread_count - the number of threads to use
+ *   error - receives the reason on failure
+ * Returns: true on success.
+ *****************************************************************************/
+bool stream_image(const QString& input, const QString& output, const Pipeline& pipeline,
+                  int strip_rows, int thread_count, QString* error)
+{
+    ImageRowReader* reader = open_row_reader(input, error);
+    if(reader == NULL)
+        return false;
+
+    ImageRowWriter* writer = open_row_writer(output, reader->size(), error);
+    if(writer == NULL)
+    {
+        delete reader;
+        return false;
+    }
+
+    bool ok = pipeline.run_stream(*reader, *writer, strip_rows, thread_count);
+    if(!ok)
+        *error = "read or write failed";
+
+    delete writer;
+    delete reader;
+
+    return ok;
+}
@@ -0,0 +1,62 @@
+#ifndef STREAMING_H
+#define STREAMING_H
+
+#include <QImage>
+#include <QString>
+
+#include "pipeline.h"
+
+// Strips streamed by Pipeline::run_stream() are sized to about this much
+#define STREAM_STRIP_BYTES (32 * 1024 * 1024)
+
+/******************************************************************************
+ * Out of core processing for images larger than memory.
+ *
+ * Instead of decoding the whole image, the source is read a band of rows at
+ * a time through an ImageRowReader, the filter chain runs over each strip of
+ * output rows with the halo its kernels need, and the result is encoded strip
+ * by strip through an ImageRowWriter. Memory use depends on the image width
+ * and the strip size, not on the image height.
+ *
+ * Binary PPM/PGM files are read and written directly, seeking to the rows.
+ * Other formats are refused: Qt has no scanline reading, and decoding a clip
+ * rectangle of a JPEG still decodes every row above it, so each band would
+ * cost more than the last. Output is written as binary PPM, the one format
+ * here that can be encoded a strip at a time.
+ *****************************************************************************/
+
+/******************************************************************************
+ * Class: ImageRowReader
+ * Description: Reads bands of rows of an image, in any order, each at a
+ *  cost that does not depend on where the band is.
+ *****************************************************************************/
+class ImageRowReader
+{
+public:
+    virtual ~ImageRowReader() {}
+
+    virtual QSize size() const = 0;
+
+    // Reads count rows from row first into dst, size().width() pixels a row
+    virtual bool read_rows(int first, int count, QRgb* dst) = 0;
+};
+
+/******************************************************************************
+ * Class: ImageRowWriter
+ * Description: Writes an image a band of rows at a time, top to bottom.
+ *****************************************************************************/
+class ImageRowWriter
+{
+public:
+    virtual ~ImageRowWriter() {}
+
+    virtual bool write_rows(const QRgb* src, int count) = 0;
+};
+
+ImageRowReader* open_row_reader(const QString& fileName, QString* error);
+ImageRowWriter* open_row_writer(const QString& fileName, const QSize& size, QString* error);
+
+bool stream_image(const QString& input, const QString& output, const Pipeline& pipeline,
+                  int strip_rows, int thread_count, QString* error);
+
+#endif // STREAMING_H
@@ -0,0 +1,261 @@
+#include "thread_policy.h"
+
+#include <atomic>
+#include <cstring>
+
+/******************************************************************************
+ * Struct: FilterSchedule
+ * Description: The schedule a filter's loops run with.
+ *****************************************************************************/
+struct FilterSchedule
+{
+    const char* filter;
+    SchedulePolicy policy;
+    int chunk;              // iterations per grab, 0 for the run time default
+};
+
+// Filters that are not listed run static. The kernel filters' loops are over
+// tiles, where the edge tiles take the slower clamped path; the others are
+// over rows.
+static const FilterSchedule schedules[] =
+{
+    {"smooth", SCHEDULE_GUIDED, 1},
+    {"gaussian", SCHEDULE_GUIDED, 1},
+    {"sharpen", SCHEDULE_GUIDED, 1},
+    {"gradient", SCHEDULE_GUIDED, 1},
+    {"laplacian", SCHEDULE_GUIDED, 1},
+    {"emboss", SCHEDULE_DYNAMIC, 16},
+    {"fft", SCHEDULE_DYNAMIC, 1},
+    {"gaussian_blur", SCHEDULE_GUIDED, 4},
+    {"box_blur", SCHEDULE_GUIDED, 4},
+    {"clahe", SCHEDULE_DYNAMIC, 1}
+};
+
+static const int schedule_count = sizeof(schedules) / sizeof(schedules[0]);
+
+static std::atomic<int> scheduleOverride(SCHEDULE_FILTER);
+
+/******************************************************************************
+ * Function: find_filter_schedule
+ * Description: The table entry for a filter.
+ * Returns: The entry, or NULL for filters that run static.
+ *****************************************************************************/
+static const FilterSchedule* find_filter_schedule(const char* filter)
+{
+    for(int i = 0; i < schedule_count; i++)
+        if(strcmp(schedules[i].filter, filter) == 0)
+            return &schedules[i];
+
+    return NULL;
+}
+
+/******************************************************************************
+ * Function: filter_schedule
+ * Description: The schedule a filter's loops run with, after the override.
+ * Parameters:
+ *   filter - the filter name, as in the filter registry
+ *****************************************************************************/
+SchedulePolicy filter_schedule(const char* filter)
+{
+    SchedulePolicy policy = (SchedulePolicy)scheduleOverride.load();
+    if(policy != SCHEDULE_FILTER && policy != SCHEDULE_PLACED)
+        return policy;
+
+    const FilterSchedule* entry = find_filter_schedule(filter);
+    return entry != NULL ? entry->policy : SCHEDULE_STATIC;
+}
+
+ScheduleScope::ScheduleScope(const char* filter)
+{
+    omp_get_schedule(&previousKind, &previousChunk);
+
+    const FilterSchedule* entry = find_filter_schedule(filter);
+    int chunk = entry != NULL ? entry->chunk : 0;
+
+    switch(filter_schedule(filter))
+    {
+    case SCHEDULE_DYNAMIC:
+        omp_set_schedule(omp_sched_dynamic, chunk > 0 ? chunk : 1);
+        break;
+    case SCHEDULE_GUIDED:
+        omp_set_schedule(omp_sched_guided, chunk > 0 ? chunk : 1);
+        break;
+    default:
+        omp_set_schedule(omp_sched_static, 0);
+        break;
+    }
+}
+
+ScheduleScope::~ScheduleScope()
+{
+    omp_set_schedule(previousKind, previousChunk);
+}
+
+/******************************************************************************
+ * Function: set_schedule_override
+ * Description: Runs every filter with one policy, or with SCHEDULE_FILTER,
+ *  each with its own again, or SCHEDULE_PLACED, each with its own except
+ *  where a PlacementScope applies.
+ *****************************************************************************/
+void set_schedule_override(SchedulePolicy policy)
+{
+    scheduleOverride.store(policy);
+}
+
+const char* schedule_name(SchedulePolicy policy)
+{
+    switch(policy)
+    {
+    case SCHEDULE_STATIC:
+        return "static";
+    case SCHEDULE_DYNAMIC:
+        return "dynamic";
+    case SCHEDULE_GUIDED:
+        return "guided";
+    case SCHEDULE_PLACED:
+        return "placed";
+    default:
+        return "filter";
+    }
+}
+
+/******************************************************************************
+ * Function: find_schedule
+ * Description: Parses a policy name as printed by schedule_name().
+ * Returns: true if the name is a policy.
+ *****************************************************************************/
+bool find_schedule(const QString& name, SchedulePolicy& policy)
+{
+    const SchedulePolicy policies[] = {SCHEDULE_FILTER, SCHEDULE_STATIC, SCHEDULE_DYNAMIC, SCHEDULE_GUIDED,
+                                       SCHEDULE_PLACED};
+
+    for(int i = 0; i < 5; i++)
+    {
+        if(name == QLatin1String(schedule_name(policies[i])))
+        {
+            policy = policies[i];
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/******************************************************************************
+ * Function: first_touched
+ * Description: Whether first_touch() places the pages of an image written by
+ *  this many threads.
+ *****************************************************************************/
+bool first_touched(const QImage& image, int thread_count)
+{
+    return thread_count >= 2 && (qint64)image.bytesPerLine() * image.height() >= FIRST_TOUCH_MIN_BYTES;
+}
+
+/******************************************************************************
+ * Function: placed_output
+ * Description: Whether the loops writing an image run static to match its
+ *  first touch; see PlacementScope.
+ *****************************************************************************/
+bool placed_output(const QImage& image, int thread_count)
+{
+    return first_touched(image, thread_count) && scheduleOverride.load() == SCHEDULE_PLACED;
+}
+
+/******************************************************************************
+ * Function: placement_applies
+ * Description: placed_output() for an ARGB32 image of this size, before it
+ *  is allocated.
+ *****************************************************************************/
+bool placement_applies(const QSize& size, int thread_count)
+{
+    return thread_count >= 2 && (qint64)size.width() * 4 * size.height() >= FIRST_TOUCH_MIN_BYTES &&
+           scheduleOverride.load() == SCHEDULE_PLACED;
+}
+
+PlacementScope::PlacementScope(const QImage& image, int thread_count)
+{
+    omp_get_schedule(&previousKind, &previousChunk);
+
+    if(placed_output(image, thread_count))
+        omp_set_schedule(omp_sched_static, 0);
+}
+
+PlacementScope::~PlacementScope()
+{
+    omp_set_schedule(previousKind, previousChunk);
+}
+
+/******************************************************************************
+ * Function: first_touch
+ * Description: Writes to every page of a newly allocated image from the
+ *  thread that a static row loop gives the page's rows to. Linux places a
+ *  page in the memory of the socket that first writes it, so this keeps a
+ *  large output from ending up on the socket of the thread that allocated
+ *  it. The pixel values are left undefined.
+ * Parameters:
+ *   image - the new image
+ *   thread_count - the number of threads the filter will use
+ *****************************************************************************/
+void first_touch(QImage& image, int thread_count)
+{
+    int height = image.height();
+    int stride = image.bytesPerLine();
+
+    if(!first_touched(image, thread_count))
+        return;
+
+    uchar* bits = image.bits();
+
+#   pragma omp parallel for num_threads(thread_count) schedule(static) default(none) \
+        shared(bits, stride, height)
+    for(int r = 0; r < height; r++)
+    {
+        uchar* row = bits + (qptrdiff)r * stride;
+
+        for(int offset = 0; offset < stride; offset += 4096)
+            row[offset] = 0;
+    }
+}
+
+/******************************************************************************
+ * Function: setup_threads
+ * Description: Called first thing in main(), so loops outside any
+ *  ScheduleScope run static. Threads are left unbound: with OMP_PROC_BIND
+ *  set, the run time pins the initial thread to the first place, and in the
+ *  GUI every worker thread it starts would inherit that one core. Batch runs
+ *  and benchmarks can set OMP_PLACES=cores OMP_PROC_BIND=spread,close.
+ *****************************************************************************/
+void setup_threads()
+{
+    omp_set_schedule(omp_sched_static, 0);
+}
+
+/******************************************************************************
+ * Function: thread_binding_description
+ * Description: The thread binding in effect, for reports.
+ *****************************************************************************/
+QString thread_binding_description()
+{
+    const char* binding;
+
+    switch(omp_get_proc_bind())
+    {
+    case omp_proc_bind_false:
+        binding = "unbound";
+        break;
+    case omp_proc_bind_true:
+        binding = "bound";
+        break;
+    case omp_proc_bind_master:
+        binding = "master";
+        break;
+    case omp_proc_bind_close:
+        binding = "close";
+        break;
+    default:
+        binding = "spread";
+        break;
+    }
+
+    return QString("%1, %2 places").arg(binding).arg(omp_get_num_places());
+}
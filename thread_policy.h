@@ -0,0 +1,94 @@
+#ifndef THREAD_POLICY_H
+#define THREAD_POLICY_H
+
+#include <QImage>
+#include <QString>
+
+#include <omp.h>
+
+// Output images smaller than this are not worth touching in parallel
+#define FIRST_TOUCH_MIN_BYTES (4 * 1024 * 1024)
+
+/******************************************************************************
+ * How the filters spread their work over threads.
+ *
+ * The filters' row and tile loops are declared schedule(runtime), and each
+ * filter opens a ScheduleScope with its name on entry, which sets the
+ * schedule those loops use from a table of per filter policies: static for
+ * loops whose iterations all cost the same, dynamic or guided for the ones
+ * that do not (the FFT passes, the kernel filters' clamped edge tiles, the
+ * blurs' padded rows). set_schedule_override() replaces the table, so the
+ * benchmarks can compare the policies.
+ *
+ * new_output_image() has the threads that will write an image's rows touch
+ * them first, in the row bands a static loop gives each thread, so when the
+ * threads are bound to cores (OMP_PLACES and OMP_PROC_BIND) each band's pages
+ * are placed in the memory of the socket that works on it. That only holds
+ * if the loop that fills the image hands out the same bands, which dynamic
+ * and guided loops do not. SCHEDULE_PLACED keeps each filter's policy but
+ * runs the loops that write a first-touched image static, through their
+ * PlacementScope; whether that beats the table is for the benchmark to say.
+ *****************************************************************************/
+
+enum SchedulePolicy
+{
+    SCHEDULE_FILTER,        // the filter's own policy from the table
+    SCHEDULE_STATIC,
+    SCHEDULE_DYNAMIC,
+    SCHEDULE_GUIDED,
+    SCHEDULE_PLACED         // the filter's own, but static writing placed outputs
+};
+
+/******************************************************************************
+ * Class: ScheduleScope
+ * Description: Sets the schedule of the schedule(runtime) loops run by the
+ *  calling thread for the lifetime of the scope.
+ *****************************************************************************/
+class ScheduleScope
+{
+public:
+    explicit ScheduleScope(const char* filter);
+    ~ScheduleScope();
+
+private:
+    omp_sched_t previousKind;
+    int previousChunk;
+
+    ScheduleScope(const ScheduleScope&);
+    ScheduleScope& operator=(const ScheduleScope&);
+};
+
+/******************************************************************************
+ * Class: PlacementScope
+ * Description: Under SCHEDULE_PLACED, runs the schedule(runtime) loops that
+ *  write an image static for the lifetime of the scope if first_touch()
+ *  placed the image's pages, so each thread writes the rows it touched.
+ *  Under any other policy it does nothing.
+ *****************************************************************************/
+class PlacementScope
+{
+public:
+    PlacementScope(const QImage& image, int thread_count);
+    ~PlacementScope();
+
+private:
+    omp_sched_t previousKind;
+    int previousChunk;
+
+    PlacementScope(const PlacementScope&);
+    PlacementScope& operator=(const PlacementScope&);
+};
+
+SchedulePolicy filter_schedule(const char* filter);
+void set_schedule_override(SchedulePolicy policy);
+const char* schedule_name(SchedulePolicy policy);
+bool find_schedule(const QString& name, SchedulePolicy& policy);
+
+bool first_touched(const QImage& image, int thread_count);
+bool placed_output(const QImage& image, int thread_count);
+bool placement_applies(const QSize& size, int thread_count);
+void first_touch(QImage& image, int thread_count);
+void setup_threads();
+QString thread_binding_description();
+
+#endif // THREAD_POLICY_H
@@ -0,0 +1,247 @@
+#include "thread_tuner.h"
+#include "filter_registry.h"
+#include "pixel_access.h"
+#include "trace.h"
+#include "qt_compat.h"
+
+#include <QMutexLocker>
+#include <QSettings>
+#include <QStringList>
+#include <QThread>
+
+#include <omp.h>
+
+ThreadTuner::ThreadTuner() :
+    maxThreads(qMax(1, omp_get_num_procs())),
+    cancelled(false),
+    paused(0),
+    pauses(0)
+{
+}
+
+/******************************************************************************
+ * Function: ThreadTuner::pause
+ * Description: Holds calibrate() before its next timing until the matching
+ *  resume(), and makes it time again the run it may be in the middle of.
+ *****************************************************************************/
+void ThreadTuner::pause()
+{
+    paused.fetch_add(1);
+    pauses.fetch_add(1);
+}
+
+/******************************************************************************
+ * Function: ThreadTuner::wait_while_paused
+ * Description: Sleeps while a job has calibration paused, or until cancel().
+ * Returns: The pause() count to compare against after a timing; if it has
+ *  changed, a job ran during the timing.
+ *****************************************************************************/
+int ThreadTuner::wait_while_paused() const
+{
+    while(paused.load() > 0 && !cancelled.load())
+        QThread::msleep(20);
+
+    return pauses.load();
+}
+
+/******************************************************************************
+ * Function: ThreadTuner::load
+ * Description: Reads the results of an earlier calibration.
+ * Returns: true if there were saved results for every filter, measured on a
+ *  machine with the same processor count.
+ *****************************************************************************/
+bool ThreadTuner::load()
+{
+    QSettings settings("prog4", "prog4");
+    settings.beginGroup("threads");
+
+    if(settings.value("version").toInt() != TUNE_VERSION ||
+       settings.value("processors").toInt() != maxThreads)
+        return false;
+
+    QStringList names = filter_names();
+    QHash<QString, QVector<int> > saved;
+
+    for(int i = 0; i < names.size(); i++)
+    {
+        QStringList values = settings.value(names[i]).toString().split(',', SKIP_EMPTY_PARTS);
+        if(values.size() != TUNE_SIZE_COUNT)
+            return false;
+
+        QVector<int> counts;
+        for(int s = 0; s < values.size(); s++)
+            counts << qBound(1, values[s].toInt(), maxThreads);
+
+        saved[names[i]] = counts;
+    }
+
+    QMutexLocker lock(&mutex);
+    best = saved;
+
+    return true;
+}
+
+/******************************************************************************
+ * Function: ThreadTuner::save
+ * Description: Stores the calibration results for the next run.
+ *****************************************************************************/
+void ThreadTuner::save() const
+{
+    QSettings settings("prog4", "prog4");
+    settings.beginGroup("threads");
+
+    settings.setValue("version", TUNE_VERSION);
+    settings.setValue("processors", maxThreads);
+
+    QMutexLocker lock(&mutex);
+
+    for(QHash<QString, QVector<int> >::const_iterator entry = best.constBegin(); entry != best.constEnd(); ++entry)
+    {
+        QStringList values;
+        for(int s = 0; s < entry.value().size(); s++)
+            values << QString::number(entry.value()[s]);
+
+        settings.setValue(entry.key(), values.join(","));
+    }
+}
+
+/******************************************************************************
+ * Function: ThreadTuner::calibrate
+ * Description: Times every filter and saves the results. Takes a few seconds
+ *  on a large machine; meant to run on a background thread. Returns early,
+ *  keeping what it has measured, once cancel() is called.
+ *****************************************************************************/
+void ThreadTuner::calibrate()
+{
+    TraceOperation operation("Calibrate threads");
+
+    const int sides[] = TUNE_SIZES;
+    QStringList names = filter_names();
+
+    for(int i = 0; i < names.size(); i++)
+    {
+        QVector<int> counts;
+
+        for(int s = 0; s < TUNE_SIZE_COUNT; s++)
+        {
+            int count = best_thread_count(names[i], sides[s]);
+
+            if(cancelled.load())
+                return;
+
+            counts << count;
+        }
+
+        QMutexLocker lock(&mutex);
+        best[names[i]] = counts;
+    }
+
+    save();
+}
+
+/******************************************************************************
+ * Function: ThreadTuner::best_thread_count
+ * Description: Times one filter on a synthetic square image with 1, 2, 4 ...
+ *  threads up to all the processors, stopping once more threads take twice
+ *  as long as the fastest count so far.
+ * Parameters:
+ *   filter - the filter name
+ *   side - the image width and height
+ * Returns: The smallest count within TUNE_TOLERANCE of the fastest.
+ *****************************************************************************/
+int ThreadTuner::best_thread_count(const QString& filter, int side) const
+{
+    const FilterInfo* info = find_filter(filter);
+
+    //some structure, so the filters have edges and a spread of values
+    QImage image(side, side, QImage::Format_ARGB32);
+    Scanlines out(image);
+    for(int r = 0; r < side; r++)
+        for(int c = 0; c < side; c++)
+            out[r][c] = qRgb((c * 7 + r) & 0xff, (r * 3) & 0xff, ((c ^ r) * 5) & 0xff);
+
+    QVector<int> counts;
+    QVector<double> times;
+    double fastest = 0;
+
+    for(int threads = 1; !cancelled.load(); threads = qMin(threads * 2, maxThreads))
+    {
+        double time = 0;
+
+        for(int run = 0; run < TUNE_RUNS && !cancelled.load(); run++)
+        {
+            int before = wait_while_paused();
+            if(cancelled.load())
+                break;
+
+            double start = omp_get_wtime();
+            delete info->function(image, threads);
+            double elapsed = omp_get_wtime() - start;
+
+            //shared the cores with a job, time it again
+            if(pauses.load() != before)
+            {
+                run--;
+                continue;
+            }
+
+            if(run == 0 || elapsed < time)
+                time = elapsed;
+        }
+
+        counts << threads;
+        times << time;
+
+        if(counts.size() == 1 || time < fastest)
+            fastest = time;
+
+        if(threads == maxThreads || time > 2 * fastest)
+            break;
+    }
+
+    for(int i = 0; i < counts.size(); i++)
+        if(times[i] <= fastest * TUNE_TOLERANCE)
+            return counts[i];
+
+    return 1;
+}
+
+/******************************************************************************
+ * Function: ThreadTuner::threads
+ * Description: The number of threads to run a filter with.
+ * Parameters:
+ *   filter - the filter name, as in the filter registry
+ *   size - the image size
+ * Returns: A count from 1 to max_threads().
+ *****************************************************************************/
+int ThreadTuner::threads(const QString& filter, const QSize& size) const
+{
+    qint64 pixels = (qint64)size.width() * size.height();
+
+    QMutexLocker lock(&mutex);
+
+    QHash<QString, QVector<int> >::const_iterator entry = best.constFind(filter);
+    if(entry == best.constEnd())
+        return (int)qBound<qint64>(1, pixels / TUNE_FALLBACK_PIXELS, maxThreads);
+
+    const int sides[] = TUNE_SIZES;
+    const QVector<int>& counts = entry.value();
+
+    //past the largest size, keep its pixels per thread
+    qint64 largest = (qint64)sides[TUNE_SIZE_COUNT - 1] * sides[TUNE_SIZE_COUNT - 1];
+    if(pixels > largest)
+        return (int)qBound<qint64>(1, counts[TUNE_SIZE_COUNT - 1] * pixels / largest, maxThreads);
+
+    //the nearest size by ratio: past the geometric mean of two sizes, the larger
+    int nearest = 0;
+    for(int s = 1; s < TUNE_SIZE_COUNT; s++)
+    {
+        qint64 smaller = (qint64)sides[s - 1] * sides[s - 1];
+        qint64 larger = (qint64)sides[s] * sides[s];
+
+        if(pixels * pixels >= smaller * larger)
+            nearest = s;
+    }
+
+    return counts[nearest];
+}
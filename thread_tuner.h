@@ -0,0 +1,82 @@
+#ifndef THREAD_TUNER_H
+#define THREAD_TUNER_H
+
+#include <QHash>
+#include <QMutex>
+#include <QSize>
+#include <QString>
+#include <QVector>
+
+#include <atomic>
+
+// Bump when the calibration changes, so saved results are measured again
+#define TUNE_VERSION 1
+
+// Sides of the square images the calibration times each filter on
+#define TUNE_SIZES {256, 512, 1024}
+#define TUNE_SIZE_COUNT 3
+
+// Runs per thread count; the fastest one counts
+#define TUNE_RUNS 3
+
+// Fewer threads are preferred unless more are this much faster
+#define TUNE_TOLERANCE 1.05
+
+// Before calibration, one thread per this many pixels
+#define TUNE_FALLBACK_PIXELS 65536
+
+/******************************************************************************
+ * Class: ThreadTuner
+ * Description: Picks the number of threads to run a filter with on an image
+ *  of a given size.
+ *
+ * calibrate() times every registered filter on synthetic images of a few
+ * sizes, doubling the thread count from one up to all the processors, and
+ * keeps for each filter and size the smallest count that is within
+ * TUNE_TOLERANCE of the fastest. Small images often run fastest on one or
+ * two threads, since starting a team costs more than the work it shares.
+ * threads() looks up the nearest calibrated size; larger images scale the
+ * count of the largest size by their pixel count, up to all the processors.
+ *
+ * The results are saved with QSettings and reused as long as the processor
+ * count and TUNE_VERSION match. threads() may be called while calibrate()
+ * runs on another thread. A filter running at the same time would compete
+ * for the cores and skew the timings, so the caller pauses calibration
+ * around its jobs with pause() and resume(); a timing that overlapped a
+ * pause is thrown away and measured again. Filters not calibrated yet, and
+ * work that is not a registered filter such as the undo history's, get one
+ * thread per TUNE_FALLBACK_PIXELS pixels.
+ *****************************************************************************/
+class ThreadTuner
+{
+public:
+    ThreadTuner();
+
+    bool load();
+    void save() const;
+    void calibrate();
+    void cancel() { cancelled.store(true); }
+
+    void pause();
+    void resume() { paused.fetch_sub(1); }
+
+    int threads(const QString& filter, const QSize& size) const;
+    int max_threads() const { return maxThreads; }
+
+private:
+    int best_thread_count(const QString& filter, int side) const;
+    int wait_while_paused() const;
+
+    mutable QMutex mutex;
+    QHash<QString, QVector<int> > best;     // per filter, per TUNE_SIZES side
+
+    int maxThreads;
+    std::atomic<bool> cancelled;
+    std::atomic<int> paused;            // jobs that calibration waits for
+    std::atomic<int> pauses;            // pause() calls so far
+
+    ThreadTuner(const ThreadTuner&);
+    ThreadTuner& operator=(const ThreadTuner&);
+};
+
+#endif // THREAD_TUNER_H
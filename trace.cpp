@@ -0,0 +1,286 @@
+#include "trace.h"
+#include "buffer_pool.h"
+
+#include <QFile>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include <omp.h>
+
+#include <atomic>
+
+/******************************************************************************
+ * Struct: TraceEvent
+ * Description: A completed scope or operation.
+ *****************************************************************************/
+struct TraceEvent
+{
+    QString name;
+    const char* category;
+    double start;           // seconds since traceEpoch
+    double duration;        // seconds
+    int thread;
+    int operation;
+    const char* counter;
+    qint64 count;
+
+    // operations only: buffer pool allocations during it, bytes at its end
+    qint64 poolHits;
+    qint64 poolMisses;
+    qint64 poolInUse;
+    qint64 poolIdle;
+};
+
+static QMutex traceMutex;
+static QList<TraceEvent> traceEvents;
+
+static const double traceEpoch = omp_get_wtime();
+
+static std::atomic<bool> traceEnabled(false);
+
+// The id of the latest operation, 0 before the first one
+static std::atomic<int> operationCount(0);
+
+__thread int traceOperation = 0;
+
+// Operations up to this one have had their events dropped
+static int trimmedOperation = 0;
+
+// Small thread numbers for the trace, in order of first use
+static std::atomic<int> threadCount(0);
+static thread_local int threadId = -1;
+
+static int trace_thread()
+{
+    if(threadId < 0)
+        threadId = threadCount.fetch_add(1);
+
+    return threadId;
+}
+
+/******************************************************************************
+ * Function: record
+ * Description: Adds an event, dropping the events of operations that have
+ *  fallen out of the kept window, wherever they are in the list: a long
+ *  operation's events sit among those of the ones started after it. Then
+ *  drops the oldest events over TRACE_MAX_EVENTS.
+ *****************************************************************************/
+static void record(const TraceEvent& event)
+{
+    QMutexLocker lock(&traceMutex);
+
+    int oldest = operationCount.load() - TRACE_MAX_OPERATIONS;
+
+    if(event.operation > oldest)
+        traceEvents << event;
+
+    if(oldest > trimmedOperation)
+    {
+        QList<TraceEvent> kept;
+        for(int i = 0; i < traceEvents.size(); i++)
+            if(traceEvents[i].operation > oldest)
+                kept << traceEvents[i];
+
+        traceEvents = kept;
+        trimmedOperation = oldest;
+    }
+
+    while(traceEvents.size() > TRACE_MAX_EVENTS)
+        traceEvents.removeFirst();
+}
+
+/******************************************************************************
+ * Function: trace_set_enabled
+ * Description: Turns recording on or off for the scopes and operations
+ *  started from now on.
+ *****************************************************************************/
+void trace_set_enabled(bool enabled)
+{
+    traceEnabled.store(enabled);
+}
+
+TraceScope::TraceScope(const char* name, const char* counter) :
+    name(name),
+    counter(counter),
+    count(0),
+    start(0),
+    enabled(traceEnabled.load())
+{
+    if(enabled)
+        start = omp_get_wtime();
+}
+
+TraceScope::~TraceScope()
+{
+    if(!enabled)
+        return;
+
+    double end = omp_get_wtime();
+
+    TraceEvent event;
+    event.name = QString::fromLatin1(name);
+    event.category = "phase";
+    event.start = start - traceEpoch;
+    event.duration = end - start;
+    event.thread = trace_thread();
+    event.operation = traceOperation;
+    event.counter = counter;
+    event.count = count;
+    event.poolHits = event.poolMisses = event.poolInUse = event.poolIdle = 0;
+
+    record(event);
+}
+
+TraceOperation::TraceOperation(const QString& name) :
+    name(name),
+    id(0),
+    previous(0),
+    start(0),
+    poolHits(0),
+    poolMisses(0),
+    enabled(traceEnabled.load())
+{
+    if(!enabled)
+        return;
+
+    id = operationCount.fetch_add(1) + 1;
+    previous = traceOperation;
+    traceOperation = id;
+    start = omp_get_wtime();
+
+    BufferPoolStats pool = buffer_pool_stats();
+
+    poolHits = pool.hits;
+    poolMisses = pool.misses;
+}
+
+TraceOperation::~TraceOperation()
+{
+    if(!enabled)
+        return;
+
+    double end = omp_get_wtime();
+    BufferPoolStats pool = buffer_pool_stats();
+
+    TraceEvent event;
+    event.name = name;
+    event.category = "operation";
+    event.start = start - traceEpoch;
+    event.duration = end - start;
+    event.thread = trace_thread();
+    event.operation = id;
+    event.counter = NULL;
+    event.count = 0;
+    event.poolHits = pool.hits - poolHits;
+    event.poolMisses = pool.misses - poolMisses;
+    event.poolInUse = pool.inUse;
+    event.poolIdle = pool.idle;
+
+    record(event);
+
+    traceOperation = previous;
+}
+
+/******************************************************************************
+ * Function: json_string
+ * Description: Quotes text as a JSON string, escaping quotes, backslashes
+ *  and control characters.
+ *****************************************************************************/
+QByteArray json_string(const QString& text)
+{
+    QByteArray escaped = "\"";
+    QByteArray utf8 = text.toUtf8();
+
+    for(int i = 0; i < utf8.size(); i++)
+    {
+        char c = utf8[i];
+
+        if(c == '"' || c == '\\')
+        {
+            escaped += '\\';
+            escaped += c;
+        }
+        else if((uchar)c < 0x20)
+        {
+            escaped += "\\u00";
+            escaped += "0123456789abcdef"[(uchar)c >> 4];
+            escaped += "0123456789abcdef"[(uchar)c & 15];
+        }
+        else
+            escaped += c;
+    }
+
+    return escaped + "\"";
+}
+
+/******************************************************************************
+ * Function: trace_write_chrome_json
+ * Description: Writes the events of the most recent operations as a Chrome
+ *  trace: one complete ("X") event per scope, timestamps in microseconds,
+ *  with each scope's counter in its args. Operations carry their buffer pool
+ *  hits and misses, and a "buffer pool" counter ("C") event at their end
+ *  tracks the megabytes in use and idle.
+ * Parameters:
+ *   fileName - the .json file to write
+ *   operations - how many of the latest operations to include
+ * Returns: true if the file was written.
+ *****************************************************************************/
+bool trace_write_chrome_json(const QString& fileName, int operations)
+{
+    QList<TraceEvent> events;
+    int first;
+    {
+        QMutexLocker lock(&traceMutex);
+        events = traceEvents;
+        first = operationCount.load() - operations + 1;
+    }
+
+    QByteArray json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool comma = false;
+
+    for(int i = 0; i < events.size(); i++)
+    {
+        const TraceEvent& event = events[i];
+        bool operation = qstrcmp(event.category, "operation") == 0;
+
+        if(event.operation < first)
+            continue;
+
+        if(comma)
+            json += ",\n";
+        comma = true;
+
+        json += "{\"name\":" + json_string(event.name);
+        json += ",\"cat\":\"" + QByteArray(event.category) + "\"";
+        json += ",\"ph\":\"X\",\"pid\":1";
+        json += ",\"tid\":" + QByteArray::number(event.thread);
+        json += ",\"ts\":" + QByteArray::number(event.start * 1e6, 'f', 1);
+        json += ",\"dur\":" + QByteArray::number(event.duration * 1e6, 'f', 1);
+        json += ",\"args\":{\"operation\":" + QByteArray::number(event.operation);
+        if(event.counter != NULL)
+            json += ",\"" + QByteArray(event.counter) + "\":" + QByteArray::number(event.count);
+        if(operation)
+        {
+            json += ",\"pool hits\":" + QByteArray::number(event.poolHits);
+            json += ",\"pool misses\":" + QByteArray::number(event.poolMisses);
+        }
+        json += "}}";
+
+        if(operation)
+        {
+            json += ",\n{\"name\":\"buffer pool\",\"ph\":\"C\",\"pid\":1";
+            json += ",\"ts\":" + QByteArray::number((event.start + event.duration) * 1e6, 'f', 1);
+            json += ",\"args\":{\"in use MB\":" + QByteArray::number(event.poolInUse / 1048576.0, 'f', 1);
+            json += ",\"idle MB\":" + QByteArray::number(event.poolIdle / 1048576.0, 'f', 1) + "}}";
+        }
+    }
+
+    json += "\n]}\n";
+
+    QFile file(fileName);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    return file.write(json) == json.size();
+}
@@ -0,0 +1,100 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QByteArray>
+#include <QString>
+
+// How many of the most recent operations the trace keeps
+#define TRACE_MAX_OPERATIONS 64
+
+// The most events kept, however few operations they span
+#define TRACE_MAX_EVENTS 65536
+
+/******************************************************************************
+ * Lightweight tracing of where a filter's time goes.
+ *
+ * A TraceOperation marks one user level operation (a filter run); the
+ * TraceScopes inside it time its phases: allocating the output, converting
+ * the input format, each thread's share of the parallel loop, putting the
+ * result on screen. Scopes opened inside a parallel region are recorded per
+ * thread, with a count of the rows (or tiles, strips...) that thread did, so
+ * load imbalance shows up as uneven bars.
+ *
+ * Each operation also records how many of its allocations the buffer pool
+ * served, and the pool's size when it ends, shown as a counter track.
+ *
+ * Each thread has its own current operation, set by the TraceOperation it
+ * runs, so the scopes of operations running at once, such as thread
+ * calibration next to a filter, are told apart. OpenMP worker threads get it
+ * from the thread that starts the team: parallel regions that open
+ * TraceScopes copy it in with copyin(traceOperation).
+ *
+ * Only completed scopes are recorded, once each, under a mutex; scopes wrap
+ * whole phases, never single pixels, so the cost is a few microseconds per
+ * filter. The events of the last TRACE_MAX_OPERATIONS operations, at most
+ * TRACE_MAX_EVENTS of them, are kept and can be written out in the Chrome
+ * trace format (chrome://tracing, Perfetto) with trace_write_chrome_json().
+ *
+ * Tracing is off until trace_set_enabled() turns it on, as the GUI does.
+ * Batch runs and the benchmark leave it off, so their filters neither take
+ * the trace mutex nor collect events no one writes out.
+ *****************************************************************************/
+
+// The operation the calling thread's scopes belong to, 0 for none. __thread,
+// not thread_local: GCC cannot copyin an extern thread_local in a template.
+extern __thread int traceOperation;
+#pragma omp threadprivate(traceOperation)
+
+/******************************************************************************
+ * Class: TraceScope
+ * Description: Times the enclosing block on the calling thread.
+ *****************************************************************************/
+class TraceScope
+{
+public:
+    explicit TraceScope(const char* name, const char* counter = NULL);
+    ~TraceScope();
+
+    void add_count(qint64 units) { count += units; }
+
+private:
+    const char* name;
+    const char* counter;    // what add_count() counts, or NULL
+    qint64 count;
+    double start;
+    bool enabled;
+
+    TraceScope(const TraceScope&);
+    TraceScope& operator=(const TraceScope&);
+};
+
+/******************************************************************************
+ * Class: TraceOperation
+ * Description: Times an operation and groups the scopes recorded on its
+ *  thread, and the teams that thread starts, while it runs.
+ *****************************************************************************/
+class TraceOperation
+{
+public:
+    explicit TraceOperation(const QString& name);
+    ~TraceOperation();
+
+private:
+    QString name;
+    int id;
+    int previous;           // the thread's operation before this one
+    double start;
+    qint64 poolHits;        // the buffer pool counters when it started
+    qint64 poolMisses;
+    bool enabled;
+
+    TraceOperation(const TraceOperation&);
+    TraceOperation& operator=(const TraceOperation&);
+};
+
+void trace_set_enabled(bool enabled);
+
+bool trace_write_chrome_json(const QString& fileName, int operations);
+QByteArray json_string(const QString& text);
+
+#endif // TRACE_H